@@ -2,69 +2,434 @@
 #define ALGO_H_
 
 #include <cstdio>
-#include <immintrin.h>
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#include <type_traits>
+#include "cpu_dispatch.h"
 #include "detection_results_v2.pb.h"
 
 using namespace std;
 
 namespace Algo
 {
+    /**
+     * \brief Sample types supported by the derivative kernels
+     */
     template<typename T>
-    void stdVectorDerivative(const std::vector<T>& data, std::vector<uint32_t>& nonZeroGrad)
-    {
-        /* always fail at compile-time */
-        /* TODO: do we really need both lines?? */
-        static_assert(is_integral<T>::value == true,"Datatype not supported");
-        static_assert(is_integral<T>::value == false,"Datatype not supported");
-    }
-
-    template<>
-    void stdVectorDerivative<int8_t>(const std::vector<int8_t>& data, std::vector<uint32_t>& nonZeroGrad)
-    {
-        static char* data_aligned_a = nullptr;
-        static char* data_aligned_b = nullptr;
-        static uint32_t num_samples_old = 0;
-
-        uint32_t num_samples = data.size();
-        nonZeroGrad.resize(num_samples);
-        const size_t chunk_size = 32;
-        const size_t alignment = 32; // required by AVX256 instructions
-        /* calculate number of chucks by ceiling */
-        auto rational_ceil = [](size_t num, size_t denom) { return (num + denom - 1) / denom; };
-        uint32_t chunks = rational_ceil(num_samples*sizeof(data[0]),chunk_size);
-        size_t size = chunk_size * chunks;
-        if (num_samples != num_samples_old)
-        {
-            std::cout << "calcNumDetections(): allocting aligned memory" << std::endl;
-            delete data_aligned_a;
-            delete data_aligned_b;
-            data_aligned_a = (char*)aligned_alloc( alignment, size );
-            data_aligned_b = (char*)aligned_alloc( alignment, size );
-            num_samples_old = num_samples;
-        }
-        memset(data_aligned_a + num_samples * sizeof(data[0]), 0, (size - num_samples)*sizeof(data[0]));
-        memset(data_aligned_b + (num_samples-1) * sizeof(data[0]), 0, (size - num_samples + 1)*sizeof(data[0]));
-        assert(num_samples <= size && "Not enough memory for all detections");
-        memcpy(data_aligned_a, &data[0], num_samples);
-        assert(num_samples <= size && "Not enough memory for all detections");
-        memcpy(data_aligned_b, &data[1], num_samples - 1);
+    constexpr bool isDerivativeType = std::is_same_v<T, int8_t> || std::is_same_v<T, int16_t> ||
+                                      std::is_same_v<T, int32_t> || std::is_same_v<T, float>;
 
+    /**
+     * \brief Kernel writing the indices k in [first, num_samples - 1) with data[k] != data[k+1] to nonZeroGrad
+     *
+     * \details
+     *      nonZeroGrad must hold num_samples - 1 - first entries. data is neither
+     *      required to be aligned nor read outside of [first, num_samples).
+     *
+     * \return Number of indices written
+     */
+    template<typename T>
+    using DerivativeKernel = uint32_t (*)(const T* data, uint32_t first, uint32_t num_samples, uint32_t* nonZeroGrad);
+
+    /**
+     * \brief Scalar kernel, also used for inputs shorter than a single vector
+     */
+    template<typename T>
+    inline uint32_t derivativeScalar(const T* data, uint32_t first, uint32_t num_samples, uint32_t* nonZeroGrad)
+    {
+        uint32_t cntNonZeroGrads = 0;
+        for (uint32_t k = first; k + 1 < num_samples; k++)
+        {
+            if (data[k] != data[k + 1])
+            {
+                nonZeroGrad[cntNonZeroGrads++] = k;
+            }
+        }
+        return cntNonZeroGrads;
+    }
+
+    /**
+     * \brief Append the index k + (n >> shift) of each set bit n of bitmask
+     *
+     * \details
+     *      shift is 1 for masks with two identical bits per sample, of which only the lower one is set.
+     */
+    template<uint32_t shift, typename TMask>
+    inline uint32_t appendIndices(TMask bitmask, uint32_t k, uint32_t* nonZeroGrad)
+    {
         uint32_t cntNonZeroGrads = 0;
-        for (size_t n = 0; n < chunks; n++) /* for each chunk is the list of all detections */
-        {
-            __m256i data_a8 = _mm256_load_si256((__m256i_u const *)(data_aligned_a + n*chunk_size));
-            __m256i data_b8 = _mm256_load_si256((__m256i_u const *)(data_aligned_b + n*chunk_size));
-            __m256i result  = _mm256_sub_epi8 (data_b8, data_a8); // b - a
-            __m256i cmp_zeros_res = _mm256_cmpeq_epi8(result, _mm256_setzero_si256());
-
-            int bitmask = ~_mm256_movemask_epi8(cmp_zeros_res);
-            while (bitmask){
-                int i = __builtin_ctz(bitmask);  /* Count the number of trailing zero bits in bitmask. */
-                nonZeroGrad[cntNonZeroGrads++] = (i + n*chunk_size);
-                bitmask = bitmask & (bitmask-1); /* Clear the lowest set bit in k.                     */
+        for (; bitmask != 0; bitmask &= bitmask - 1) /* clear the lowest set bit */
+        {
+            nonZeroGrad[cntNonZeroGrads++] = k + (__builtin_ctzll(bitmask) >> shift);
+        }
+        return cntNonZeroGrads;
+    }
+
+#if CPU_DISPATCH_X86
+    /*
+     * The SIMD kernels compare a chunk of samples with the same chunk shifted by
+     * one sample, both read with unaligned loads directly from the input. The
+     * last chunk of the SSE and AVX2 kernels ends at the last sample and overlaps
+     * the previous chunk, whose pairs are masked out. AVX-512 masks the loads of
+     * the last chunk instead.
+     */
+
+    /**
+     * \brief One bit per pair of data[0..16 / sizeof(T)] that differs, two bits per pair of int16_t
+     */
+    template<typename T>
+    TARGET_SSE42 inline uint32_t neqMaskSse42(const T* data)
+    {
+        if constexpr (std::is_same_v<T, float>)
+        {
+            return _mm_movemask_ps(_mm_cmpneq_ps(_mm_loadu_ps(data), _mm_loadu_ps(data + 1)));
+        }
+        else
+        {
+            __m128i data_a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+            __m128i data_b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 1));
+            if constexpr (sizeof(T) == 1)
+            {
+                return ~_mm_movemask_epi8(_mm_cmpeq_epi8(data_a, data_b)) & 0xffff;
+            }
+            else if constexpr (sizeof(T) == 2)
+            {
+                return ~_mm_movemask_epi8(_mm_cmpeq_epi16(data_a, data_b)) & 0x5555;
+            }
+            else
+            {
+                return ~_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(data_a, data_b))) & 0xf;
+            }
+        }
+    }
+
+    template<typename T>
+    TARGET_AVX2 inline uint32_t neqMaskAvx2(const T* data)
+    {
+        if constexpr (std::is_same_v<T, float>)
+        {
+            return _mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(data), _mm256_loadu_ps(data + 1), _CMP_NEQ_UQ));
+        }
+        else
+        {
+            __m256i data_a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data));
+            __m256i data_b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + 1));
+            if constexpr (sizeof(T) == 1)
+            {
+                return ~_mm256_movemask_epi8(_mm256_cmpeq_epi8(data_a, data_b));
+            }
+            else if constexpr (sizeof(T) == 2)
+            {
+                return ~_mm256_movemask_epi8(_mm256_cmpeq_epi16(data_a, data_b)) & 0x55555555;
+            }
+            else
+            {
+                return ~_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(data_a, data_b))) & 0xff;
+            }
+        }
+    }
+
+    template<typename T>
+    TARGET_SSE42 inline uint32_t derivativeSse42(const T* data, uint32_t first, uint32_t num_samples, uint32_t* nonZeroGrad)
+    {
+        const uint32_t chunk_size = 16 / sizeof(T);
+        const uint32_t shift = (sizeof(T) == 2) ? 1 : 0;
+        if (num_samples < first + chunk_size + 1)
+        {
+            return derivativeScalar(data, first, num_samples, nonZeroGrad);
+        }
+        const uint32_t last_chunk = num_samples - 1 - chunk_size;
+        uint32_t cntNonZeroGrads = 0;
+        uint32_t k = first;
+        for (; k < last_chunk; k += chunk_size) /* for each chunk of pairs */
+        {
+            cntNonZeroGrads += appendIndices<shift>(neqMaskSse42(data + k), k, nonZeroGrad + cntNonZeroGrads);
+        }
+        uint32_t bitmask = neqMaskSse42(data + last_chunk) & (~0u << ((k - last_chunk) << shift));
+        return cntNonZeroGrads + appendIndices<shift>(bitmask, last_chunk, nonZeroGrad + cntNonZeroGrads);
+    }
+
+    template<typename T>
+    TARGET_AVX2 inline uint32_t derivativeAvx2(const T* data, uint32_t first, uint32_t num_samples, uint32_t* nonZeroGrad)
+    {
+        const uint32_t chunk_size = 32 / sizeof(T);
+        const uint32_t shift = (sizeof(T) == 2) ? 1 : 0;
+        if (num_samples < first + chunk_size + 1)
+        {
+            return derivativeSse42(data, first, num_samples, nonZeroGrad);
+        }
+        const uint32_t last_chunk = num_samples - 1 - chunk_size;
+        uint32_t cntNonZeroGrads = 0;
+        uint32_t k = first;
+        for (; k < last_chunk; k += chunk_size) /* for each chunk of pairs */
+        {
+            cntNonZeroGrads += appendIndices<shift>(neqMaskAvx2(data + k), k, nonZeroGrad + cntNonZeroGrads);
+        }
+        uint32_t bitmask = neqMaskAvx2(data + last_chunk) & (~0u << ((k - last_chunk) << shift));
+        return cntNonZeroGrads + appendIndices<shift>(bitmask, last_chunk, nonZeroGrad + cntNonZeroGrads);
+    }
+
+    template<typename T>
+    TARGET_AVX512 inline uint32_t derivativeAvx512(const T* data, uint32_t first, uint32_t num_samples, uint32_t* nonZeroGrad)
+    {
+        const uint32_t chunk_size = 64 / sizeof(T);
+        uint32_t cntNonZeroGrads = 0;
+        for (uint32_t k = first; k + 1 < num_samples; k += chunk_size) /* for each chunk of pairs */
+        {
+            /* masked loads never touch the samples behind the last one */
+            uint32_t num_pairs = std::min(chunk_size, num_samples - 1 - k);
+            uint64_t lanes = (num_pairs == 64) ? ~0ull : (1ull << num_pairs) - 1;
+            uint64_t bitmask;
+            if constexpr (std::is_same_v<T, float>)
+            {
+                __m512 data_a = _mm512_maskz_loadu_ps(lanes, data + k);
+                __m512 data_b = _mm512_maskz_loadu_ps(lanes, data + k + 1);
+                bitmask = _mm512_mask_cmp_ps_mask(lanes, data_a, data_b, _CMP_NEQ_UQ);
+            }
+            else if constexpr (sizeof(T) == 1)
+            {
+                __m512i data_a = _mm512_maskz_loadu_epi8(lanes, data + k);
+                __m512i data_b = _mm512_maskz_loadu_epi8(lanes, data + k + 1);
+                bitmask = _mm512_mask_cmpneq_epi8_mask(lanes, data_a, data_b);
+            }
+            else if constexpr (sizeof(T) == 2)
+            {
+                __m512i data_a = _mm512_maskz_loadu_epi16(lanes, data + k);
+                __m512i data_b = _mm512_maskz_loadu_epi16(lanes, data + k + 1);
+                bitmask = _mm512_mask_cmpneq_epi16_mask(lanes, data_a, data_b);
+            }
+            else
+            {
+                __m512i data_a = _mm512_maskz_loadu_epi32(lanes, data + k);
+                __m512i data_b = _mm512_maskz_loadu_epi32(lanes, data + k + 1);
+                bitmask = _mm512_mask_cmpneq_epi32_mask(lanes, data_a, data_b);
+            }
+            cntNonZeroGrads += appendIndices<0>(bitmask, k, nonZeroGrad + cntNonZeroGrads);
+        }
+        return cntNonZeroGrads;
+    }
+#endif
+
+    /**
+     * \brief Kernel for an instruction set, the next less capable one if there is none
+     */
+    template<typename T>
+    inline DerivativeKernel<T> derivativeKernel(CpuDispatch::Isa isa)
+    {
+        static_assert(isDerivativeType<T>, "Datatype not supported");
+#if CPU_DISPATCH_X86
+        switch (isa)
+        {
+            case CpuDispatch::Isa::Avx512: return derivativeAvx512<T>;
+            case CpuDispatch::Isa::Avx2:   return derivativeAvx2<T>;
+            case CpuDispatch::Isa::Sse42:  return derivativeSse42<T>;
+            default:                       break;
+        }
+#endif
+        (void)isa;
+        return derivativeScalar<T>;
+    }
+
+    /**
+     * \brief Sample types supported by the threshold mask kernels
+     */
+    template<typename T>
+    constexpr bool isMaskType = std::is_same_v<T, int8_t> || std::is_same_v<T, int16_t>;
+
+    /**
+     * \brief Kernel setting bit k % 64 of bits[k / 64] for each sample with data[k] >= threshold
+     *
+     * \details
+     *      bits must hold (num_samples + 63) / 64 words, the bits behind the last sample are cleared.
+     */
+    template<typename T>
+    using ThresholdMaskKernel = void (*)(const T* data, uint32_t num_samples, T threshold, uint64_t* bits);
+
+    template<typename T>
+    inline void thresholdMaskScalar(const T* data, uint32_t num_samples, T threshold, uint64_t* bits)
+    {
+        for (uint32_t w = 0; w * 64 < num_samples; w++)
+        {
+            uint32_t num_bits = std::min(64u, num_samples - w * 64);
+            uint64_t word = 0;
+            for (uint32_t b = 0; b < num_bits; b++)
+            {
+                word |= uint64_t(data[w * 64 + b] >= threshold) << b;
+            }
+            bits[w] = word;
+        }
+    }
+
+#if CPU_DISPATCH_X86
+    /*
+     * Full words of 64 samples are compared in vectors, a partial last word by
+     * the scalar kernel. The comparisons of int16_t samples are packed to bytes
+     * with signed saturation, which keeps their sign, to get one bit per sample.
+     */
+
+    /**
+     * \brief One bit per sample of data[0..16] below threshold
+     */
+    template<typename T>
+    TARGET_SSE42 inline uint32_t belowMaskSse42(const T* data, T threshold)
+    {
+        __m128i data_a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+        if constexpr (sizeof(T) == 1)
+        {
+            return _mm_movemask_epi8(_mm_cmpgt_epi8(_mm_set1_epi8(threshold), data_a));
+        }
+        else
+        {
+            const __m128i threshold16 = _mm_set1_epi16(threshold);
+            __m128i data_b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 8));
+            return _mm_movemask_epi8(_mm_packs_epi16(_mm_cmpgt_epi16(threshold16, data_a),
+                                                     _mm_cmpgt_epi16(threshold16, data_b)));
+        }
+    }
+
+    /**
+     * \brief One bit per sample of data[0..32] below threshold
+     */
+    template<typename T>
+    TARGET_AVX2 inline uint32_t belowMaskAvx2(const T* data, T threshold)
+    {
+        __m256i data_a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data));
+        if constexpr (sizeof(T) == 1)
+        {
+            return _mm256_movemask_epi8(_mm256_cmpgt_epi8(_mm256_set1_epi8(threshold), data_a));
+        }
+        else
+        {
+            /* packing interleaves the 128 bit halves of both vectors */
+            const __m256i threshold16 = _mm256_set1_epi16(threshold);
+            __m256i data_b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + 16));
+            __m256i packed = _mm256_packs_epi16(_mm256_cmpgt_epi16(threshold16, data_a),
+                                                _mm256_cmpgt_epi16(threshold16, data_b));
+            return _mm256_movemask_epi8(_mm256_permute4x64_epi64(packed, 0xd8));
+        }
+    }
+
+    template<typename T>
+    TARGET_SSE42 inline void thresholdMaskSse42(const T* data, uint32_t num_samples, T threshold, uint64_t* bits)
+    {
+        uint32_t w = 0;
+        for (; (w + 1) * 64 <= num_samples; w++)
+        {
+            uint64_t below = 0;
+            for (uint32_t v = 0; v < 4; v++)
+            {
+                below |= uint64_t(belowMaskSse42(data + w * 64 + v * 16, threshold)) << (v * 16);
             }
+            bits[w] = ~below;
         }
-        nonZeroGrad.resize(cntNonZeroGrads);
+        thresholdMaskScalar<T>(data + w * 64, num_samples - w * 64, threshold, bits + w);
+    }
+
+    template<typename T>
+    TARGET_AVX2 inline void thresholdMaskAvx2(const T* data, uint32_t num_samples, T threshold, uint64_t* bits)
+    {
+        uint32_t w = 0;
+        for (; (w + 1) * 64 <= num_samples; w++)
+        {
+            uint64_t below_lo = belowMaskAvx2(data + w * 64, threshold);
+            uint64_t below_hi = belowMaskAvx2(data + w * 64 + 32, threshold);
+            bits[w] = ~(below_lo | (below_hi << 32));
+        }
+        thresholdMaskScalar<T>(data + w * 64, num_samples - w * 64, threshold, bits + w);
+    }
+
+    template<typename T>
+    TARGET_AVX512 inline void thresholdMaskAvx512(const T* data, uint32_t num_samples, T threshold, uint64_t* bits)
+    {
+        for (uint32_t w = 0; w * 64 < num_samples; w++)
+        {
+            /* masked loads never touch the samples behind the last one */
+            uint32_t num_bits = std::min(64u, num_samples - w * 64);
+            __mmask64 lanes = (num_bits == 64) ? ~0ull : (1ull << num_bits) - 1;
+            if constexpr (sizeof(T) == 1)
+            {
+                __m512i data8 = _mm512_maskz_loadu_epi8(lanes, data + w * 64);
+                bits[w] = _mm512_mask_cmpge_epi8_mask(lanes, data8, _mm512_set1_epi8(threshold));
+            }
+            else
+            {
+                const __m512i threshold16 = _mm512_set1_epi16(threshold);
+                __mmask32 lanes_lo = __mmask32(lanes);
+                __mmask32 lanes_hi = __mmask32(lanes >> 32);
+                __m512i data_lo = _mm512_maskz_loadu_epi16(lanes_lo, data + w * 64);
+                __m512i data_hi = _mm512_maskz_loadu_epi16(lanes_hi, data + w * 64 + 32);
+                uint64_t above_lo = _mm512_mask_cmpge_epi16_mask(lanes_lo, data_lo, threshold16);
+                uint64_t above_hi = _mm512_mask_cmpge_epi16_mask(lanes_hi, data_hi, threshold16);
+                bits[w] = above_lo | (above_hi << 32);
+            }
+        }
+    }
+#endif
+
+    /**
+     * \brief Kernel for an instruction set, the next less capable one if there is none
+     */
+    template<typename T>
+    inline ThresholdMaskKernel<T> thresholdMaskKernel(CpuDispatch::Isa isa)
+    {
+        static_assert(isMaskType<T>, "Unsupported sample type");
+#if CPU_DISPATCH_X86
+        switch (isa)
+        {
+            case CpuDispatch::Isa::Avx512: return thresholdMaskAvx512<T>;
+            case CpuDispatch::Isa::Avx2:   return thresholdMaskAvx2<T>;
+            case CpuDispatch::Isa::Sse42:  return thresholdMaskSse42<T>;
+            default:                       break;
+        }
+#endif
+        (void)isa;
+        return thresholdMaskScalar<T>;
+    }
+
+    /**
+     * \brief Bit mask of the samples with data[k] >= threshold, see ThresholdMaskKernel
+     *
+     * The kernel is selected once from the instruction sets supported by the CPU.
+     */
+    template<typename T>
+    inline void thresholdMask(const T* data, uint32_t num_samples, T threshold, uint64_t* bits)
+    {
+        static const ThresholdMaskKernel<T> kernel = thresholdMaskKernel<T>(CpuDispatch::isa());
+        kernel(data, num_samples, threshold, bits);
+    }
+
+    /**
+     * \brief Indices k in [first, last) with data[k] != data[k+1], where k + 1 < num_samples
+     *
+     * \details
+     *      The last sample of the range is compared with its successor, so that the
+     *      results of adjacent ranges add up to the result of the whole input and
+     *      ranges can be processed concurrently. The kernel is selected once from
+     *      the instruction sets supported by the CPU.
+     */
+    template<typename T>
+    inline void derivativeRange(const T* data, uint32_t num_samples, uint32_t first, uint32_t last,
+                                std::vector<uint32_t>& nonZeroGrad)
+    {
+        static const DerivativeKernel<T> kernel = derivativeKernel<T>(CpuDispatch::isa());
+        uint32_t end = std::min<uint64_t>(uint64_t(last) + 1, num_samples);
+        if (first + 1 >= uint64_t(end))
+        {
+            nonZeroGrad.clear();
+            return;
+        }
+        nonZeroGrad.resize(end - 1 - first);
+        nonZeroGrad.resize(kernel(data, first, end, nonZeroGrad.data()));
+    }
+
+    /**
+     * \brief Indices k with data[k] != data[k+1]
+     */
+    template<typename T>
+    inline void stdVectorDerivative(const std::vector<T>& data, std::vector<uint32_t>& nonZeroGrad)
+    {
+        derivativeRange(data.data(), data.size(), 0, data.size(), nonZeroGrad);
     }
 };
 
@@ -0,0 +1,402 @@
+/**
+ * Columnar cache of the analysis results of a record file.
+ *
+ * Stores everything the UI needs after a scan: the number of detections above
+ * each threshold level per class and image, the track breaks per image,
+ * timestamps and points of interest. The levels are stored as the bit-packed
+ * blocks of their EncodedColumn, so that they are appended to the columns
+ * without encoding them again. The cache is written next to the record file and
+ * memory-mapped on open, so that reopening a file does not require to parse any
+ * record. The record offsets are taken from the offset index sidecar.
+ *
+ * A cache is only valid for the evaluator, threshold levels and classes it was
+ * computed with, and for the version of the record file it was computed from.
+ * The counts of a threshold are the levels of that threshold, the points of
+ * interest refer to the threshold stored in the header.
+ *
+ * Layout (all sections 8-byte aligned):
+ *      Header
+ *      int32_t  classIds[numClasses]
+ *      int32_t  thresholdLevels[numLevels]
+ *      numClasses x numLevels x { uint64_t numBytes; char levels[numBytes]; }, see EncodedColumn::write()
+ *      uint8_t  trackBreaks[numFrames]
+ *      uint64_t timestamps[numFrames]
+ *      numClasses x { uint64_t numPois; uint32_t pois[numPois]; }
+ */
+
+#ifndef COLUMN_CACHE_H_
+#define COLUMN_CACHE_H_
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <filesystem>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "encoded_column.h"
+#include "offset_index.h"
+
+using namespace std;
+namespace fs = std::filesystem;
+
+/**
+ * \brief Everything a cache depends on
+ */
+struct ColumnCacheKey
+{
+    std::string evaluator;
+    int threshold = 0;
+    std::vector<int> thresholdLevels;
+    std::vector<int> classIds;
+    FileStamp stamp;
+};
+
+class ColumnCache
+{
+    public:
+        static constexpr char MAGIC[8] = {'I','A','C','O','L','S','\0','\0'};
+        static constexpr uint32_t VERSION = 5;
+
+        struct Header
+        {
+            char magic[8];
+            uint32_t version;
+            uint32_t numClasses;
+            char evaluator[64];
+            int32_t threshold;
+            uint32_t numLevels;
+            uint64_t fileSize;
+            int64_t fileMtime;
+            uint64_t numFrames;
+        };
+
+        ColumnCache() = default;
+        ColumnCache(const ColumnCache&) = delete;
+        ColumnCache& operator=(const ColumnCache&) = delete;
+
+        ~ColumnCache()
+        {
+            unmap();
+        }
+
+        static fs::path cachePath(const fs::path& recordFile)
+        {
+            fs::path p(recordFile);
+            p += ".cols";
+            return p;
+        }
+
+        void clear()
+        {
+            unmap();
+        }
+
+        bool isValid() const
+        {
+            return m_mapping != nullptr;
+        }
+
+        uint64_t numFrames() const
+        {
+            return m_numFrames;
+        }
+
+        /**
+         * \brief Threshold, the POIs have been computed for
+         */
+        int threshold() const
+        {
+            return m_threshold;
+        }
+
+        /**
+         * \brief Number of detections of a class above a threshold level of each frame,
+         *        numBytes serialized by EncodedColumn::write()
+         */
+        const char* levels(unsigned classIdx, unsigned level, uint64_t& numBytes) const
+        {
+            numBytes = m_levelBytes[classIdx * m_numLevels + level];
+            return m_levels[classIdx * m_numLevels + level];
+        }
+
+        /**
+         * \brief Number of track breaks of each frame
+         */
+        const uint8_t* trackBreaks() const
+        {
+            return m_trackBreaks;
+        }
+
+        const uint64_t* timestamps() const
+        {
+            return m_timestamps;
+        }
+
+        /**
+         * \brief POIs of a class as indices within the record file
+         */
+        const uint32_t* pois(unsigned classIdx, uint64_t& numPois) const
+        {
+            numPois = m_numPois[classIdx];
+            return m_pois[classIdx];
+        }
+
+        /**
+         * \brief Memory-map a cache, if it has been computed for key
+         */
+        bool load(const fs::path& fname, const ColumnCacheKey& key)
+        {
+            unmap();
+            int fd = ::open(fname.c_str(), O_RDONLY);
+            if (fd < 0)
+            {
+                return false;
+            }
+            struct stat st;
+            if (fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(Header))
+            {
+                ::close(fd);
+                return false;
+            }
+            void* addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            ::close(fd);
+            if (addr == MAP_FAILED)
+            {
+                return false;
+            }
+            m_mapping = addr;
+            m_mappingSize = st.st_size;
+            if ( !parse(key) )
+            {
+                unmap();
+                return false;
+            }
+            return true;
+        }
+
+        /**
+         * \brief Write a cache
+         *
+         * \details
+         *      The columns are views, whose values are written piece by piece through
+         *      forEachSegment(fn(const T* values, size_t n)) without copying them. The
+         *      levels are written through write(fn(const void* data, size_t n)).
+         *
+         * \param levels Per class and threshold level the number of detections of each image
+         * \param trackBreaks Number of track breaks of each image
+         * \param pois Per class the points of interest
+         */
+        template<typename TLevels, typename TTrackBreaks, typename TTimestamps>
+        static bool save(const fs::path& fname, const ColumnCacheKey& key,
+                         const std::vector< std::vector<TLevels> >& levels,
+                         const TTrackBreaks& trackBreaks,
+                         const TTimestamps& timestamps,
+                         const std::vector< std::vector<uint32_t> >& pois)
+        {
+            Header hdr;
+            memset(&hdr, 0, sizeof(hdr));
+            memcpy(hdr.magic, MAGIC, sizeof(MAGIC));
+            hdr.version = VERSION;
+            hdr.numClasses = key.classIds.size();
+            strncpy(hdr.evaluator, key.evaluator.c_str(), sizeof(hdr.evaluator) - 1);
+            hdr.threshold = key.threshold;
+            hdr.numLevels = key.thresholdLevels.size();
+            hdr.fileSize = key.stamp.size;
+            hdr.fileMtime = key.stamp.mtime;
+            hdr.numFrames = timestamps.size();
+
+            /* write to a temporary file first, so that readers never see a partial cache */
+            fs::path tmp(fname);
+            tmp += ".tmp";
+            {
+                ofstream output(tmp, ios::out | ios::trunc | ios::binary);
+                const char zeros[8] = {0};
+                auto write = [&output, &zeros](const void* data, size_t n) {
+                    output.write(static_cast<const char*>(data), n);
+                    output.write(zeros, padding(n));
+                };
+                auto writeColumn = [&output](const auto& column) {
+                    column.forEachSegment([&output](const auto* values, size_t n) {
+                        output.write(reinterpret_cast<const char*>(values), n * sizeof(*values));
+                    });
+                };
+                write(&hdr, sizeof(hdr));
+                std::vector<int32_t> classIds(key.classIds.begin(), key.classIds.end());
+                write(classIds.data(), classIds.size() * sizeof(int32_t));
+                std::vector<int32_t> thresholdLevels(key.thresholdLevels.begin(), key.thresholdLevels.end());
+                write(thresholdLevels.data(), thresholdLevels.size() * sizeof(int32_t));
+                for (auto& classLevels : levels)
+                {
+                    for (auto& column : classLevels)
+                    {
+                        uint64_t numBytes = 0;
+                        column.write([&numBytes](const void*, size_t n) { numBytes += n; });
+                        write(&numBytes, sizeof(numBytes));
+                        column.write([&output](const void* data, size_t n) {
+                            output.write(static_cast<const char*>(data), n);
+                        });
+                        output.write(zeros, padding(numBytes));
+                    }
+                }
+                writeColumn(trackBreaks);
+                output.write(zeros, padding(hdr.numFrames));
+                writeColumn(timestamps);
+                for (auto& classPois : pois)
+                {
+                    uint64_t numPois = classPois.size();
+                    write(&numPois, sizeof(numPois));
+                    write(classPois.data(), classPois.size() * sizeof(uint32_t));
+                }
+                if ( !output )
+                {
+                    std::cerr << "Failed to write column cache " << fname << std::endl;
+                    return false;
+                }
+            }
+            std::error_code ec;
+            fs::rename(tmp, fname, ec);
+            return !ec;
+        }
+
+    private:
+        static size_t padding(size_t n)
+        {
+            return (8 - n % 8) % 8;
+        }
+
+        /**
+         * \brief Validate the mapped cache against key and set up the section pointers
+         */
+        bool parse(const ColumnCacheKey& key)
+        {
+            const char* base = static_cast<const char*>(m_mapping);
+            const Header* hdr = reinterpret_cast<const Header*>(base);
+            if ( memcmp(hdr->magic, MAGIC, sizeof(MAGIC)) != 0 ||
+                 hdr->version != VERSION ||
+                 strncmp(hdr->evaluator, key.evaluator.c_str(), sizeof(hdr->evaluator)) != 0 ||
+                 hdr->numClasses != key.classIds.size() ||
+                 hdr->numLevels != key.thresholdLevels.size() ||
+                 hdr->fileSize != key.stamp.size ||
+                 hdr->fileMtime != key.stamp.mtime )
+            {
+                return false;
+            }
+            uint64_t numFrames = hdr->numFrames;
+            uint32_t numClasses = hdr->numClasses;
+            uint32_t numLevels = hdr->numLevels;
+            if (numFrames > m_mappingSize)
+            {
+                return false;
+            }
+            size_t off = sizeof(Header);
+            auto section = [&](size_t n) -> const char* {
+                if (off > m_mappingSize || n > m_mappingSize - off)
+                {
+                    return nullptr;
+                }
+                const char* p = base + off;
+                off += n + padding(n);
+                return p;
+            };
+            auto classIds = reinterpret_cast<const int32_t*>(section(numClasses * sizeof(int32_t)));
+            auto thresholdLevels = reinterpret_cast<const int32_t*>(section(numLevels * sizeof(int32_t)));
+            if ( !classIds || !thresholdLevels )
+            {
+                return false;
+            }
+            m_levels.resize(numClasses * numLevels);
+            m_levelBytes.resize(numClasses * numLevels);
+            for (uint32_t k = 0; k < numClasses * numLevels; k++)
+            {
+                auto numBytes = reinterpret_cast<const uint64_t*>(section(sizeof(uint64_t)));
+                if ( !numBytes )
+                {
+                    return false;
+                }
+                m_levelBytes[k] = *numBytes;
+                m_levels[k] = section(m_levelBytes[k]);
+                uint64_t numValues = 0;
+                if ( !m_levels[k] || !EncodedColumn::checkStored(m_levels[k], m_levelBytes[k], numValues) ||
+                     numValues != numFrames )
+                {
+                    return false;
+                }
+            }
+            m_trackBreaks = reinterpret_cast<const uint8_t*>(section(numFrames));
+            m_timestamps = reinterpret_cast<const uint64_t*>(section(numFrames * sizeof(uint64_t)));
+            if ( !m_trackBreaks || !m_timestamps )
+            {
+                return false;
+            }
+            for (uint32_t l = 0; l < numLevels; l++)
+            {
+                if (thresholdLevels[l] != key.thresholdLevels[l])
+                {
+                    return false;
+                }
+            }
+            for (uint32_t k = 0; k < numClasses; k++)
+            {
+                if (classIds[k] != key.classIds[k])
+                {
+                    return false;
+                }
+            }
+            m_pois.resize(numClasses);
+            m_numPois.resize(numClasses);
+            for (uint32_t k = 0; k < numClasses; k++)
+            {
+                auto numPois = reinterpret_cast<const uint64_t*>(section(sizeof(uint64_t)));
+                if ( !numPois || *numPois > numFrames )
+                {
+                    return false;
+                }
+                m_numPois[k] = *numPois;
+                m_pois[k] = reinterpret_cast<const uint32_t*>(section(m_numPois[k] * sizeof(uint32_t)));
+                if ( !m_pois[k] )
+                {
+                    return false;
+                }
+            }
+            m_numFrames = numFrames;
+            m_numLevels = numLevels;
+            m_threshold = hdr->threshold;
+            return true;
+        }
+
+        void unmap()
+        {
+            if (m_mapping != nullptr)
+            {
+                munmap(m_mapping, m_mappingSize);
+                m_mapping = nullptr;
+            }
+            m_numFrames = 0;
+            m_levels.clear();
+            m_levelBytes.clear();
+            m_pois.clear();
+            m_numPois.clear();
+        }
+
+        void* m_mapping = nullptr;
+        size_t m_mappingSize = 0;
+        uint64_t m_numFrames = 0;
+        uint32_t m_numLevels = 0;
+        int m_threshold = 0;
+        /* per class and threshold level */
+        std::vector<const char*> m_levels;
+        std::vector<uint64_t> m_levelBytes;
+        const uint8_t* m_trackBreaks = nullptr;
+        const uint64_t* m_timestamps = nullptr;
+        std::vector<const uint32_t*> m_pois;
+        std::vector<uint64_t> m_numPois;
+};
+
+#endif /* COLUMN_CACHE_H_ */
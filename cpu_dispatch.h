@@ -0,0 +1,109 @@
+/**
+ * Runtime selection of the instruction set used by the SIMD kernels.
+ *
+ * The binary is built for the baseline x86-64 target. Kernels for newer
+ * instruction sets are compiled with the TARGET_* attributes below and are
+ * selected once, on first use, from the CPUID feature flags. The environment
+ * variable IMAGE_ANALYSIS_ISA (scalar, sse4.2, avx2, avx512) restricts the
+ * selection, e.g. to benchmark each path on the same machine.
+ */
+
+#ifndef CPU_DISPATCH_H_
+#define CPU_DISPATCH_H_
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CPU_DISPATCH_X86 1
+#include <immintrin.h>
+#define TARGET_SSE42  __attribute__((target("sse4.2,popcnt")))
+#define TARGET_AVX2   __attribute__((target("avx2,popcnt,bmi")))
+#define TARGET_AVX512 __attribute__((target("avx512f,avx512bw,popcnt,bmi")))
+#else
+#define CPU_DISPATCH_X86 0
+#endif
+
+namespace CpuDispatch
+{
+    /* ordered by capability, each level requires the previous ones */
+    enum class Isa { Scalar, Sse42, Avx2, Avx512 };
+
+    inline const char* isaName(Isa isa)
+    {
+        switch (isa)
+        {
+            case Isa::Sse42:  return "sse4.2";
+            case Isa::Avx2:   return "avx2";
+            case Isa::Avx512: return "avx512";
+            default:          return "scalar";
+        }
+    }
+
+    /**
+     * \brief Most capable instruction set supported by CPU and OS
+     */
+    inline Isa detectIsa()
+    {
+#if CPU_DISPATCH_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw"))
+        {
+            return Isa::Avx512;
+        }
+        if (__builtin_cpu_supports("avx2"))
+        {
+            return Isa::Avx2;
+        }
+        if (__builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("popcnt"))
+        {
+            return Isa::Sse42;
+        }
+#endif
+        return Isa::Scalar;
+    }
+
+    /**
+     * \brief Detected instruction set, limited by IMAGE_ANALYSIS_ISA
+     *
+     * \details
+     *      An override can only lower the selection, instruction sets not supported
+     *      by the CPU are never used. Only an invalid override is reported.
+     */
+    inline Isa selectIsa()
+    {
+        Isa detected = detectIsa();
+        const char* env = std::getenv("IMAGE_ANALYSIS_ISA");
+        if (env == nullptr || *env == '\0')
+        {
+            return detected;
+        }
+        for (Isa isa : {Isa::Scalar, Isa::Sse42, Isa::Avx2, Isa::Avx512})
+        {
+            if (strcmp(env, isaName(isa)) == 0)
+            {
+                if (isa > detected)
+                {
+                    std::cerr << "IMAGE_ANALYSIS_ISA=" << env << " is not supported by this CPU, using "
+                              << isaName(detected) << std::endl;
+                    return detected;
+                }
+                return isa;
+            }
+        }
+        std::cerr << "Unknown IMAGE_ANALYSIS_ISA=" << env << ", using " << isaName(detected) << std::endl;
+        return detected;
+    }
+
+    /**
+     * \brief Instruction set used by all kernels, selected on first call
+     */
+    inline Isa isa()
+    {
+        static const Isa selected = selectIsa();
+        return selected;
+    }
+};
+
+#endif /* CPU_DISPATCH_H_ */
@@ -2,10 +2,12 @@
 #define DATAMODEL_H_
 
 #include <memory>
+#include <cstdint>
 #include <fstream>
 #include <string>
 #include <mutex>
 #include <future>
+#include <functional>
 #include <filesystem>
 
 using namespace std;
@@ -19,11 +21,59 @@ class DataModel
 
     public:
         // workaround to avoid virtual functions using CRTP
-        std::vector<int8_t> getNumDetections(uint8_t classIdx)
+        std::vector<int16_t> getNumDetections(uint8_t classIdx)
         {
             return static_cast<T*>(this)->getNumDetections(classIdx);
         }
 
+        std::vector<int16_t> getNumDetectionsRange(uint8_t classIdx, uint32_t from, uint32_t to)
+        {
+            return static_cast<T*>(this)->getNumDetectionsRange(classIdx, from, to);
+        }
+
+        auto getNumDetectionsView(uint8_t classIdx, uint32_t from = 0, uint32_t to = UINT32_MAX)
+        {
+            return static_cast<T*>(this)->getNumDetectionsView(classIdx, from, to);
+        }
+
+        auto getNumDetectionsEnvelope(uint8_t classIdx, uint32_t from, uint32_t to, uint32_t numBins)
+        {
+            return static_cast<T*>(this)->getNumDetectionsEnvelope(classIdx, from, to, numBins);
+        }
+
+        std::vector<uint8_t> getTrackBreaks(uint32_t from, uint32_t to)
+        {
+            return static_cast<T*>(this)->getTrackBreaks(from, to);
+        }
+
+        template<typename TResult>
+        bool evaluateGroundTruth(const fs::path& fname, TResult& result)
+        {
+            return static_cast<T*>(this)->evaluateGroundTruth(fname, result);
+        }
+
+        template<typename TParams>
+        bool setFilter(const TParams& params)
+        {
+            return static_cast<T*>(this)->setFilter(params);
+        }
+
+        template<typename TParams>
+        void setSegmentation(bool enable, const TParams& params)
+        {
+            return static_cast<T*>(this)->setSegmentation(enable, params);
+        }
+
+        auto getSegments(uint8_t classIdx)
+        {
+            return static_cast<T*>(this)->getSegments(classIdx);
+        }
+
+        bool saveSegments(const fs::path& fname)
+        {
+            return static_cast<T*>(this)->saveSegments(fname);
+        }
+
         void open(string fname)
         {
             return static_cast<T*>(this)->open(fname);
@@ -34,6 +84,46 @@ class DataModel
             return static_cast<T*>(this)->load();
         }
 
+        void cancelLoad()
+        {
+            return static_cast<T*>(this)->cancelLoad();
+        }
+
+        void setLoadCallback(std::function<void(uint32_t numLoaded, bool finished)> callback)
+        {
+            return static_cast<T*>(this)->setLoadCallback(callback);
+        }
+
+        void setFollowMode(bool enable)
+        {
+            return static_cast<T*>(this)->setFollowMode(enable);
+        }
+
+        void setClassIds(const std::vector<int>& classIds)
+        {
+            return static_cast<T*>(this)->setClassIds(classIds);
+        }
+
+        const std::vector<int>& getClassIds()
+        {
+            return static_cast<T*>(this)->getClassIds();
+        }
+
+        bool setThreshold(int threshold)
+        {
+            return static_cast<T*>(this)->setThreshold(threshold);
+        }
+
+        int getThreshold()
+        {
+            return static_cast<T*>(this)->getThreshold();
+        }
+
+        uint32_t getNumLoaded()
+        {
+            return static_cast<T*>(this)->getNumLoaded();
+        }
+
         fs::path getItemByIdx(uint64_t idx)
         {
             return static_cast<T*>(this)->getItemByIdx(idx);
@@ -49,6 +139,16 @@ class DataModel
             return static_cast<T*>(this)->prevPoi(idx);
         }
 
+        void setPoiFilter(const std::vector<int>& classIds, bool trackBreaks = true)
+        {
+            return static_cast<T*>(this)->setPoiFilter(classIds, trackBreaks);
+        }
+
+        void clearPoiFilter()
+        {
+            return static_cast<T*>(this)->clearPoiFilter();
+        }
+
         int testFunc(int a)
         {
             return static_cast<T*>(this)->testFunc(a);
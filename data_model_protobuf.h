@@ -3,44 +3,320 @@
 
 #include <memory>
 #include <cstddef>
+#include <cstdint>
 #include <cstdio>
 #include <fstream>
 #include <string>
 #include <mutex>
 #include <thread>
+#include <condition_variable>
+#include <functional>
+#include <chrono>
+#include <type_traits>
 #include <future>
 #include <filesystem>
+#include <algorithm>
+#include <optional>
+
+#include <fnmatch.h>
+
+#include <google/protobuf/arena.h>
 
 #include "detection_results_v2.pb.h"
 #include "data_model.h"
 #include "data_vector.h"
+#include "encoded_column.h"
+#include "record_shard.h"
 #include "algo.h"
+#include "eval_box_flicker.h"
+#include "eval_ground_truth.h"
+#include "event_segmenter.h"
+#include "temporal_filter.h"
 
 using namespace std;
 namespace fs = std::filesystem;
 
-template<typename T_EvalAlgo>
-class DataModelProtoBuf: public DataModel<DataModelProtoBuf<T_EvalAlgo>>
+/**
+ * \brief Data model of record files with protobuf encoded examples
+ *
+ * \details
+ *      T_EvalAlgo counts the detections per image, T_TrackAlgo the track breaks
+ *      between consecutive images. T_GroundTruthAlgo matches the detections
+ *      against ground truth on request.
+ */
+template<typename T_EvalAlgo, typename T_TrackAlgo = EvalBoxFlicker, typename T_GroundTruthAlgo = EvalGroundTruth>
+class DataModelProtoBuf: public DataModel<DataModelProtoBuf<T_EvalAlgo, T_TrackAlgo, T_GroundTruthAlgo>>
 {
     typedef T_EvalAlgo T;
-    friend class DataModel<DataModelProtoBuf<T_EvalAlgo>>;
+    friend class DataModel<DataModelProtoBuf<T_EvalAlgo, T_TrackAlgo, T_GroundTruthAlgo>>;
+
+    /* columns are appended by the loading thread and read concurrently without locking */
+    template<typename TValue>
+    using Column = DataVector<TValue, 1 << 14>;
 
 	public:
-		~DataModelProtoBuf() = default;
+        /* counts of a column, that stay readable while the model replaces the column */
+        typedef ColumnView<EncodedColumn> CountView;
+
+		~DataModelProtoBuf()
+        {
+            cancelLoad();
+        }
 
+        /**
+         * \brief Open a dataset
+         *
+         * \details
+         *      fname is either a single record file, a directory, whose *.pb files are
+         *      shards of the dataset, or a glob pattern like "rec/cam0_*.pb". Shards
+         *      are ordered by the timestamp of their first record and form a single,
+         *      globally indexed sequence of images. A running load() of the previous
+         *      dataset is stopped first, see cancelLoad().
+         */
         void open(string fname)
         {
-            m_path = fs::path(fname).parent_path();
-            m_file = make_unique<ifstream>(fname, ios::binary);
-            if ( (m_file->rdstate() & std::ifstream::failbit ) != 0 )
+            /* held until the dataset is set up, a load() started meanwhile waits for it */
+            std::unique_lock<std::mutex> lck (m_loadMtx);
+            stopLoading(lck);
+            std::atomic_store(&m_shardFirst, ShardTable());
+            m_shards.clear();
+            for (auto& shardName : findShards(fs::path(fname)))
+            {
+                auto shard = make_unique<RecordShard>();
+                if ( !shard->open(shardName, m_readerMode) )
+                {
+                    std::cerr << "Error opening file " << shardName << std::endl;
+                    continue;
+                }
+                m_shards.push_back(std::move(shard));
+            }
+            if ( m_shards.empty() )
             {
                 std::cerr << "Error opening file " << fname << std::endl;
             }
+            sortShards();
+            m_numCacheSaved.assign(m_shards.size(), 0);
             m_dataLoading.clear();
             m_dataLoaded = false;
-            m_poisIdentified.clear();
-            m_fileOffsets.clear();
-            m_fileOffsets.insert(std::make_pair(0,0));
+            m_numExamples = 0;
+            m_classIds = m_nextClassIds;
+            /* columns are created before loading, so that they can be read while loading */
+            m_timestamps = make_shared<Column<uint64_t>>();
+            m_trackBreaks = make_shared<Column<uint8_t>>();
+            m_detectsPerClass.resize(0);
+            m_levelsPerClass.resize(0);
+            m_filteredPerClass.resize(0);
+            for (unsigned idx = 0; idx < m_classIds.size(); idx++)
+            {
+                m_levelsPerClass.emplace_back();
+                for (size_t level = 0; level < m_thresholdLevels.size(); level++)
+                {
+                    m_levelsPerClass.back().push_back(make_shared<EncodedColumn>());
+                }
+                m_detectsPerClass.push_back(m_levelsPerClass.back()[levelOf(m_threshold)]);
+                m_filteredPerClass.push_back(make_shared<EncodedColumn>());
+            }
+            m_filtersPerClass.assign(m_classIds.size(), TemporalFilter(m_filterParams));
+            {
+                std::lock_guard<std::mutex> lck (m_poiMtx);
+                m_poisPerClass.resize(0);
+                for (unsigned idx = 0; idx < m_classIds.size(); idx++)
+                {
+                    m_poisPerClass.push_back(make_unique< std::vector<uint32_t> >());
+                }
+                m_trackBreakPois.clear();
+                m_segmentersPerClass.assign(m_classIds.size(), EventSegmenter(m_segmentParams));
+            }
+            /* with offset indices of previous scans, all images are addressable right away */
+            bool allMapped = std::all_of(m_shards.begin(), m_shards.end(),
+                                         [](auto& shard) { return shard->offsets().isMapped(); });
+            if ( allMapped )
+            {
+                publishShards();
+            }
+        }
+
+        /**
+         * \brief Keep loading records appended to the file after load() has finished
+         *
+         * \details
+         *      The file is polled for new records, which are appended to the loaded
+         *      data and published like during load(). Enabled during load(), following
+         *      starts once it has finished.
+         */
+        void setFollowMode(bool enable)
+        {
+            std::lock_guard<std::mutex> lck (m_loadMtx);
+            m_followMode = enable;
+            if (!enable)
+            {
+                stopFollowing();
+            }
+            else if (m_dataLoaded && !m_loadRunning)
+            {
+                startFollowing();
+            }
+        }
+
+        /**
+         * \brief Select the classes evaluated by subsequent calls to open()
+         *
+         * \details
+         *      Column classIdx of getNumDetections() and the POIs of classIdx refer to
+         *      classIds[classIdx].
+         */
+        void setClassIds(const std::vector<int>& classIds)
+        {
+            m_nextClassIds = classIds;
+        }
+
+        /**
+         * \brief Classes evaluated for the current dataset
+         */
+        const std::vector<int>& getClassIds() const
+        {
+            return m_classIds;
+        }
+
+        /**
+         * \brief Change the score threshold, above which a detection is counted
+         *
+         * \details
+         *      threshold is rounded to the nearest threshold level. The
+         *      number of detections above each threshold level is kept per image, so
+         *      only the POIs of the loaded images are computed again, without reading
+         *      the records. Not possible while loading, no load starts until the
+         *      threshold has been changed.
+         *
+         * \return false, if the threshold could not be changed
+         */
+        bool setThreshold(int threshold)
+        {
+            threshold = roundThreshold(threshold);
+            std::lock_guard<std::mutex> lck (m_loadMtx);
+            if (threshold == m_threshold)
+            {
+                return true;
+            }
+            if (m_loadRunning)
+            {
+                return false;
+            }
+            /* the follow thread must not append images while the columns are replaced */
+            pauseFollowing();
+            m_threshold = threshold;
+            applyThreshold();
+            if (m_dataLoaded && m_followMode)
+            {
+                startFollowing();
+            }
+            return true;
+        }
+
+        int getThreshold() const
+        {
+            return m_threshold;
+        }
+
+        /**
+         * \brief Smooth the number of detections of each class over time
+         *
+         * \details
+         *      Unless params.type is None, the filtered numbers are returned by
+         *      getNumDetections() and are the input of the POIs and events. The
+         *      filtered columns of the loaded images are recomputed from the
+         *      unfiltered ones. Not possible while loading, no load starts until the
+         *      filter has been changed.
+         *
+         * \return false, if the filter could not be changed
+         */
+        bool setFilter(const FilterParams& params)
+        {
+            std::lock_guard<std::mutex> lck (m_loadMtx);
+            if (m_loadRunning)
+            {
+                return false;
+            }
+            /* the follow thread must not append images while the columns are replaced */
+            pauseFollowing();
+            m_filterParams = params;
+            applyFilter();
+            identifyAllPois();
+            if (m_dataLoaded && m_followMode)
+            {
+                startFollowing();
+            }
+            return true;
+        }
+
+        const FilterParams& getFilter() const
+        {
+            return m_filterParams;
+        }
+
+        /**
+         * \brief Navigate by events instead of single changes of the count
+         *
+         * \details
+         *      If enabled, the first and the last image of each event of any class are
+         *      the points of interest, track breaks are left out. The events of the
+         *      loaded images are recomputed from their counts with params.
+         */
+        void setSegmentation(bool enable, const SegmentParams& params = SegmentParams())
+        {
+            std::lock_guard<std::mutex> lck (m_poiMtx);
+            m_segmentation = enable;
+            m_segmentParams = params;
+            for (auto& segmenter : m_segmentersPerClass)
+            {
+                segmenter = EventSegmenter(params);
+            }
+            identifySegments(m_numExamples);
+        }
+
+        /**
+         * \brief Events of a class within the loaded images, including one that may still be extended
+         */
+        std::vector<Segment> getSegments(uint8_t classIdx)
+        {
+            std::lock_guard<std::mutex> lck (m_poiMtx);
+            std::vector<Segment> segments(0);
+            if (classIdx < m_segmentersPerClass.size())
+            {
+                segments = m_segmentersPerClass[classIdx].allSegments();
+            }
+            return segments;
+        }
+
+        /**
+         * \brief Write the events of all classes as CSV: class, first image, last image, timestamps of both
+         */
+        bool saveSegments(const fs::path& fname)
+        {
+            ofstream output(fname, ios::out | ios::trunc);
+            output << "class,first,last,first_timestamp,last_timestamp" << std::endl;
+            for (unsigned classIdx = 0; classIdx < m_classIds.size(); classIdx++)
+            {
+                for (auto& segment : getSegments(classIdx))
+                {
+                    output << m_classIds[classIdx] << ',' << segment.first << ',' << segment.last - 1 << ','
+                           << getTimestamp(segment.first) << ',' << getTimestamp(segment.last - 1) << '\n';
+                }
+            }
+            if ( !output )
+            {
+                std::cerr << "Failed to write segments " << fname << std::endl;
+                return false;
+            }
+            return true;
+        }
+
+        /**
+         * \brief Select how the record file is accessed by subsequent calls to open()
+         */
+        void setReaderMode(RecordReader::Mode mode)
+        {
+            m_readerMode = mode;
         }
 
         void load()
@@ -48,263 +324,1395 @@ class DataModelProtoBuf: public DataModel<DataModelProtoBuf<T_EvalAlgo>>
             this->parseStuff();
         }
 
+        /**
+         * \brief Stop a running load() and following the file, wait until both have returned
+         *
+         * \details
+         *      The images loaded so far stay available. The dataset has to be opened
+         *      again to load it completely.
+         */
+        void cancelLoad()
+        {
+            std::unique_lock<std::mutex> lck (m_loadMtx);
+            stopLoading(lck);
+        }
+
+        /**
+         * \brief Register a function, that is called from the loading thread
+         *        whenever another batch of images has been loaded
+         *
+         * \details
+         *      numLoaded is the number of images, for which detections and points of
+         *      interest are available. finished is set for the last call of a load.
+         */
+        void setLoadCallback(std::function<void(uint32_t numLoaded, bool finished)> callback)
+        {
+            m_loadCallback = callback;
+        }
+
+        /**
+         * \brief Number of images loaded so far
+         */
+        uint32_t getNumLoaded()
+        {
+            return m_numExamples.load(std::memory_order_acquire);
+        }
+
         /**
          * \brief Number of detections per image
          */
-        std::vector<int8_t> getNumDetections(uint8_t classIdx)
+        std::vector<int16_t> getNumDetections(uint8_t classIdx)
+        {
+            return getNumDetectionsView(classIdx).toStdVector();
+        }
+
+        /**
+         * \brief Number of detections for the images [from, to)
+         */
+        std::vector<int16_t> getNumDetectionsRange(uint8_t classIdx, uint32_t from, uint32_t to)
+        {
+            return getNumDetectionsView(classIdx, from, to).toStdVector();
+        }
+
+        /**
+         * \brief Number of detections for the images [from, to), read in place
+         *
+         * \details
+         *      to is clamped to the loaded images. The view keeps the column alive,
+         *      a change of the threshold or the filter replaces the column of the
+         *      model, while the view keeps showing the counts it was created for.
+         */
+        CountView getNumDetectionsView(uint8_t classIdx, uint32_t from = 0, uint32_t to = UINT32_MAX)
         {
-            std::vector<int8_t> det(0);
-            if (classIdx < m_detectsPerClass.size())
+            if (classIdx >= m_detectsPerClass.size())
             {
-                det = m_detectsPerClass[classIdx]->toStdVector();
+                return CountView();
             }
-            return det;
+            return countView(classIdx, from, std::min(to, getNumLoaded()));
         }
 
-        fs::path getItemByIdx(uint64_t idx)
+        /**
+         * \brief Minimum and maximum number of detections of numBins equal parts of the images [from, to)
+         *
+         * \details
+         *      Meant for plotting a long range at the resolution of the screen. The
+         *      counts are summarized in a pyramid while loading, so the cost grows
+         *      with numBins and only logarithmically with the length of the range.
+         */
+        std::vector<MinMax> getNumDetectionsEnvelope(uint8_t classIdx, uint32_t from, uint32_t to, uint32_t numBins)
         {
-            auto it = m_fileOffsets.lower_bound(idx);
-            if(it != m_fileOffsets.begin()) {
-                --it; // it now points at the right element
-            }
-            idx -= it->first;
-            uint64_t off = it->second;
+            return getNumDetectionsView(classIdx, from, to).envelope(numBins);
+        }
 
-            const unsigned SIZE_BYTES = 8;
-            const unsigned FIELD_DESCR = 1;
-            const uint64_t DATA_SIZE_MAX = 10000;
-            char size_field[SIZE_BYTES + FIELD_DESCR];
-            char data[DATA_SIZE_MAX];
-            uint64_t record_size = 0;
-            fs::path img_path;
-            object_detection::Size size;
-            object_detection::Example example;
-        
-            if ( m_file && m_file->is_open() )
+        /**
+         * \brief Number of track breaks between each of the images [from, to) and its predecessor
+         *
+         * \details
+         *      The first image of each shard has no predecessor and no track breaks.
+         */
+        std::vector<uint8_t> getTrackBreaks(uint32_t from, uint32_t to)
+        {
+            std::vector<uint8_t> breaks(0);
+            to = std::min(to, getNumLoaded());
+            if (from < to)
             {
-                for (unsigned k = 0; k < idx+1; k++) {
-                    readFromFile(size_field, sizeof(size_field), off);
-                    size.ParseFromArray(size_field, sizeof(size_field));
-                    record_size = size.value();
-                    off += FIELD_DESCR + SIZE_BYTES;
-                    off += record_size;
-                }
-                size_t n_bytes = std::min(record_size, sizeof(data));
-                readFromFile(data, n_bytes, off);
-                example.ParseFromArray(data, n_bytes);
-                img_path = m_path / example.filename();
+                breaks = m_trackBreaks->toStdVector(from, to);
             }
-            return img_path;
+            return breaks;
         }
 
-        uint32_t nextPoi(unsigned idx)
+        /**
+         * \brief Evaluate the detections of the loaded images against a ground truth file
+         *
+         * \details
+         *      Only images, whose filename is found in the ground truth, are evaluated.
+         *      The images are split into blocks, that are matched on all cores, the
+         *      counts of the blocks are merged afterwards. Requires a loaded dataset.
+         *
+         * \return false, if the dataset is not loaded or a file could not be read
+         */
+        bool evaluateGroundTruth(const fs::path& fname, typename T_GroundTruthAlgo::Result& result)
         {
-            uint32_t idxPoi = m_numExamples;
-            if (identifyPois())
+            typedef typename T_GroundTruthAlgo::UScanView UScanView;
+            typedef typename T_GroundTruthAlgo::Counts UCounts;
+            if ( !m_dataLoaded )
+            {
+                std::cerr << "Ground truth evaluation requires a loaded dataset" << std::endl;
+                return false;
+            }
+            typename T_GroundTruthAlgo::Index groundTruth;
+            if ( !groundTruth.load(fname) )
+            {
+                return false;
+            }
+            struct Block
+            {
+                RecordShard* shard;
+                uint64_t first;
+                uint64_t count;
+            };
+            std::vector<Block> blocks;
+            const uint64_t last = getNumLoaded();
+            const ShardTable shardTable = std::atomic_load(&m_shardFirst);
+            for (size_t k = 0; shardTable && k < m_shards.size(); k++)
             {
-                for (auto& classVec : m_poisPerClass) // foreach class
+                uint64_t shardFirst = (*shardTable)[k];
+                uint64_t shardLast = std::min(last, shardFirst + m_shards[k]->offsets().size());
+                for (uint64_t n = shardFirst; n < shardLast; n += scanBlockSize)
                 {
-                    for (auto val : *classVec) // foreach point of interest within class
+                    blocks.push_back({m_shards[k].get(), n - shardFirst, std::min(scanBlockSize, shardLast - n)});
+                }
+            }
+
+            std::vector<UCounts> counts(blocks.size(), UCounts(m_classIds.size()));
+            std::atomic<bool> failed = false;
+            runParallel(blocks.size(), [&](uint64_t b) {
+                std::vector<char> buffer;
+                uint64_t record_size = 0;
+                UScanView example;
+                for (uint64_t n = blocks[b].first; n < blocks[b].first + blocks[b].count && !failed; n++)
+                {
+                    const char* payload = blocks[b].shard->readRecord(n, buffer, record_size);
+                    bool parsed = false;
+                    if constexpr (std::is_base_of_v<google::protobuf::MessageLite, UScanView>)
                     {
-                        if (val > idx)
-                        {
-                            if (val < idxPoi)
-                                idxPoi = val;
-                            break;
-                        }
+                        parsed = (payload != nullptr) && example.ParseFromArray(payload, record_size);
+                    }
+                    else
+                    {
+                        parsed = (payload != nullptr) && example.parse(payload, record_size, T_GroundTruthAlgo::scanFields);
+                    }
+                    if ( !parsed )
+                    {
+                        std::cerr << "Parsing payload failed at record: " << n << std::endl;
+                        failed = true;
+                        break;
+                    }
+                    auto frame = groundTruth.find(example.filename());
+                    if (frame != nullptr)
+                    {
+                        T_GroundTruthAlgo::matchDetections(example, *frame, m_classIds, counts[b]);
                     }
                 }
+            });
+            if (failed)
+            {
+                return false;
             }
-            return idxPoi;
+            UCounts total(m_classIds.size());
+            for (auto& blockCounts : counts)
+            {
+                total += blockCounts;
+            }
+            result = T_GroundTruthAlgo::summarize(total, m_classIds);
+            return true;
         }
- 
-        uint32_t prevPoi(unsigned idx)
+
+        /**
+         * \brief Timestamp of a loaded image
+         */
+        uint64_t getTimestamp(uint32_t idx)
+        {
+            auto ts = m_timestamps->toStdVector(idx, idx + 1);
+            return ts.empty() ? 0 : ts[0];
+        }
+
+        fs::path getItemByIdx(uint64_t idx)
         {
-            uint32_t idxPoi = 0;
-            if (identifyPois())
+            std::vector<char> data;
+            uint64_t record_size = 0;
+            fs::path img_path;
+            object_detection::Example example;
+
+            RecordShard* shard = nullptr;
+            uint64_t localIdx = 0;
+            if ( locateRecord(idx, shard, localIdx) )
             {
-                for (auto& classVec : m_poisPerClass) // foreach class
+                const char* payload = shard->readRecord(localIdx, data, record_size);
+                if ( payload != nullptr && example.ParseFromArray(payload, record_size) )
                 {
-                    uint32_t lastVal = 0;
-                    for (auto val : *classVec) // foreach point of interest within class
-                    {
-                        if (val < idx)
-                        {
-                            lastVal = val;
-                        }
-                        else
-                        {
-                            if (lastVal > idxPoi)
-                                idxPoi = lastVal;
-                            break;
-                        }
-                        lastVal = val;
-                    }
+                    img_path = shard->dir() / example.filename();
                 }
             }
-            return idxPoi;
+            return img_path;
+        }
+
+        /**
+         * \brief Next point of interest of the selected classes or track break behind idx
+         *
+         * \return getNumLoaded(), if there is none
+         */
+        uint32_t nextPoi(unsigned idx)
+        {
+            return findPoi(idx, true);
+        }
+
+        /**
+         * \brief Previous point of interest of the selected classes or track break in front of idx
+         *
+         * \return 0, if there is none
+         */
+        uint32_t prevPoi(unsigned idx)
+        {
+            return findPoi(idx, false);
+        }
+
+        /**
+         * \brief Select the classes, whose POIs or events nextPoi() and prevPoi() visit,
+         *        and whether track breaks are visited
+         *
+         * \details
+         *      Applies to the current and all following datasets. Ids of classes, that
+         *      are not evaluated, are ignored.
+         */
+        void setPoiFilter(const std::vector<int>& classIds, bool trackBreaks = true)
+        {
+            std::lock_guard<std::mutex> lck (m_poiMtx);
+            m_poiClassIds = classIds;
+            m_poiTrackBreaks = trackBreaks;
+        }
+
+        /**
+         * \brief Visit the POIs of all classes and track breaks again
+         */
+        void clearPoiFilter()
+        {
+            std::lock_guard<std::mutex> lck (m_poiMtx);
+            m_poiClassIds.reset();
+            m_poiTrackBreaks = true;
         }
         
 	protected:
 		shared_ptr<string> m_description;
 
 	private:
-		DataModelProtoBuf<T_EvalAlgo>():m_detectsPerClass(0)
+		DataModelProtoBuf():m_detectsPerClass(0)
         {
             // Verify that the version of the library that we linked against is
             // compatible with the version of the headers we compiled against.
             GOOGLE_PROTOBUF_VERIFY_VERSION;
         }
 
-        bool readFromFile(char* buffer, size_t n, size_t seek_off)
+        /**
+         * \brief Record files of the dataset named by fname
+         */
+        static std::vector<fs::path> findShards(const fs::path& fname)
         {
-            bool ret_val = false;
-            std::lock_guard<std::mutex> lck (m_fileMtx);
-            m_file->clear();
-            if ( m_file->is_open() )
+            std::vector<fs::path> shards;
+            std::error_code ec;
+            fs::path dir = fname;
+            std::string pattern = "*.pb";
+            if ( !fs::is_directory(fname, ec) )
             {
-                m_file->seekg(seek_off);
-                if ( !(*m_file) )
-                {
-                    return ret_val;
-                }
-                m_file->read(buffer, n);
-                if ( !(*m_file) )
+                std::string name = fname.filename().string();
+                if ( name.find_first_of("*?[") == std::string::npos )
                 {
-                    return ret_val;
-                }
-                else
-                {
-                    ret_val = true;
+                    shards.push_back(fname);
+                    return shards;
                 }
+                dir = fname.has_parent_path() ? fname.parent_path() : fs::path(".");
+                pattern = name;
             }
-            else
+            for (auto& entry : fs::directory_iterator(dir, ec))
             {
-                std::cout << "File unexpetedly closed" << std::endl;
+                if ( entry.is_regular_file(ec) &&
+                     fnmatch(pattern.c_str(), entry.path().filename().c_str(), 0) == 0 )
+                {
+                    shards.push_back(entry.path());
+                }
             }
-            return ret_val;
+            std::sort(shards.begin(), shards.end());
+            return shards;
         }
 
-        bool identifyPois()
+        /**
+         * \brief Order shards by the timestamp of their first record,
+         *        empty shards are moved to the end
+         */
+        void sortShards()
         {
-            if (m_dataLoaded)
+            std::vector< std::pair<uint64_t, unique_ptr<RecordShard>> > sorted;
+            for (auto& shard : m_shards)
             {
-                if (!m_poisIdentified.test_and_set())
+                uint64_t timestamp = 0;
+                if ( !shard->firstTimestamp(timestamp) )
                 {
-                    m_poisPerClass.resize(m_detectsPerClass.size());
-                    for (unsigned classIdx = 0; classIdx < m_detectsPerClass.size(); classIdx++)
-                    {
-                        m_poisPerClass[classIdx] = make_unique< std::vector<uint32_t> >();
-                        auto det = m_detectsPerClass[classIdx]->toStdVector();
-                        Algo::stdVectorDerivative<int8_t>(det, *m_poisPerClass[classIdx]);
-                    }
+                    timestamp = std::numeric_limits<uint64_t>::max();
                 }
-                return true;
+                sorted.emplace_back(timestamp, std::move(shard));
             }
-            else
+            std::stable_sort(sorted.begin(), sorted.end(),
+                             [](auto& a, auto& b) { return a.first < b.first; });
+            for (size_t k = 0; k < sorted.size(); k++)
             {
-                return false;
+                m_shards[k] = std::move(sorted[k].second);
             }
         }
-        
-        void parseStuff()
+
+        /**
+         * \brief Make the global index of the first image of each shard available
+         *
+         * \details
+         *      Requires all but the last shard to be indexed completely. Only the last
+         *      shard may grow afterwards (follow mode). The table is never modified once
+         *      published, a new one replaces it, while readers keep the one they loaded.
+         */
+        void publishShards()
         {
-            if (m_dataLoading.test_and_set())
+            auto shardFirst = std::make_shared< std::vector<uint64_t> >(m_shards.size());
+            uint64_t first = 0;
+            for (size_t k = 0; k < m_shards.size(); k++)
             {
-                /* file has already been loaded */
-                return;
+                (*shardFirst)[k] = first;
+                first += m_shards[k]->offsets().size();
             }
-            size_t off = 0;
-            object_detection::Size size;
-            typename T_EvalAlgo::UParser example;
-            uint64_t record_size = 0;
-            const unsigned SIZE_BYTES = 8;
-            const unsigned FIELD_DESCR = 1;
-            const uint64_t DATA_SIZE_MAX = 10000;
-            char size_field[SIZE_BYTES + FIELD_DESCR];
-            char data[DATA_SIZE_MAX];
-            std::vector<int> valid_det(2);
-            const int threshold = 10;
-            m_numExamples = 0;
+            std::atomic_store(&m_shardFirst, ShardTable(std::move(shardFirst)));
+        }
 
-            m_detectsPerClass.resize(0);
-            for (unsigned idx = 0; idx < class_ids.size(); idx++)
+        /**
+         * \brief Number of images, whose records have been indexed
+         */
+        uint64_t numIndexed()
+        {
+            if ( m_shards.empty() )
             {
-                m_detectsPerClass.push_back(make_unique<DataVector<int8_t, 128>>());
+                return 0;
             }
-
-            if ( m_file->is_open() )
+            const ShardTable shardFirst = std::atomic_load(&m_shardFirst);
+            if ( !shardFirst )
             {
-                for (unsigned n_rec = 0; n_rec < std::numeric_limits<decltype(n_rec)>::max(); n_rec++) {
-                    if ( !readFromFile(size_field, sizeof(size_field), off) )
-                    {
-                        std::cout << "Reading header failed" << std::endl;
-                        break;
-                    }
-                    if ( !size.ParseFromArray(size_field, sizeof(size_field)) )
-                    {
-                        std::cout << "Parsing header failed" << std::endl;
-                        break;
-                    }
-                    record_size = size.value();
-                    off += FIELD_DESCR + SIZE_BYTES;
+                return 0;
+            }
+            return shardFirst->back() + m_shards.back()->offsets().size();
+        }
 
-                    size_t n_bytes = std::min(record_size, sizeof(data));
-                    if (record_size > sizeof(data)) {
-                        std::cerr << "Record-size of " << record_size << " bytes exceeds buffer" << std::endl;
-                        break;
-                    }
-                    if ( !readFromFile(data, n_bytes, off) )
-                    {
-                        std::cout << "Reading payload failed" << std::endl;
-                        break;
-                    }
-                    if ( !example.ParseFromArray(data, n_bytes) )
+        /**
+         * \brief Map a global image index to shard and index within the shard
+         *
+         * \details
+         *      As long as the shards have not been indexed, only images of the first
+         *      shard can be located.
+         */
+        bool locateRecord(uint64_t idx, RecordShard*& shard, uint64_t& localIdx)
+        {
+            if ( m_shards.empty() )
+            {
+                return false;
+            }
+            const ShardTable shardFirst = std::atomic_load(&m_shardFirst);
+            if ( !shardFirst )
+            {
+                shard = m_shards[0].get();
+                localIdx = idx;
+                return true;
+            }
+            auto it = std::upper_bound(shardFirst->begin(), shardFirst->end(), idx);
+            size_t k = (it - shardFirst->begin()) - 1;
+            shard = m_shards[k].get();
+            localIdx = idx - (*shardFirst)[k];
+            return true;
+        }
+
+        /**
+         * \brief Call fn(k) for k in [0, n) on all cores
+         */
+        static void runParallel(uint64_t n, const std::function<void(uint64_t)>& fn)
+        {
+            std::atomic<uint64_t> next = 0;
+            unsigned numWorkers = std::max(1u, std::thread::hardware_concurrency());
+            numWorkers = std::min<uint64_t>(numWorkers, n);
+            std::vector<std::thread> workers;
+            for (unsigned w = 0; w < numWorkers; w++)
+            {
+                workers.emplace_back([&]() {
+                    for (uint64_t k = next++; k < n; k = next++)
                     {
-                        std::cerr << "Parsing payload failed at record: " << n_rec << std::endl;
+                        fn(k);
+                    }
+                });
+            }
+            for (auto& worker : workers)
+            {
+                worker.join();
+            }
+        }
+
+        /**
+         * \brief Counts of the images [from, to), that POIs, events and readers refer to
+         *
+         * \details
+         *      The columns are replaced by applyThreshold() and applyFilter() while
+         *      readers may take views, hence the shared pointers are loaded atomically.
+         */
+        CountView countView(unsigned classIdx, uint32_t from, uint32_t to)
+        {
+            auto& column = (m_filterParams.type != FilterParams::Type::None) ? m_filteredPerClass[classIdx]
+                                                                            : m_detectsPerClass[classIdx];
+            return CountView(std::atomic_load(&column), from, to);
+        }
+
+        /**
+         * \brief Append the indices k with counts[k] != counts[k+1] to pois
+         *
+         * \details
+         *      Long ranges, e.g. after a change of the threshold, are split into
+         *      chunks processed on all cores. Each chunk is decoded block by block,
+         *      the change between two blocks is checked separately.
+         */
+        void countDerivative(const CountView& counts, std::vector<uint32_t>& pois)
+        {
+            const uint32_t numChunks = (counts.size() + poiChunkSize - 1) / poiChunkSize;
+            std::vector< std::vector<uint32_t> > grads(numChunks);
+            auto derivative = [&](uint64_t c) {
+                uint32_t offset = c * poiChunkSize;
+                /* the last image of the chunk is compared with its successor */
+                uint32_t to = std::min<uint64_t>(counts.size(), (c + 1) * poiChunkSize + 1);
+                int16_t prev = 0;
+                std::vector<uint32_t> blockGrads;
+                counts.forEachSegment(offset, to, [&](const int16_t* data, size_t n) {
+                    if (offset > c * poiChunkSize && prev != data[0])
+                    {
+                        grads[c].push_back(offset - 1);
+                    }
+                    Algo::derivativeRange(data, n, 0, n, blockGrads);
+                    for (auto val : blockGrads)
+                    {
+                        grads[c].push_back(offset + val);
+                    }
+                    prev = data[n - 1];
+                    offset += n;
+                });
+            };
+            if (numChunks > 1)
+            {
+                runParallel(numChunks, derivative);
+            }
+            else if (numChunks == 1)
+            {
+                derivative(0);
+            }
+            for (auto& chunk : grads)
+            {
+                pois.insert(pois.end(), chunk.begin(), chunk.end());
+            }
+        }
+
+        /**
+         * \brief Append the filtered counts of the images behind those already filtered up to to
+         */
+        void filterCounts(uint32_t to)
+        {
+            if (m_filterParams.type == FilterParams::Type::None)
+            {
+                return;
+            }
+            std::vector<int16_t> filtered;
+            for (unsigned classIdx = 0; classIdx < m_filtersPerClass.size(); classIdx++)
+            {
+                TemporalFilter& filter = m_filtersPerClass[classIdx];
+                EncodedColumn& column = *m_filteredPerClass[classIdx];
+                m_detectsPerClass[classIdx]->forEachSegment(filter.numFrames(), to,
+                        [&filter, &column, &filtered](const int16_t* det, size_t n) {
+                    filtered.resize(n);
+                    filter.apply(det, n, filtered.data());
+                    column.append(filtered.data(), n);
+                });
+            }
+        }
+
+        /**
+         * \brief Append the points of interest within the images [from, to)
+         *
+         * \details
+         *      The change between image from-1 and from is detected as well, so that
+         *      the POIs of consecutive batches add up to the POIs of the whole column.
+         */
+        void identifyPois(uint32_t from, uint32_t to)
+        {
+            uint32_t first = (from > 0) ? from - 1 : 0;
+            if (to < first + 2)
+            {
+                return;
+            }
+            std::vector<uint32_t> grads;
+            for (unsigned classIdx = 0; classIdx < m_detectsPerClass.size(); classIdx++)
+            {
+                /* long ranges, e.g. after a change of the threshold, are processed on all cores */
+                grads.clear();
+                countDerivative(countView(classIdx, first, to), grads);
+                /* the last image of the batch has no successor yet and is never reported */
+                std::lock_guard<std::mutex> lck (m_poiMtx);
+                for (auto val : grads)
+                {
+                    m_poisPerClass[classIdx]->push_back(first + val);
+                }
+            }
+        }
+
+        /**
+         * \brief Append the images of [from, to) with track breaks to the points of interest
+         */
+        void identifyTrackBreakPois(uint32_t from, uint32_t to)
+        {
+            if (from >= to)
+            {
+                return;
+            }
+            auto breaks = m_trackBreaks->toStdVector(from, to);
+            std::lock_guard<std::mutex> lck (m_poiMtx);
+            for (uint32_t k = 0; k < breaks.size(); k++)
+            {
+                if (breaks[k] > 0)
+                {
+                    m_trackBreakPois.push_back(from + k);
+                }
+            }
+        }
+
+        /**
+         * \brief Segment the images behind those already segmented up to to, m_poiMtx must be held
+         */
+        void identifySegments(uint32_t to)
+        {
+            for (unsigned classIdx = 0; classIdx < m_segmentersPerClass.size(); classIdx++)
+            {
+                EventSegmenter& segmenter = m_segmentersPerClass[classIdx];
+                countView(classIdx, segmenter.numFrames(), to).forEachSegment([&segmenter](const int16_t* det, size_t n) {
+                    segmenter.append(det, n);
+                });
+            }
+        }
+
+        /**
+         * \brief Nearest point of interest behind (forward) or in front of idx
+         *
+         * \details
+         *      The POIs of each class and the track breaks are sorted, the nearest POI
+         *      of each source is found by binary search and the nearest of those is
+         *      taken. In segmentation mode, the event boundaries are searched instead.
+         *
+         * \return getNumLoaded() (forward) or 0, if there is none
+         */
+        uint32_t findPoi(uint32_t idx, bool forward)
+        {
+            uint32_t idxPoi = forward ? getNumLoaded() : 0;
+            auto take = [forward, &idxPoi](uint32_t val) {
+                if (forward ? val < idxPoi : val > idxPoi)
+                {
+                    idxPoi = val;
+                }
+            };
+            auto search = [idx, forward, &take](const std::vector<uint32_t>& pois) {
+                if (forward)
+                {
+                    auto it = std::upper_bound(pois.begin(), pois.end(), idx);
+                    if (it != pois.end())
+                    {
+                        take(*it);
+                    }
+                }
+                else
+                {
+                    auto it = std::lower_bound(pois.begin(), pois.end(), idx);
+                    if (it != pois.begin())
+                    {
+                        take(*(it - 1));
+                    }
+                }
+            };
+            std::lock_guard<std::mutex> lck (m_poiMtx);
+            for (unsigned classIdx = 0; classIdx < m_classIds.size(); classIdx++)
+            {
+                if ( m_poiClassIds && std::find(m_poiClassIds->begin(), m_poiClassIds->end(),
+                                                m_classIds[classIdx]) == m_poiClassIds->end() )
+                {
+                    continue;
+                }
+                uint32_t val = 0;
+                if (!m_segmentation)
+                {
+                    search(*m_poisPerClass[classIdx]);
+                }
+                else if (forward ? m_segmentersPerClass[classIdx].nextBoundary(idx, val)
+                                 : m_segmentersPerClass[classIdx].prevBoundary(idx, val))
+                {
+                    take(val);
+                }
+            }
+            if (m_poiTrackBreaks && !m_segmentation)
+            {
+                search(m_trackBreakPois);
+            }
+            return idxPoi;
+        }
+
+        /**
+         * \brief Append points of interest of the images [from, to) taken from a cache
+         *
+         * \details
+         *      pois holds the POIs per class within [from, to - 1), the change between
+         *      image from-1 and from is detected here.
+         */
+        void appendPois(uint32_t from, uint32_t to, const std::vector< std::vector<uint32_t> >& pois)
+        {
+            for (unsigned classIdx = 0; classIdx < m_detectsPerClass.size(); classIdx++)
+            {
+                auto det = m_detectsPerClass[classIdx]->toStdVector((from > 0) ? from - 1 : 0, std::min(from + 1, to));
+                std::lock_guard<std::mutex> lck (m_poiMtx);
+                if (from > 0 && det.size() == 2 && det[0] != det[1])
+                {
+                    m_poisPerClass[classIdx]->push_back(from - 1);
+                }
+                auto& classPois = *m_poisPerClass[classIdx];
+                classPois.insert(classPois.end(), pois[classIdx].begin(), pois[classIdx].end());
+            }
+        }
+
+        /**
+         * \brief Make the images [0, numLoaded) available to readers
+         *
+         * \param pois POIs of the new images, if they are known already. See appendPois().
+         */
+        void publishLoaded(uint32_t numLoaded, bool finished,
+                           const std::vector< std::vector<uint32_t> >* pois = nullptr)
+        {
+            filterCounts(numLoaded);
+            /* cached POIs refer to the unfiltered counts */
+            if (pois != nullptr && m_filterParams.type == FilterParams::Type::None)
+            {
+                appendPois(m_numExamples, numLoaded, *pois);
+            }
+            else
+            {
+                identifyPois(m_numExamples, numLoaded);
+            }
+            identifyTrackBreakPois(m_numExamples, numLoaded);
+            {
+                std::lock_guard<std::mutex> lck (m_poiMtx);
+                identifySegments(numLoaded);
+            }
+            m_numExamples.store(numLoaded, std::memory_order_release);
+            if (m_loadCallback)
+            {
+                m_loadCallback(numLoaded, finished);
+            }
+        }
+        
+        /**
+         * \brief Results of parsing a contiguous range of records
+         */
+        struct ScanBlock
+        {
+            RecordShard* shard = nullptr;
+            /* index of the first record within the shard */
+            uint64_t first = 0;
+            uint64_t globalFirst = 0;
+            uint64_t count = 0;
+            /* number of records evaluated successfully, < count if parsing failed */
+            uint64_t numValid = 0;
+            /* per class and threshold level */
+            std::vector< std::vector< std::vector<int16_t> > > levelsPerClass;
+            std::vector<uint8_t> trackBreaks;
+            std::vector<uint64_t> timestamps;
+            /* the block is the whole shard and taken from its column cache */
+            bool cached = false;
+            /* POIs per class, if the cache holds them for the current threshold */
+            std::vector< std::vector<uint32_t> > pois;
+            bool done = false;
+        };
+
+        /**
+         * \brief Memory reused by a worker across records and blocks
+         */
+        struct ScanContext
+        {
+            typedef typename T_EvalAlgo::UScanView UScanView;
+            static constexpr bool isMessage = std::is_base_of_v<google::protobuf::MessageLite, UScanView>;
+
+            /* payload copies per record of a batch, only used if the file is not memory-mapped */
+            std::vector< std::vector<char> > buffers;
+            /* parsed records of the current batch */
+            google::protobuf::Arena arena;
+            /* decoded records, if the evaluator scans through a lightweight view */
+            std::vector< std::conditional_t<isMessage, std::nullptr_t, UScanView> > views;
+            /* the records of the current batch, as passed to the evaluator */
+            std::vector<const UScanView*> examples;
+            /* boxes of the last record evaluated by T_TrackAlgo */
+            typename T_TrackAlgo::State track;
+            /* per class the score levels of the block as written by T_EvalAlgo, numLevels per record */
+            std::vector< std::vector<int16_t> > levels;
+
+            explicit ScanContext(size_t batchSize)
+                : buffers(batchSize), views(batchSize)
+            {
+                examples.reserve(batchSize);
+            }
+
+            /**
+             * \brief Decode the fields of record k of the current batch needed by the evaluator
+             *
+             * \details
+             *      Protobuf messages are fully parsed into the arena, which is released with
+             *      the first record of the next batch. Views only decode the fields declared
+             *      by the scanFields of both evaluators without copying.
+             */
+            const UScanView* parse(const char* payload, size_t n, size_t k)
+            {
+                if constexpr (isMessage)
+                {
+                    if (k == 0)
+                    {
+                        arena.Reset();
+                    }
+                    UScanView* msg = google::protobuf::Arena::CreateMessage<UScanView>(&arena);
+                    return msg->ParseFromArray(payload, n) ? msg : nullptr;
+                }
+                else
+                {
+                    uint32_t fields = T_EvalAlgo::scanFields | T_TrackAlgo::scanFields | ExampleView::TIMESTAMP;
+                    return views[k].parse(payload, n, fields) ? &views[k] : nullptr;
+                }
+            }
+        };
+
+        /**
+         * \brief Second pass: parse and evaluate the records of a single block
+         *
+         * Called concurrently by the workers of scanRecords().
+         */
+        void scanBlock(ScanBlock& block, ScanContext& ctx)
+        {
+            uint64_t record_size = 0;
+
+            if (block.cached)
+            {
+                /* appended from the cache by scanRecords() */
+                return;
+            }
+            const unsigned numLevels = m_thresholdLevels.size();
+            ctx.levels.resize(m_classIds.size());
+            for (auto& classLevels : ctx.levels)
+            {
+                classLevels.resize(block.count * numLevels);
+            }
+            std::vector<int16_t*> levels(m_classIds.size());
+            block.trackBreaks.resize(block.count);
+            block.timestamps.reserve(block.count);
+            const uint64_t last = block.first + block.count;
+            bool failed = !seedTrack(block, ctx);
+            for (uint64_t n_batch = block.first; n_batch < last && !failed; n_batch += evalBatchSize)
+            {
+                ctx.examples.clear();
+                for (uint64_t n_rec = n_batch; n_rec < std::min(last, n_batch + evalBatchSize); n_rec++)
+                {
+                    size_t k = n_rec - n_batch;
+                    /* in mmap mode, the payload is parsed directly from the mapping */
+                    const char* payload = block.shard->readRecord(n_rec, ctx.buffers[k], record_size);
+                    if ( payload == nullptr )
+                    {
+                        uint64_t off = 0;
+                        block.shard->offsets().lookup(n_rec, off);
+                        std::cerr << "Reading record " << n_rec << " at offset " << off
+                                  << " of " << block.shard->fname() << " failed" << std::endl;
+                        failed = true;
                         break;
                     }
-                    if ( !T_EvalAlgo::calcNumDetections(example, class_ids, valid_det, threshold) )
+                    auto example = ctx.parse(payload, record_size, k);
+                    if ( example == nullptr )
                     {
-                        return;
+                        std::cerr << "Parsing payload failed at record: " << n_rec << std::endl;
+                        failed = true;
+                        break;
                     }
-                    for (uint32_t i = 0; i < valid_det.size(); ++i)
+                    ctx.examples.push_back(example);
+                }
+                for (uint32_t i = 0; i < levels.size(); ++i)
+                {
+                    levels[i] = ctx.levels[i].data() + block.numValid * numLevels;
+                }
+                if ( !T_EvalAlgo::calcScoreLevels(ctx.examples.data(), ctx.examples.size(),
+                                                  m_classIds, m_thresholdLevels, levels.data()) ||
+                     !T_TrackAlgo::calcTrackBreaks(ctx.examples.data(), ctx.examples.size(),
+                                                   m_classIds, ctx.track, block.trackBreaks.data() + block.numValid) )
+                {
+                    break;
+                }
+                for (auto example : ctx.examples)
+                {
+                    block.timestamps.push_back(example->timestamp());
+                }
+                block.numValid += ctx.examples.size();
+            }
+            /* one column per threshold level */
+            block.levelsPerClass.assign(m_classIds.size(), std::vector< std::vector<int16_t> >(numLevels));
+            for (uint32_t i = 0; i < m_classIds.size(); ++i)
+            {
+                for (unsigned l = 0; l < numLevels; l++)
+                {
+                    auto& column = block.levelsPerClass[i][l];
+                    column.resize(block.numValid);
+                    for (uint64_t k = 0; k < block.numValid; k++)
                     {
-                        m_detectsPerClass[i]->push_back(valid_det[i]);
+                        column[k] = ctx.levels[i][k * numLevels + l];
                     }
+                }
+            }
+        }
+
+        /**
+         * \brief Let the track breaks of a block start from the boxes of the preceding record
+         *
+         * \return false, if the preceding record could not be read
+         */
+        bool seedTrack(ScanBlock& block, ScanContext& ctx)
+        {
+            ctx.track.valid = false;
+            if (block.first == 0)
+            {
+                /* first record of the shard */
+                return true;
+            }
+            uint64_t record_size = 0;
+            const char* payload = block.shard->readRecord(block.first - 1, ctx.buffers[0], record_size);
+            auto example = (payload != nullptr) ? ctx.parse(payload, record_size, 0) : nullptr;
+            if ( example == nullptr )
+            {
+                std::cerr << "Parsing payload failed at record: " << block.first - 1 << std::endl;
+                return false;
+            }
+            uint8_t breaks = 0;
+            return T_TrackAlgo::calcTrackBreaks(&example, 1, m_classIds, ctx.track, &breaks);
+        }
+
+        /**
+         * \brief Nearest threshold level
+         */
+        static constexpr int roundThreshold(int threshold)
+        {
+            threshold = std::clamp(threshold, DefaultThresholds::values.front(), DefaultThresholds::values.back());
+            return levelOf(threshold + thresholdStep / 2) * thresholdStep + DefaultThresholds::values.front();
+        }
+
+        /**
+         * \brief Index of the threshold level in m_thresholdLevels and m_levelsPerClass
+         */
+        static constexpr unsigned levelOf(int threshold)
+        {
+            return (threshold - DefaultThresholds::values.front()) / thresholdStep;
+        }
+
+        /**
+         * \brief Count the detections of all loaded images above the current threshold
+         *        and recompute their POIs
+         *
+         * \details
+         *      The counts are the level column of the threshold, views taken before
+         *      keep the previous one. Only called, while no images are loaded
+         *      concurrently.
+         */
+        void applyThreshold()
+        {
+            const unsigned level = levelOf(m_threshold);
+            for (unsigned i = 0; i < m_classIds.size(); i++)
+            {
+                std::atomic_store(&m_detectsPerClass[i], m_levelsPerClass[i][level]);
+            }
+            applyFilter();
+            identifyAllPois();
+        }
+
+        /**
+         * \brief Recompute the filtered counts of all loaded images for the current filter
+         *
+         * \details
+         *      Only called, while no images are loaded concurrently.
+         */
+        void applyFilter()
+        {
+            for (unsigned i = 0; i < m_classIds.size(); i++)
+            {
+                std::atomic_store(&m_filteredPerClass[i], make_shared<EncodedColumn>());
+                m_filtersPerClass[i] = TemporalFilter(m_filterParams);
+            }
+            filterCounts(m_numExamples);
+        }
+
+        /**
+         * \brief Recompute the POIs and events of all loaded images from their counts
+         *
+         * \details
+         *      Only called, while no images are loaded concurrently.
+         */
+        void identifyAllPois()
+        {
+            const uint32_t numLoaded = m_numExamples;
+            {
+                std::lock_guard<std::mutex> lck (m_poiMtx);
+                for (auto& pois : m_poisPerClass)
+                {
+                    pois->clear();
+                }
+                for (auto& segmenter : m_segmentersPerClass)
+                {
+                    segmenter.reset();
+                }
+                identifySegments(numLoaded);
+            }
+            identifyPois(0, numLoaded);
+        }
+
+        /**
+         * \brief Append the results of a whole shard from its column cache
+         *
+         * \details
+         *      The encoded level columns are appended without decoding them. The POIs
+         *      are taken over, if they have been computed for the current threshold.
+         */
+        void appendCachedBlock(ScanBlock& block)
+        {
+            const ColumnCache& cache = block.shard->cache();
+            for (uint32_t i = 0; i < m_classIds.size(); ++i)
+            {
+                for (unsigned l = 0; l < m_thresholdLevels.size(); l++)
+                {
+                    uint64_t numBytes = 0;
+                    const char* levels = cache.levels(i, l, numBytes);
+                    m_levelsPerClass[i][l]->appendStored(levels, numBytes);
+                }
+            }
+            m_trackBreaks->append(cache.trackBreaks(), block.count);
+            m_timestamps->append(cache.timestamps(), block.count);
+            block.numValid = block.count;
+            if (cache.threshold() != m_threshold)
+            {
+                return;
+            }
+            block.pois.resize(m_classIds.size());
+            for (uint32_t i = 0; i < m_classIds.size(); ++i)
+            {
+                uint64_t numPois = 0;
+                const uint32_t* pois = cache.pois(i, numPois);
+                /* the change from the last image of the shard to its successor is detected by the next block */
+                auto end = std::lower_bound(pois, pois + numPois, block.count - 1);
+                for (auto it = pois; it != end; ++it)
+                {
+                    block.pois[i].push_back(block.globalFirst + *it);
+                }
+            }
+        }
 
-                    off += record_size;
-                    m_numExamples++;
+        /**
+         * \brief Key of the column cache of a shard
+         */
+        ColumnCacheKey cacheKey(RecordShard& shard)
+        {
+            ColumnCacheKey key;
+            key.evaluator = std::string(T_EvalAlgo::name) + "+" + T_TrackAlgo::name;
+            key.threshold = m_threshold;
+            key.thresholdLevels = m_thresholdLevels;
+            key.classIds = m_classIds;
+            FileStamp::fromFile(shard.fname(), key.stamp);
+            return key;
+        }
 
-                    // store file offsets for later use
-                    if (m_numExamples % 1024 == 0)
+        /**
+         * \brief Map the column cache of shard k, it is only used together with the
+         *         offset index sidecar of the same records
+         */
+        void loadCache(size_t k)
+        {
+            RecordShard& shard = *m_shards[k];
+            ColumnCache& cache = shard.cache();
+            if ( !cache.load(ColumnCache::cachePath(shard.fname()), cacheKey(shard)) )
+            {
+                return;
+            }
+            if ( shard.offsets().size() != cache.numFrames() )
+            {
+                cache.clear();
+                return;
+            }
+            m_numCacheSaved[k] = cache.numFrames();
+        }
+
+        /**
+         * \brief Write the column cache of shard k, if all of its records have been loaded,
+         *         it is not still being written and has grown since the last save
+         */
+        void saveCache(size_t k)
+        {
+            RecordShard& shard = *m_shards[k];
+            const ShardTable shardFirst = std::atomic_load(&m_shardFirst);
+            if ( !shardFirst )
+            {
+                return;
+            }
+            uint64_t first = (*shardFirst)[k];
+            uint64_t numFrames = shard.offsets().size();
+            uint64_t last = first + numFrames;
+            ColumnCacheKey key = cacheKey(shard);
+            if ( numFrames == 0 || numFrames == m_numCacheSaved[k] || last > m_numExamples ||
+                 key.stamp.size != shard.indexedSize() )
+            {
+                return;
+            }
+            /* the columns are written in place */
+            std::vector< std::vector<CountView> > levels(m_classIds.size());
+            std::vector< std::vector<uint32_t> > pois(m_classIds.size());
+            for (unsigned i = 0; i < m_classIds.size(); i++)
+            {
+                for (auto& column : m_levelsPerClass[i])
+                {
+                    levels[i].emplace_back(column, first, last);
+                }
+                /* the POIs of the unfiltered counts, the cache does not depend on the filter */
+                countDerivative(CountView(m_detectsPerClass[i], first, last), pois[i]);
+            }
+            if ( ColumnCache::save(ColumnCache::cachePath(shard.fname()), key, levels,
+                                   ColumnView< Column<uint8_t> >(m_trackBreaks, first, last),
+                                   ColumnView< Column<uint64_t> >(m_timestamps, first, last), pois) )
+            {
+                m_numCacheSaved[k] = numFrames;
+            }
+        }
+
+        /**
+         * \brief Evaluate the indexed images [first, last) on all cores
+         *
+         * \details
+         *      The images are split into blocks, that do not cross shard boundaries.
+         *      Workers pick blocks in ascending order, so that all shards are scanned
+         *      concurrently. The calling thread appends the finished blocks to
+         *      m_levelsPerClass in frame order, publishes them and stops at the first
+         *      record that could not be evaluated. Shards with a column cache are
+         *      appended from it as a whole. Once cancel is set, the scan stops at the
+         *      next block boundary.
+         *
+         * \return false, if a record could not be evaluated
+         */
+        bool scanRecords(uint64_t first, uint64_t last, const std::atomic<bool>& cancel)
+        {
+            bool valid = true;
+            std::vector<ScanBlock> blocks;
+            const ShardTable shardTable = std::atomic_load(&m_shardFirst);
+            for (size_t k = 0; shardTable && k < m_shards.size(); k++)
+            {
+                uint64_t shardFirst = (*shardTable)[k];
+                uint64_t shardLast = shardFirst + m_shards[k]->offsets().size();
+                bool cached = m_shards[k]->cache().isValid() && first <= shardFirst && shardLast <= last;
+                uint64_t blockSize = cached ? shardLast - shardFirst : scanBlockSize;
+                for (uint64_t n = std::max(first, shardFirst); n < std::min(last, shardLast); n += blockSize)
+                {
+                    ScanBlock block;
+                    block.shard = m_shards[k].get();
+                    block.first = n - shardFirst;
+                    block.globalFirst = n;
+                    block.cached = cached;
+                    block.count = std::min(blockSize, std::min(last, shardLast) - n);
+                    blocks.push_back(std::move(block));
+                }
+            }
+            const uint64_t numBlocks = blocks.size();
+
+            std::atomic<uint64_t> nextBlock = 0;
+            std::mutex blockMtx;
+            std::condition_variable blockDone;
+            unsigned numWorkers = std::max(1u, std::thread::hardware_concurrency());
+            numWorkers = std::min<uint64_t>(numWorkers, numBlocks);
+            std::vector<std::thread> workers;
+            for (unsigned w = 0; w < numWorkers; w++)
+            {
+                workers.emplace_back([&]() {
+                    ScanContext ctx(evalBatchSize);
+                    for (uint64_t b = nextBlock++; b < numBlocks; b = nextBlock++)
+                    {
+                        /* cancelled blocks are left empty, so that the stitching loop never waits forever */
+                        if ( !cancel )
+                        {
+                            scanBlock(blocks[b], ctx);
+                        }
+                        std::lock_guard<std::mutex> lck (blockMtx);
+                        blocks[b].done = true;
+                        blockDone.notify_all();
+                    }
+                });
+            }
+
+            for (auto& block : blocks)
+            {
+                {
+                    std::unique_lock<std::mutex> lck (blockMtx);
+                    blockDone.wait(lck, [&block]() { return block.done; });
+                }
+                if (cancel)
+                {
+                    nextBlock = numBlocks;
+                    break;
+                }
+                if (block.cached)
+                {
+                    appendCachedBlock(block);
+                }
+                else
+                {
+                    /* the counts are one of the level columns */
+                    for (uint32_t i = 0; i < block.levelsPerClass.size(); ++i)
                     {
-                        m_fileOffsets.insert(std::make_pair(m_numExamples, off));
+                        for (unsigned l = 0; l < m_thresholdLevels.size(); l++)
+                        {
+                            m_levelsPerClass[i][l]->append(block.levelsPerClass[i][l].data(), block.numValid);
+                        }
                     }
+                    m_trackBreaks->append(block.trackBreaks.data(), block.numValid);
+                    m_timestamps->append(block.timestamps.data(), block.numValid);
+                }
+                publishLoaded(m_numExamples + block.numValid, false, block.pois.empty() ? nullptr : &block.pois);
+                /* release memory of the stitched block */
+                block.levelsPerClass = {};
+                block.trackBreaks = {};
+                block.timestamps = {};
+                block.pois = {};
+                if (block.numValid < block.count)
+                {
+                    /* skip all remaining blocks */
+                    nextBlock = numBlocks;
+                    valid = false;
+                    break;
+                }
+            }
+            for (auto& worker : workers)
+            {
+                worker.join();
+            }
+            return valid;
+        }
+
+        void parseStuff()
+        {
+            {
+                std::lock_guard<std::mutex> lck (m_loadMtx);
+                if (m_dataLoading.test_and_set())
+                {
+                    /* file has already been loaded */
+                    return;
+                }
+                m_loadRunning = true;
+            }
+            loadShards();
+            {
+                std::lock_guard<std::mutex> lck (m_loadMtx);
+                m_loadRunning = false;
+                /* setFollowMode() leaves starting to the load, while it is running */
+                if (m_dataLoaded && m_followMode)
+                {
+                    startFollowing();
+                }
+            }
+            m_loadCv.notify_all();
+        }
+
+        /**
+         * \brief Make a running load return early and wait for it, then stop following
+         *
+         * \details
+         *      lck holds m_loadMtx, no other load starts until the caller releases it.
+         */
+        void stopLoading(std::unique_lock<std::mutex>& lck)
+        {
+            m_cancelLoad = true;
+            m_loadCv.wait(lck, [this]() { return !m_loadRunning; });
+            /* a follow scan in progress returns early as well */
+            stopFollowing();
+            m_cancelLoad = false;
+        }
+
+        /**
+         * \brief Index and evaluate all shards, returns early if m_cancelLoad is set
+         */
+        void loadShards()
+        {
+            /* shards with a valid column cache do not need to be parsed at all */
+            runParallel(m_shards.size(), [this](uint64_t k) { loadCache(k); });
+            /* first pass, shards with an index mapped from a sidecar only check for new records */
+            runParallel(m_shards.size(), [this](uint64_t k) {
+                if ( !m_shards[k]->cache().isValid() )
+                {
+                    m_shards[k]->indexRecords(&m_cancelLoad);
+                }
+            });
+            if (m_cancelLoad)
+            {
+                return;
+            }
+            publishShards();
+            /* second pass */
+            scanRecords(0, numIndexed(), m_cancelLoad);
+            if (m_cancelLoad)
+            {
+                return;
+            }
+            for (size_t k = 0; k < m_shards.size(); k++)
+            {
+                m_shards[k]->saveIndex();
+                if ( !m_shards[k]->cache().isValid() )
+                {
+                    saveCache(k);
                 }
             }
-            m_file->clear();
             std::cout << "Found " << m_numExamples << " images" << std::endl;
             m_dataLoaded = true;
+            publishLoaded(m_numExamples, true);
+        }
+
+        void startFollowing()
+        {
+            std::lock_guard<std::mutex> lck (m_followMtx);
+            if (!m_following && !m_shards.empty())
+            {
+                m_following = true;
+                m_followThread = std::thread(&DataModelProtoBuf::followFile, this);
+            }
+        }
+
+        /**
+         * \brief Stop following and write the sidecars of the records loaded meanwhile
+         */
+        void stopFollowing()
+        {
+            if ( pauseFollowing() )
+            {
+                m_shards.back()->saveIndex();
+                saveCache(m_shards.size() - 1);
+            }
+        }
+
+        /**
+         * \brief Stop the follow thread without writing the sidecars, e.g. to restart it
+         *        after changing the columns
+         *
+         * \return false, if it was not running
+         */
+        bool pauseFollowing()
+        {
+            /* a poll in progress holds m_followMtx until it returns early */
+            m_cancelFollow = true;
+            {
+                std::lock_guard<std::mutex> lck (m_followMtx);
+                m_following = false;
+            }
+            m_followCv.notify_all();
+            bool running = m_followThread.joinable();
+            if (running)
+            {
+                m_followThread.join();
+            }
+            m_cancelFollow = false;
+            return running;
+        }
+
+        /**
+         * \brief Poll the newest shard for appended records and load them
+         *
+         * \details
+         *      A poll interrupted by pauseFollowing() stops at a block boundary, the
+         *      next poll continues with the first image, that has not been loaded.
+         */
+        void followFile()
+        {
+            std::unique_lock<std::mutex> lck (m_followMtx);
+            while ( !m_followCv.wait_for(lck, followInterval, [this]() { return !m_following; }) )
+            {
+                auto& shard = m_shards.back();
+                shard->reader().refresh();
+                /* picks up the records left by an interrupted poll as well */
+                shard->indexRecords(&m_cancelFollow);
+                uint64_t first = m_numExamples;
+                if ( first >= numIndexed() )
+                {
+                    continue;
+                }
+                shard->cache().clear();
+                if ( !scanRecords(first, numIndexed(), m_cancelFollow) )
+                {
+                    /* there is no way to resume behind an invalid record */
+                    std::cerr << "Stop following " << shard->fname() << std::endl;
+                    break;
+                }
+                publishLoaded(m_numExamples, true);
+            }
         }
 
-        const size_t vectorReservationChunksize = 512;
+        /* number of records evaluated by a worker at once */
+        const uint64_t scanBlockSize = 4096;
+        /* records parsed into one arena and evaluated together */
+        const uint64_t evalBatchSize = 256;
+        /* number of images, whose POIs are computed by a single worker */
+        const uint32_t poiChunkSize = 1 << 16;
+        /* polling interval of the follow mode */
+        const std::chrono::milliseconds followInterval{500};
 
-        unique_ptr<ifstream> m_file;
-        std::map<uint32_t,uint32_t> m_fileOffsets;
-        std::mutex m_fileMtx;
-        fs::path m_path;
+        RecordReader::Mode m_readerMode = RecordReader::Mode::Mmap;
+        /* shards of the dataset ordered by time */
+        std::vector< unique_ptr<RecordShard> > m_shards;
+        /* global index of the first image of each shard, not set until the shards are indexed */
+        typedef std::shared_ptr< const std::vector<uint64_t> > ShardTable;
+        ShardTable m_shardFirst;
+        /* number of images of each shard in its column cache, like RecordShard::saveIndex() */
+        std::vector<uint64_t> m_numCacheSaved;
         std::atomic_flag m_dataLoading = ATOMIC_FLAG_INIT;
-        std::atomic_flag m_poisIdentified = ATOMIC_FLAG_INIT;
         std::atomic<bool> m_dataLoaded = false;
+        /* serializes open(), setThreshold(), setFilter() and setFollowMode() against a running load */
+        std::mutex m_loadMtx;
+        std::condition_variable m_loadCv;
+        bool m_loadRunning = false;
+        /* set while open() or cancelLoad() wait for the load to return */
+        std::atomic<bool> m_cancelLoad = false;
+        /* set while pauseFollowing() waits for the follow thread to return */
+        std::atomic<bool> m_cancelFollow = false;
+        std::function<void(uint32_t, bool)> m_loadCallback;
+        std::atomic<bool> m_followMode = false;
+        bool m_following = false;
+        std::thread m_followThread;
+        std::mutex m_followMtx;
+        std::condition_variable m_followCv;
 
-        uint32_t m_numExamples;
-        std::vector< unique_ptr<DataVector<int8_t, 128>> > m_detectsPerClass;
+        /* number of images published to readers */
+        std::atomic<uint32_t> m_numExamples = 0;
+        /* columns are shared with the views handed out to readers */
+        std::vector< shared_ptr<EncodedColumn> > m_detectsPerClass;
+        shared_ptr<Column<uint64_t>> m_timestamps;
+        /* track breaks per image, independent of the threshold */
+        shared_ptr<Column<uint8_t>> m_trackBreaks;
+        /* sorted per class */
         std::vector< unique_ptr< std::vector<uint32_t> > > m_poisPerClass;
-        const std::vector<int> class_ids{1,2};
-        DataVector<uint8_t, 128> m_numDetections;
-        uint8_t m_scoreThreshold = 60;
-        std::mutex fileMtx;
+        /* images with track breaks, kept apart from the POIs derived from the counts */
+        std::vector<uint32_t> m_trackBreakPois;
+        /* counts per class smoothed by m_filtersPerClass, empty if the filter is None */
+        std::vector< shared_ptr<EncodedColumn> > m_filteredPerClass;
+        std::vector<TemporalFilter> m_filtersPerClass;
+        FilterParams m_filterParams;
+        /* events per class, POIs are their boundaries if m_segmentation is set */
+        std::vector<EventSegmenter> m_segmentersPerClass;
+        SegmentParams m_segmentParams;
+        bool m_segmentation = false;
+        /* classes visited by nextPoi() and prevPoi(), all if not set */
+        std::optional< std::vector<int> > m_poiClassIds;
+        bool m_poiTrackBreaks = true;
+        std::mutex m_poiMtx;
+        /* classes evaluated by the current dataset and by the next call to open() */
+        std::vector<int> m_classIds;
+        std::vector<int> m_nextClassIds{T_EvalAlgo::DefaultConfig::Classes::ids.begin(),
+                                        T_EvalAlgo::DefaultConfig::Classes::ids.end()};
+        /* the number of detections above each of these thresholds is kept per image,
+         * the same as counted by the prebuilt kernel of the evaluator */
+        typedef typename T_EvalAlgo::DefaultConfig::Thresholds DefaultThresholds;
+        static constexpr int thresholdStep = DefaultThresholds::step();
+        static_assert(thresholdStep > 0, "Threshold levels have to be equally spaced");
+        const std::vector<int> m_thresholdLevels{DefaultThresholds::values.begin(), DefaultThresholds::values.end()};
+        /* scores have to be above threshold to count as detection, one of m_thresholdLevels */
+        int m_threshold = roundThreshold(10);
+        /* per class and threshold level the number of detections of each image, m_detectsPerClass holds one of them */
+        std::vector< std::vector< shared_ptr<EncodedColumn> > > m_levelsPerClass;
 };
 
 #endif /* _DATAMODELPROTOBUF_H_ */
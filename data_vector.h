@@ -1,76 +1,373 @@
 /**
- * A implementation based on std::vector with locking:
+ * An append-only column of values stored in fixed size chunks:
  *  * a single producer
- *  * multiple consumers
+ *  * multiple consumers, that never lock
+ *
+ * Chunks never move once allocated. The producer writes the values first and
+ * then publishes the new size with release semantics, readers load the size
+ * with acquire semantics and may read all values below it. The directory of
+ * chunk pointers is replaced by a larger copy when it is full, replaced
+ * directories are kept until destruction, so that readers still using them
+ * stay valid.
  */
 
 #ifndef DATA_VECTOR_H_
 #define DATA_VECTOR_H_
 
+#include <algorithm>
 #include <atomic>
-#include <thread>
+#include <cstring>
+#include <iterator>
+#include <memory>
+#include <type_traits>
 #include <vector>
 
 using namespace std;
 
-template<class T, size_t UChuckSize>
-class DataVector 
+template<class T, size_t UChunkSize>
+class DataVector
 {
+    static_assert(UChunkSize > 0 && (UChunkSize & (UChunkSize - 1)) == 0, "Chunk size has to be a power of 2");
+    static_assert(std::is_trivially_copyable<T>::value, "Values are copied as bytes");
+
     public:
+        typedef T value_type;
+
+        DataVector()
+        {
+            m_directories.push_back(std::make_unique<T*[]>(initialDirectorySize));
+            m_directoryCapacity = initialDirectorySize;
+            m_directory.store(m_directories.back().get(), std::memory_order_release);
+        }
+
+        DataVector(const DataVector&) = delete;
+        DataVector& operator=(const DataVector&) = delete;
+
+        ~DataVector()
+        {
+            T** directory = m_directory.load(std::memory_order_relaxed);
+            for (size_t c = 0; c < m_numChunks; c++)
+            {
+                delete[] directory[c];
+            }
+        }
+
+        /**
+         * \brief Number of published values, a consistent snapshot for the calling reader
+         */
         size_t size() const noexcept
         {
-            return m_values.size();
+            return m_size.load(std::memory_order_acquire);
         }
+
         /**
-         * \brief Reserve space for the vector
-         *
-         * \details 
-         *      Locking of resize is needed, since if the container capacity is exhausted,
-         *      realllocation at a different memory location might take place
+         * \brief Allocate the chunks for n values, only called by the producer
          */
         void reserve(size_t n)
         {
-            size_t new_size = m_values.capacity();
-            while (new_size < n) {
-                new_size += UChuckSize;
+            size_t numChunks = (n + UChunkSize - 1) / UChunkSize;
+            if (numChunks <= m_numChunks)
+            {
+                return;
+            }
+            if (numChunks > m_directoryCapacity)
+            {
+                /* readers may still use the current directory, it is kept */
+                size_t capacity = std::max(numChunks, 2 * m_directoryCapacity);
+                auto directory = std::make_unique<T*[]>(capacity);
+                std::copy(m_directories.back().get(), m_directories.back().get() + m_numChunks, directory.get());
+                m_directories.push_back(std::move(directory));
+                m_directoryCapacity = capacity;
+                m_directory.store(m_directories.back().get(), std::memory_order_release);
             }
-            while (m_lock.test_and_set(std::memory_order_acquire));  // acquire m_lock
-            m_values.reserve(new_size);
-            m_lock.clear(std::memory_order_release);
+            T** directory = m_directories.back().get();
+            for (; m_numChunks < numChunks; m_numChunks++)
+            {
+                directory[m_numChunks] = new T[UChunkSize];
+            }
+        }
+
+        void push_back(T value)
+        {
+            append(&value, 1);
+        }
+
+        /**
+         * \brief Append n values at once, only called by the producer
+         */
+        void append(const T* values, size_t n)
+        {
+            size_t size = m_size.load(std::memory_order_relaxed);
+            reserve(size + n);
+            T** directory = m_directories.back().get();
+            while (n > 0)
+            {
+                size_t offset = size % UChunkSize;
+                size_t num = std::min(n, UChunkSize - offset);
+                memcpy(directory[size / UChunkSize] + offset, values, num * sizeof(T));
+                values += num;
+                size += num;
+                n -= num;
+            }
+            m_size.store(size, std::memory_order_release);
         }
 
-        void push_back(T i)
+        /**
+         * \brief Call fn(const T* values, size_t n) for the contiguous pieces of the values [from, to)
+         *
+         * \details
+         *      to is clamped to the published size. The pieces are read in place
+         *      without locking or copying.
+         */
+        template<typename TFn>
+        void forEachSegment(size_t from, size_t to, TFn fn) const
         {
-            if (m_values.capacity() < m_values.size() + sizeof(T)) {
-                reserve(m_values.size() + sizeof(T));
+            to = std::min(to, size());
+            T* const* directory = m_directory.load(std::memory_order_acquire);
+            while (from < to)
+            {
+                size_t offset = from % UChunkSize;
+                size_t num = std::min(to - from, UChunkSize - offset);
+                fn(static_cast<const T*>(directory[from / UChunkSize] + offset), num);
+                from += num;
             }
-            
-            auto* before = &m_values[0];
-            m_values.push_back(i);
-            auto* after = &m_values[0];
-            assert(before == after && "Reallocation should never be needed in push_back");
         }
 
-        std::vector<T> toStdVector()
+        std::vector<T> toStdVector() const
+        {
+            return toStdVector(0, size());
+        }
+
+        /**
+         * \brief Copy of the values [from, to), to is clamped to the published size
+         */
+        std::vector<T> toStdVector(size_t from, size_t to) const
         {
             std::vector<T> n(0);
-            while (m_lock.test_and_set());  // acquire m_lock
-            n = m_values;
-            m_lock.clear();
+            to = std::min(to, size());
+            if (from < to)
+            {
+                n.resize(to - from);
+                T* out = n.data();
+                forEachSegment(from, to, [&out](const T* values, size_t num) {
+                    std::copy(values, values + num, out);
+                    out += num;
+                });
+            }
             return n;
         }
-        
-        double operator()(int i)
-        { 
-            while (m_lock.test_and_set());  // acquire m_lock
-            auto v = m_values[i];
-            m_lock.clear(std::memory_order_release);
-            return v;
+
+        /**
+         * \brief Value i, i has to be below the published size
+         */
+        T operator[](size_t i) const
+        {
+            T* const* directory = m_directory.load(std::memory_order_acquire);
+            return directory[i / UChunkSize][i % UChunkSize];
+        }
+
+        double operator()(int i) const
+        {
+            return (*this)[i];
+        }
+
+    private:
+        static constexpr size_t initialDirectorySize = 16;
+
+        std::atomic<size_t> m_size = 0;
+        /* current directory of chunk pointers, read by consumers */
+        std::atomic<T**> m_directory = nullptr;
+        /* all directories ever used, the last one is current, only accessed by the producer */
+        std::vector< std::unique_ptr<T*[]> > m_directories;
+        size_t m_directoryCapacity = 0;
+        size_t m_numChunks = 0;
+};
+
+/**
+ * \brief Read-only view of the values [from, to) of a column
+ *
+ * \details
+ *      TColumn is a DataVector or a column with the same reader interface. The
+ *      view shares ownership of the column, so that it stays valid after the
+ *      owner replaced or dropped the column. The range is clamped to the values
+ *      published when the view is created, later appends are not visible. The
+ *      values are read in place, nothing is copied unless toStdVector() is called.
+ */
+template<class TColumn>
+class ColumnView
+{
+    public:
+        typedef TColumn UColumn;
+        typedef typename TColumn::value_type T;
+
+        class const_iterator
+        {
+            public:
+                typedef std::forward_iterator_tag iterator_category;
+                typedef T value_type;
+                typedef std::ptrdiff_t difference_type;
+                typedef const T* pointer;
+                typedef T reference;
+
+                const_iterator(const UColumn* column, size_t idx)
+                    : m_column(column), m_idx(idx)
+                {
+                }
+
+                T operator*() const
+                {
+                    return (*m_column)[m_idx];
+                }
+
+                const_iterator& operator++()
+                {
+                    m_idx++;
+                    return *this;
+                }
+
+                const_iterator operator++(int)
+                {
+                    const_iterator it = *this;
+                    m_idx++;
+                    return it;
+                }
+
+                bool operator==(const const_iterator& other) const
+                {
+                    return m_idx == other.m_idx;
+                }
+
+                bool operator!=(const const_iterator& other) const
+                {
+                    return m_idx != other.m_idx;
+                }
+
+            private:
+                const UColumn* m_column;
+                size_t m_idx;
+        };
+
+        ColumnView() = default;
+
+        ColumnView(std::shared_ptr<const UColumn> column, size_t from, size_t to)
+            : m_column(std::move(column))
+        {
+            if (m_column)
+            {
+                m_to = std::min(to, m_column->size());
+                m_from = std::min(from, m_to);
+            }
+        }
+
+        size_t size() const
+        {
+            return m_to - m_from;
+        }
+
+        bool empty() const
+        {
+            return m_from == m_to;
+        }
+
+        /**
+         * \brief Index of the first value of the view within the column
+         */
+        size_t first() const
+        {
+            return m_from;
+        }
+
+        /**
+         * \brief Value i of the view, i has to be below size()
+         */
+        T operator[](size_t i) const
+        {
+            return (*m_column)[m_from + i];
+        }
+
+        const_iterator begin() const
+        {
+            return const_iterator(m_column.get(), m_from);
+        }
+
+        const_iterator end() const
+        {
+            return const_iterator(m_column.get(), m_to);
+        }
+
+        /**
+         * \brief Call fn(const T* values, size_t n) for the pieces of the view in order
+         */
+        template<typename TFn>
+        void forEachSegment(TFn fn) const
+        {
+            if (m_column)
+            {
+                m_column->forEachSegment(m_from, m_to, fn);
+            }
+        }
+
+        /**
+         * \brief Call fn(const T* values, size_t n) for the pieces of the values [from, to) of the view
+         */
+        template<typename TFn>
+        void forEachSegment(size_t from, size_t to, TFn fn) const
+        {
+            if (m_column)
+            {
+                m_column->forEachSegment(m_from + std::min(from, size()), m_from + std::min(to, size()), fn);
+            }
+        }
+
+        std::vector<T> toStdVector() const
+        {
+            return m_column ? m_column->toStdVector(m_from, m_to) : std::vector<T>(0);
+        }
+
+        /**
+         * \brief Minimum and maximum of each of numBins equal parts of the view
+         *
+         * \details
+         *      A part holds at least one value, so there are fewer parts for short
+         *      views. Only available for columns summarizing a range with
+         *      minMax(from, to), e.g. EncodedColumn.
+         */
+        template<class U = TColumn>
+        auto envelope(size_t numBins) const -> std::vector<decltype(std::declval<const U&>().minMax(0, 0))>
+        {
+            std::vector<decltype(std::declval<const U&>().minMax(0, 0))> bins;
+            numBins = std::min(numBins, size());
+            bins.reserve(numBins);
+            for (size_t b = 0; b < numBins; b++)
+            {
+                bins.push_back(m_column->minMax(m_from + size() * b / numBins, m_from + size() * (b + 1) / numBins));
+            }
+            return bins;
+        }
+
+        /**
+         * \brief Serialize the view through write(const void* data, size_t n)
+         *
+         * \details
+         *      Only available for columns, that serialize a range with
+         *      write(from, to, write), e.g. EncodedColumn.
+         */
+        template<typename TWrite>
+        void write(TWrite write) const
+        {
+            if (m_column)
+            {
+                m_column->write(m_from, m_to, write);
+            }
         }
 
     private:
-        std::vector<T> m_values;
-        std::atomic_flag m_lock = ATOMIC_FLAG_INIT;
+        std::shared_ptr<const UColumn> m_column;
+        size_t m_from = 0;
+        size_t m_to = 0;
 };
 
+template<class T, size_t UChunkSize>
+using DataVectorView = ColumnView< DataVector<T, UChunkSize> >;
+
 #endif /* DATA_VECTOR_H_ */
@@ -0,0 +1,625 @@
+/**
+ * An append-only column of int16 values, encoded in blocks of 256 values:
+ *  * a single producer
+ *  * multiple consumers, that never lock
+ *
+ * Each block stores its minimum as base and the offsets of its values from
+ * the base with the fewest bits, that hold the largest offset (0..16). A block
+ * of equal values, e.g. an image sequence without detections, takes no
+ * payload at all. The payload is laid out in 16 lanes of 16 bit words: value k
+ * of a block belongs to lane k % 16, whose 16 values are packed one after the
+ * other into bits words of the lane. Row r of all lanes is the values
+ * [16 r, 16 r + 16) of the block and is decoded with a vector shift and mask.
+ *
+ * The block being appended to is kept raw. Readers access it like a seqlock:
+ * they read it, then check that it has not been encoded meanwhile, else they
+ * decode the encoded block. Encoded blocks never change.
+ *
+ * The minimum and maximum of the encoded blocks are summarized in a pyramid,
+ * so that the envelope of a long range is found without decoding it.
+ */
+
+#ifndef ENCODED_COLUMN_H_
+#define ENCODED_COLUMN_H_
+
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+#include "cpu_dispatch.h"
+#include "data_vector.h"
+#include "min_max_pyramid.h"
+
+using namespace std;
+
+namespace BitPackKernels
+{
+    static constexpr uint32_t blockSize = 256;
+    static constexpr uint32_t numLanes = 16;
+    static constexpr uint32_t numRows = blockSize / numLanes;
+
+    /**
+     * \brief A 16 bit word of each lane
+     */
+    struct alignas(32) PackedRow
+    {
+        uint16_t lanes[numLanes];
+    };
+
+    /**
+     * \brief Kernel decoding the blockSize values base + offset of a block, whose offsets are packed into bits rows
+     */
+    typedef void (*DecodeKernel)(const PackedRow* rows, uint32_t bits, int16_t base, int16_t* out);
+
+    /**
+     * \brief Number of bits of the offsets of a block, that spans [min, max]
+     */
+    inline uint32_t bitWidth(int16_t min, int16_t max)
+    {
+        uint32_t range = uint32_t(int32_t(max) - int32_t(min));
+        return (range == 0) ? 0 : 32 - __builtin_clz(range);
+    }
+
+    /**
+     * \brief Pack the offsets of blockSize values from base into bits rows
+     */
+    inline void encode(const int16_t* values, int16_t base, uint32_t bits, PackedRow* rows)
+    {
+        memset(rows, 0, bits * sizeof(PackedRow));
+        for (uint32_t k = 0; k < blockSize && bits > 0; k++)
+        {
+            uint32_t offset = uint16_t(values[k] - base);
+            uint32_t pos = (k / numLanes) * bits;
+            uint16_t* word = &rows[pos / 16].lanes[k % numLanes];
+            word[0] |= uint16_t(offset << (pos % 16));
+            if (pos % 16 + bits > 16)
+            {
+                word[numLanes] |= uint16_t(offset >> (16 - pos % 16));
+            }
+        }
+    }
+
+    /**
+     * \brief Value k of a block
+     */
+    inline int16_t decodeValue(const PackedRow* rows, uint32_t bits, int16_t base, uint32_t k)
+    {
+        if (bits == 0)
+        {
+            return base;
+        }
+        uint32_t pos = (k / numLanes) * bits;
+        const uint16_t* word = &rows[pos / 16].lanes[k % numLanes];
+        uint32_t offset = word[0] >> (pos % 16);
+        if (pos % 16 + bits > 16)
+        {
+            offset |= uint32_t(word[numLanes]) << (16 - pos % 16);
+        }
+        return int16_t(base + (offset & ((1u << bits) - 1)));
+    }
+
+    inline void decodeScalar(const PackedRow* rows, uint32_t bits, int16_t base, int16_t* out)
+    {
+        for (uint32_t k = 0; k < blockSize; k++)
+        {
+            out[k] = decodeValue(rows, bits, base, k);
+        }
+    }
+
+#if CPU_DISPATCH_X86
+    /*
+     * Row r starts at bit r * bits of each lane. The kernels shift the word
+     * holding the start right and, if the value continues in the next word,
+     * merge that word shifted left, then mask the offsets and add the base.
+     * SSE4.2 decodes the lanes of a row in two halves.
+     */
+
+    TARGET_SSE42 inline void decodeSse42(const PackedRow* rows, uint32_t bits, int16_t base, int16_t* out)
+    {
+        const __m128i base16 = _mm_set1_epi16(base);
+        if (bits == 0)
+        {
+            for (uint32_t k = 0; k < blockSize; k += 8)
+            {
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out + k), base16);
+            }
+            return;
+        }
+        const __m128i mask = _mm_set1_epi16(int16_t((1u << bits) - 1));
+        for (uint32_t r = 0; r < numRows; r++)
+        {
+            uint32_t pos = r * bits;
+            const __m128i* word = reinterpret_cast<const __m128i*>(rows + pos / 16);
+            const __m128i shift = _mm_cvtsi32_si128(pos % 16);
+            __m128i lo = _mm_srl_epi16(_mm_load_si128(word), shift);
+            __m128i hi = _mm_srl_epi16(_mm_load_si128(word + 1), shift);
+            if (pos % 16 + bits > 16)
+            {
+                const __m128i carry = _mm_cvtsi32_si128(16 - pos % 16);
+                lo = _mm_or_si128(lo, _mm_sll_epi16(_mm_load_si128(word + 2), carry));
+                hi = _mm_or_si128(hi, _mm_sll_epi16(_mm_load_si128(word + 3), carry));
+            }
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + r * numLanes), _mm_add_epi16(_mm_and_si128(lo, mask), base16));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + r * numLanes + 8), _mm_add_epi16(_mm_and_si128(hi, mask), base16));
+        }
+    }
+
+    TARGET_AVX2 inline void decodeAvx2(const PackedRow* rows, uint32_t bits, int16_t base, int16_t* out)
+    {
+        const __m256i base16 = _mm256_set1_epi16(base);
+        if (bits == 0)
+        {
+            for (uint32_t k = 0; k < blockSize; k += 16)
+            {
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + k), base16);
+            }
+            return;
+        }
+        const __m256i mask = _mm256_set1_epi16(int16_t((1u << bits) - 1));
+        for (uint32_t r = 0; r < numRows; r++)
+        {
+            uint32_t pos = r * bits;
+            const __m256i* word = reinterpret_cast<const __m256i*>(rows + pos / 16);
+            __m256i val = _mm256_srl_epi16(_mm256_load_si256(word), _mm_cvtsi32_si128(pos % 16));
+            if (pos % 16 + bits > 16)
+            {
+                val = _mm256_or_si256(val, _mm256_sll_epi16(_mm256_load_si256(word + 1), _mm_cvtsi32_si128(16 - pos % 16)));
+            }
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + r * numLanes), _mm256_add_epi16(_mm256_and_si256(val, mask), base16));
+        }
+    }
+#endif
+
+    /**
+     * \brief Kernel for an instruction set, the next less capable one if there is none
+     */
+    inline DecodeKernel decodeKernel(CpuDispatch::Isa isa)
+    {
+#if CPU_DISPATCH_X86
+        switch (isa)
+        {
+            case CpuDispatch::Isa::Avx512:
+            case CpuDispatch::Isa::Avx2:   return decodeAvx2;
+            case CpuDispatch::Isa::Sse42:  return decodeSse42;
+            default:                       break;
+        }
+#endif
+        (void)isa;
+        return decodeScalar;
+    }
+
+    /**
+     * \brief Decode a block, see DecodeKernel
+     *
+     * The kernel is selected once from the instruction sets supported by the CPU.
+     */
+    inline void decode(const PackedRow* rows, uint32_t bits, int16_t base, int16_t* out)
+    {
+        static const DecodeKernel kernel = decodeKernel(CpuDispatch::isa());
+        kernel(rows, bits, base, out);
+    }
+};
+
+class EncodedColumn
+{
+    public:
+        typedef int16_t value_type;
+        static constexpr uint32_t blockSize = BitPackKernels::blockSize;
+
+        EncodedColumn() = default;
+        EncodedColumn(const EncodedColumn&) = delete;
+        EncodedColumn& operator=(const EncodedColumn&) = delete;
+
+        /**
+         * \brief Number of published values, a consistent snapshot for the calling reader
+         */
+        size_t size() const noexcept
+        {
+            return m_size.load(std::memory_order_acquire);
+        }
+
+        /**
+         * \brief Bytes taken by the encoded blocks, their summaries and the raw block
+         */
+        size_t memoryUsage() const
+        {
+            return m_blocks.size() * sizeof(Block) + m_rows.size() * sizeof(BitPackKernels::PackedRow) + sizeof(m_tail)
+                 + m_pyramid.memoryUsage();
+        }
+
+        void push_back(int16_t value)
+        {
+            append(&value, 1);
+        }
+
+        /**
+         * \brief Append n values at once, only called by the producer
+         */
+        void append(const int16_t* values, size_t n)
+        {
+            size_t size = m_size.load(std::memory_order_relaxed);
+            while (n > 0)
+            {
+                size_t offset = size % blockSize;
+                size_t num = std::min<size_t>(n, blockSize - offset);
+                for (size_t k = 0; k < num; k++)
+                {
+                    m_tail[offset + k].store(values[k], std::memory_order_relaxed);
+                }
+                values += num;
+                size += num;
+                n -= num;
+                if (size % blockSize == 0)
+                {
+                    encodeTail();
+                }
+            }
+            m_size.store(size, std::memory_order_release);
+        }
+
+        /**
+         * \brief Call fn(const int16_t* values, size_t n) for the decoded pieces of the values [from, to)
+         *
+         * \details
+         *      to is clamped to the published size. Each block is decoded into a
+         *      buffer on the stack, the pieces are only valid during the call of fn.
+         */
+        template<typename TFn>
+        void forEachSegment(size_t from, size_t to, TFn fn) const
+        {
+            to = std::min(to, size());
+            alignas(32) int16_t buffer[blockSize];
+            while (from < to)
+            {
+                size_t b = from / blockSize;
+                size_t offset = from % blockSize;
+                size_t num = std::min<size_t>(to - from, blockSize - offset);
+                decodeBlock(b, offset + num, buffer);
+                fn(static_cast<const int16_t*>(buffer + offset), num);
+                from += num;
+            }
+        }
+
+        /**
+         * \brief Minimum and maximum of the values [from, to), to is clamped to the published size
+         *
+         * \details
+         *      The whole blocks in the range are looked up in the pyramid, only the
+         *      partial blocks at both ends are decoded.
+         */
+        MinMax minMax(size_t from, size_t to) const
+        {
+            MinMax result;
+            to = std::min(to, size());
+            auto addValues = [this, &result](size_t first, size_t last) {
+                forEachSegment(first, last, [&result](const int16_t* values, size_t n) {
+                    auto [min, max] = std::minmax_element(values, values + n);
+                    result.add(*min);
+                    result.add(*max);
+                });
+            };
+            size_t firstBlock = (from + blockSize - 1) / blockSize;
+            size_t lastBlock = std::min(to / blockSize, m_pyramid.size());
+            if (firstBlock < lastBlock)
+            {
+                result = m_pyramid.range(firstBlock, lastBlock);
+                addValues(from, firstBlock * blockSize);
+                addValues(lastBlock * blockSize, to);
+            }
+            else
+            {
+                addValues(from, to);
+            }
+            return result;
+        }
+
+        std::vector<int16_t> toStdVector() const
+        {
+            return toStdVector(0, size());
+        }
+
+        /**
+         * \brief Copy of the values [from, to), to is clamped to the published size
+         */
+        std::vector<int16_t> toStdVector(size_t from, size_t to) const
+        {
+            std::vector<int16_t> n(0);
+            to = std::min(to, size());
+            if (from < to)
+            {
+                n.reserve(to - from);
+                forEachSegment(from, to, [&n](const int16_t* values, size_t num) {
+                    n.insert(n.end(), values, values + num);
+                });
+            }
+            return n;
+        }
+
+        /**
+         * \brief Serialize the values [from, to) through write(const void* data, size_t n)
+         *
+         * \details
+         *      to is clamped to the published size. The layout is
+         *          StoredHeader
+         *          StoredBlock blocks[numValues / blockSize]
+         *          PackedRow   rows[numRows]
+         *          int16_t     tail[numValues % blockSize]
+         *      The encoded blocks are written as they are, unless from is not at a
+         *      block boundary, then the values are encoded again.
+         */
+        template<typename TWrite>
+        void write(size_t from, size_t to, TWrite write) const
+        {
+            to = std::min(to, size());
+            from = std::min(from, to);
+            if (from % blockSize != 0)
+            {
+                EncodedColumn column;
+                forEachSegment(from, to, [&column](const int16_t* values, size_t n) {
+                    column.append(values, n);
+                });
+                column.write(0, column.size(), write);
+                return;
+            }
+            const size_t firstBlock = from / blockSize;
+            const size_t lastBlock = to / blockSize;
+            StoredHeader hdr = {to - from, 0};
+            for (size_t b = firstBlock; b < lastBlock; b++)
+            {
+                hdr.numRows += m_blocks[b].bits;
+            }
+            write(&hdr, sizeof(hdr));
+            uint32_t row = 0;
+            for (size_t b = firstBlock; b < lastBlock; b++)
+            {
+                Block block = m_blocks[b];
+                MinMax leaf = m_pyramid.range(b, b + 1);
+                StoredBlock stored = {row, leaf.min, leaf.max, block.bits, {0, 0, 0}};
+                write(&stored, sizeof(stored));
+                row += block.bits;
+            }
+            for (size_t b = firstBlock; b < lastBlock; b++)
+            {
+                Block block = m_blocks[b];
+                if (block.bits > 0)
+                {
+                    write(payload(block), block.bits * sizeof(BitPackKernels::PackedRow));
+                }
+            }
+            forEachSegment(lastBlock * blockSize, to, [&write](const int16_t* values, size_t n) {
+                write(values, n * sizeof(int16_t));
+            });
+        }
+
+        /**
+         * \brief Check n bytes written by write(), numValues is set to the number of values they hold
+         */
+        static bool checkStored(const char* data, size_t n, uint64_t& numValues)
+        {
+            StoredHeader hdr;
+            if (n < sizeof(hdr))
+            {
+                return false;
+            }
+            memcpy(&hdr, data, sizeof(hdr));
+            const uint64_t numBlocks = hdr.numValues / blockSize;
+            if ( numBlocks > n / sizeof(StoredBlock) || hdr.numRows > n / sizeof(BitPackKernels::PackedRow) ||
+                 n != sizeof(hdr) + numBlocks * sizeof(StoredBlock) + hdr.numRows * sizeof(BitPackKernels::PackedRow)
+                      + (hdr.numValues % blockSize) * sizeof(int16_t) )
+            {
+                return false;
+            }
+            /* the payloads follow each other without gaps */
+            uint64_t row = 0;
+            for (uint64_t b = 0; b < numBlocks; b++)
+            {
+                StoredBlock stored;
+                memcpy(&stored, data + sizeof(hdr) + b * sizeof(StoredBlock), sizeof(stored));
+                if (stored.row != row || stored.bits > 16 || stored.min > stored.max)
+                {
+                    return false;
+                }
+                row += stored.bits;
+            }
+            numValues = hdr.numValues;
+            return row == hdr.numRows;
+        }
+
+        /**
+         * \brief Append n bytes written by write(), only called by the producer
+         *
+         * \details
+         *      If the column ends at a block boundary, the blocks are taken over
+         *      without decoding them. Else they are decoded and appended like values.
+         *
+         * \return false, if data is not a valid serialization
+         */
+        bool appendStored(const char* data, size_t n)
+        {
+            uint64_t numValues = 0;
+            if ( !checkStored(data, n, numValues) )
+            {
+                return false;
+            }
+            StoredHeader hdr;
+            memcpy(&hdr, data, sizeof(hdr));
+            const uint64_t numBlocks = numValues / blockSize;
+            const char* blocks = data + sizeof(hdr);
+            const char* rows = blocks + numBlocks * sizeof(StoredBlock);
+            const char* tail = rows + hdr.numRows * sizeof(BitPackKernels::PackedRow);
+            const size_t size = m_size.load(std::memory_order_relaxed);
+            const bool aligned = size % blockSize == 0;
+            alignas(32) int16_t values[blockSize];
+            BitPackKernels::PackedRow packed[16];
+            for (uint64_t b = 0; b < numBlocks; b++)
+            {
+                StoredBlock stored;
+                memcpy(&stored, blocks + b * sizeof(StoredBlock), sizeof(stored));
+                memcpy(packed, rows + stored.row * sizeof(BitPackKernels::PackedRow), stored.bits * sizeof(BitPackKernels::PackedRow));
+                if (aligned)
+                {
+                    appendBlock(packed, stored.min, stored.max, stored.bits);
+                }
+                else
+                {
+                    BitPackKernels::decode(packed, stored.bits, stored.min, values);
+                    append(values, blockSize);
+                }
+            }
+            if (aligned && numBlocks > 0)
+            {
+                m_numEncoded.store(m_blocks.size(), std::memory_order_release);
+                m_size.store(size + numBlocks * blockSize, std::memory_order_release);
+            }
+            memcpy(values, tail, (numValues % blockSize) * sizeof(int16_t));
+            append(values, numValues % blockSize);
+            return true;
+        }
+
+        /**
+         * \brief Value i, i has to be below the published size
+         */
+        int16_t operator[](size_t i) const
+        {
+            size_t b = i / blockSize;
+            if (b < m_numEncoded.load(std::memory_order_acquire))
+            {
+                return decodeValue(b, i % blockSize);
+            }
+            int16_t value = m_tail[i % blockSize].load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (b < m_numEncoded.load(std::memory_order_acquire))
+            {
+                /* the raw block has been encoded and reused meanwhile */
+                return decodeValue(b, i % blockSize);
+            }
+            return value;
+        }
+
+    private:
+        struct Block
+        {
+            /* first row of the payload in m_rows */
+            uint32_t row;
+            int16_t base;
+            uint8_t bits;
+        };
+
+        /**
+         * \brief Start of the values written by write()
+         */
+        struct StoredHeader
+        {
+            uint64_t numValues;
+            /* rows of all stored blocks */
+            uint64_t numRows;
+        };
+
+        struct StoredBlock
+        {
+            /* first row of the payload, counted from the first stored block */
+            uint32_t row;
+            int16_t min;
+            int16_t max;
+            uint8_t bits;
+            uint8_t reserved[3];
+        };
+
+        /* rows per chunk of m_rows, a payload never crosses chunks */
+        static constexpr size_t rowsPerChunk = 1 << 12;
+
+        const BitPackKernels::PackedRow* payload(const Block& block) const
+        {
+            const BitPackKernels::PackedRow* rows = nullptr;
+            m_rows.forEachSegment(block.row, block.row + block.bits, [&rows](const BitPackKernels::PackedRow* p, size_t) {
+                rows = p;
+            });
+            return rows;
+        }
+
+        int16_t decodeValue(size_t b, uint32_t k) const
+        {
+            Block block = m_blocks[b];
+            return BitPackKernels::decodeValue(payload(block), block.bits, block.base, k);
+        }
+
+        /**
+         * \brief Values [0, num) of block b
+         */
+        void decodeBlock(size_t b, size_t num, int16_t* out) const
+        {
+            if (b >= m_numEncoded.load(std::memory_order_acquire))
+            {
+                for (size_t k = 0; k < num; k++)
+                {
+                    out[k] = m_tail[k].load(std::memory_order_relaxed);
+                }
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (b >= m_numEncoded.load(std::memory_order_acquire))
+                {
+                    return;
+                }
+                /* the raw block has been encoded and reused meanwhile */
+            }
+            Block block = m_blocks[b];
+            BitPackKernels::decode(payload(block), block.bits, block.base, out);
+        }
+
+        /**
+         * \brief Encode the full raw block and publish it, only called by the producer
+         */
+        void encodeTail()
+        {
+            int16_t values[blockSize];
+            for (uint32_t k = 0; k < blockSize; k++)
+            {
+                values[k] = m_tail[k].load(std::memory_order_relaxed);
+            }
+            auto [min, max] = std::minmax_element(values, values + blockSize);
+            uint32_t bits = BitPackKernels::bitWidth(*min, *max);
+            BitPackKernels::PackedRow rows[16];
+            BitPackKernels::encode(values, *min, bits, rows);
+            appendBlock(rows, *min, *max, bits);
+            m_numEncoded.store(m_blocks.size(), std::memory_order_release);
+            /* the raw block is only overwritten after readers can see, that it has been encoded */
+            std::atomic_thread_fence(std::memory_order_release);
+        }
+
+        /**
+         * \brief Append an encoded block behind the encoded ones without publishing it
+         */
+        void appendBlock(const BitPackKernels::PackedRow* rows, int16_t min, int16_t max, uint32_t bits)
+        {
+            Block block;
+            block.base = min;
+            block.bits = bits;
+            /* pad the current chunk, if the payload does not fit */
+            const BitPackKernels::PackedRow padding[16] = {};
+            size_t used = m_rows.size() % rowsPerChunk;
+            if (block.bits > 0 && used + block.bits > rowsPerChunk)
+            {
+                m_rows.append(padding, rowsPerChunk - used);
+            }
+            block.row = m_rows.size();
+            if (block.bits > 0)
+            {
+                m_rows.append(rows, block.bits);
+            }
+            m_blocks.push_back(block);
+            m_pyramid.push_back({min, max});
+        }
+
+        std::atomic<size_t> m_size = 0;
+        /* number of encoded blocks */
+        std::atomic<size_t> m_numEncoded = 0;
+        DataVector<Block, 1 << 12> m_blocks;
+        DataVector<BitPackKernels::PackedRow, rowsPerChunk> m_rows;
+        /* minimum and maximum of the encoded blocks */
+        MinMaxPyramid m_pyramid;
+        /* values of the block behind the encoded ones */
+        std::atomic<int16_t> m_tail[blockSize] = {};
+};
+
+#endif /* ENCODED_COLUMN_H_ */
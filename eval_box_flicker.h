@@ -0,0 +1,336 @@
+/**
+ * Temporal consistency of the detected boxes.
+ *
+ * The boxes of consecutive images are matched by their intersection over
+ * union (IoU). A box without a box of the same class and sufficient overlap
+ * in the other image is a track break: the object appeared, disappeared or
+ * jumped. Unlike the number of detections, the number of track breaks per
+ * image also reveals detections, that move while their count stays the same.
+ */
+
+#ifndef EVAL_BOX_FLICKER_H_
+#define EVAL_BOX_FLICKER_H_
+
+#include <cstdint>
+#include <algorithm>
+#include <limits>
+#include <type_traits>
+#include <vector>
+
+#include "detection_results_v2.pb.h"
+#include "example_view.h"
+#include "cpu_dispatch.h"
+
+struct EvalBoxFlicker
+{
+    typedef object_detection::Example UParser;
+    typedef ExampleView UScanView;
+    /* fields decoded while scanning, in addition to those of the count evaluator */
+    static constexpr uint32_t scanFields = ExampleView::NUM_DETECTIONS | ExampleView::SCORES |
+                                           ExampleView::CLASSES | ExampleView::BOXES;
+    /* identifies results of this evaluator, e.g. in caches */
+    static constexpr const char* name = "EvalBoxFlicker";
+    /* only detections with a score above are matched, independent of the count threshold */
+    static constexpr int minScore = 50;
+    /* boxes overlapping at least this much show the same object */
+    static constexpr float minIou = 0.5f;
+
+    /**
+     * \brief Boxes of an image as structure of arrays
+     *
+     * \details
+     *      The arrays are padded to a multiple of lanes with empty boxes of an
+     *      invalid class, which never match.
+     */
+    struct Boxes
+    {
+        static constexpr uint32_t lanes = 8;
+        static constexpr int32_t paddingClass = std::numeric_limits<int32_t>::min();
+
+        std::vector<float> xmin, xmax, ymin, ymax, area;
+        std::vector<int32_t> classes;
+        /* number of boxes without padding */
+        uint32_t size = 0;
+
+        /**
+         * \brief Remove all boxes and make room for up to n boxes and their padding
+         */
+        void reset(uint32_t n)
+        {
+            size = 0;
+            uint32_t capacity = (n + lanes - 1) / lanes * lanes;
+            if (classes.size() < capacity)
+            {
+                for (auto* column : {&xmin, &xmax, &ymin, &ymax, &area})
+                {
+                    column->resize(capacity);
+                }
+                classes.resize(capacity);
+            }
+        }
+
+        /**
+         * \brief Append a box, there must be room for it
+         */
+        void add(float x0, float x1, float y0, float y1, int32_t cls)
+        {
+            xmin[size] = x0;
+            xmax[size] = x1;
+            ymin[size] = y0;
+            ymax[size] = y1;
+            area[size] = std::max(0.0f, x1 - x0) * std::max(0.0f, y1 - y0);
+            classes[size] = cls;
+            size++;
+        }
+
+        void pad()
+        {
+            for (uint32_t k = size; k < numChunks() * lanes; k++)
+            {
+                xmin[k] = xmax[k] = ymin[k] = ymax[k] = area[k] = 0.0f;
+                classes[k] = paddingClass;
+            }
+        }
+
+        uint32_t numChunks() const
+        {
+            return (size + lanes - 1) / lanes;
+        }
+    };
+
+    /**
+     * \brief Memory reused across the examples of a sequence
+     */
+    struct State
+    {
+        /* boxes of the preceding image, valid is false if there is none */
+        Boxes prev;
+        bool valid = false;
+        Boxes cur;
+        std::vector<uint32_t> matched;
+    };
+
+    /**
+     * \brief Kernel counting the boxes of cur and prev without a match in the other image
+     *
+     * \details
+     *      matched_prev must hold prev.numChunks() entries, the bit k of entry c is set
+     *      if box c * Boxes::lanes + k of prev has a match.
+     */
+    typedef uint32_t (*BreakKernel)(const Boxes& prev, const Boxes& cur, uint32_t* matched_prev);
+
+    /**
+     * \brief Number of track breaks between each of a sequence of examples and its predecessor
+     *
+     * Boxes of the detections of class_ids with a score above minScore are matched.
+     *
+     * \param examples num_examples consecutive images as UParser or UScanView
+     * \param state Boxes of the predecessor of examples[0], if state.valid is set. Holds
+     *              the boxes of the last example afterwards, so that the next sequence
+     *              continues seamlessly. The first image without a predecessor has no
+     *              track breaks.
+     * \param breaks num_examples counts, saturated to the range of TCount
+     */
+    template<typename TExample, typename TCount>
+    static bool calcTrackBreaks(const TExample* const* examples, size_t num_examples,
+            const std::vector<int>& class_ids, State& state, TCount* breaks)
+    {
+        static const BreakKernel kernel = breakKernel(CpuDispatch::isa());
+        bool selected[256] = {false};
+        for (int id : class_ids)
+        {
+            selected[uint8_t(id)] = true;
+        }
+        for (size_t k = 0; k < num_examples; k++) /* for each example */
+        {
+            gatherBoxes(*examples[k], selected, state.cur);
+            uint32_t val = 0;
+            if (state.valid)
+            {
+                state.matched.resize(state.prev.numChunks());
+                val = kernel(state.prev, state.cur, state.matched.data());
+            }
+            breaks[k] = std::min<uint32_t>(val, std::numeric_limits<TCount>::max());
+            std::swap(state.prev, state.cur);
+            state.valid = true;
+        }
+        return true;
+    }
+
+    /**
+     * \brief Kernel for an instruction set, the next less capable one if there is none
+     */
+    static BreakKernel breakKernel(CpuDispatch::Isa isa)
+    {
+#if CPU_DISPATCH_X86
+        switch (isa)
+        {
+            case CpuDispatch::Isa::Avx512:
+            case CpuDispatch::Isa::Avx2:   return breaksAvx2;
+            case CpuDispatch::Isa::Sse42:  return breaksSse42;
+            default:                       break;
+        }
+#endif
+        (void)isa;
+        return breaksScalar;
+    }
+
+    private:
+        /**
+         * \brief Boxes of the selected detections with a score above minScore
+         */
+        template<typename TExample>
+        static void gatherBoxes(const TExample& example, const bool* selected, Boxes& boxes)
+        {
+            uint32_t num_detections = std::min<size_t>({example.num_detections(),
+                    example.scores().size(), example.classes().size()});
+            boxes.reset(num_detections);
+            const char* scores = example.scores().data();
+            const char* classes = example.classes().data();
+            auto wanted = [&](uint32_t n) {
+                return int8_t(scores[n]) > minScore && selected[uint8_t(classes[n])];
+            };
+            if constexpr (std::is_same_v<TExample, ExampleView>)
+            {
+                ExampleView::BoxReader reader = example.boxes();
+                float x0, x1, y0, y1;
+                for (uint32_t n = 0; n < num_detections && reader.next(); n++)
+                {
+                    if ( wanted(n) && reader.decode(x0, x1, y0, y1) )
+                    {
+                        boxes.add(x0, x1, y0, y1, uint8_t(classes[n]));
+                    }
+                }
+            }
+            else
+            {
+                num_detections = std::min<uint32_t>(num_detections, example.boxes_size());
+                for (uint32_t n = 0; n < num_detections; n++)
+                {
+                    if ( wanted(n) )
+                    {
+                        auto& box = example.boxes(n);
+                        boxes.add(box.xmin(), box.xmax(), box.ymin(), box.ymax(), uint8_t(classes[n]));
+                    }
+                }
+            }
+            boxes.pad();
+        }
+
+        /**
+         * \brief Boxes of prev without a match, given the matches found by a kernel
+         */
+        static uint32_t unmatched(const Boxes& prev, const uint32_t* matched_prev)
+        {
+            uint32_t numMatched = 0;
+            for (uint32_t c = 0; c < prev.numChunks(); c++)
+            {
+                numMatched += __builtin_popcount(matched_prev[c]);
+            }
+            return prev.size - numMatched;
+        }
+
+        static uint32_t breaksScalar(const Boxes& prev, const Boxes& cur, uint32_t* matched_prev)
+        {
+            std::fill(matched_prev, matched_prev + prev.numChunks(), 0);
+            uint32_t breaks = 0;
+            for (uint32_t i = 0; i < cur.size; i++)
+            {
+                bool matched = false;
+                for (uint32_t j = 0; j < prev.size; j++)
+                {
+                    float width = std::max(0.0f, std::min(prev.xmax[j], cur.xmax[i]) - std::max(prev.xmin[j], cur.xmin[i]));
+                    float height = std::max(0.0f, std::min(prev.ymax[j], cur.ymax[i]) - std::max(prev.ymin[j], cur.ymin[i]));
+                    float inter = width * height;
+                    /* IoU >= minIou without a division */
+                    if (prev.classes[j] == cur.classes[i] && inter >= minIou * (prev.area[j] + cur.area[i] - inter))
+                    {
+                        matched = true;
+                        matched_prev[j / Boxes::lanes] |= 1u << (j % Boxes::lanes);
+                    }
+                }
+                breaks += !matched;
+            }
+            return breaks + unmatched(prev, matched_prev);
+        }
+
+#if CPU_DISPATCH_X86
+        /*
+         * The SIMD kernels compare a box of cur against the boxes of prev chunk by
+         * chunk. The padding of prev never matches, so no lanes have to be masked.
+         */
+
+        TARGET_SSE42 static uint32_t breaksSse42(const Boxes& prev, const Boxes& cur, uint32_t* matched_prev)
+        {
+            const uint32_t num_chunks = prev.numChunks();
+            std::fill(matched_prev, matched_prev + num_chunks, 0);
+            const __m128 zero = _mm_setzero_ps();
+            const __m128 min_iou = _mm_set1_ps(minIou);
+            uint32_t breaks = 0;
+            for (uint32_t i = 0; i < cur.size; i++)
+            {
+                __m128 xmin_i = _mm_set1_ps(cur.xmin[i]);
+                __m128 xmax_i = _mm_set1_ps(cur.xmax[i]);
+                __m128 ymin_i = _mm_set1_ps(cur.ymin[i]);
+                __m128 ymax_i = _mm_set1_ps(cur.ymax[i]);
+                __m128 area_i = _mm_set1_ps(cur.area[i]);
+                __m128i class_i = _mm_set1_epi32(cur.classes[i]);
+                uint32_t matched = 0;
+                for (uint32_t j = 0; j < num_chunks * Boxes::lanes; j += 4) /* for each half chunk */
+                {
+                    __m128 width = _mm_max_ps(zero, _mm_sub_ps(_mm_min_ps(_mm_loadu_ps(&prev.xmax[j]), xmax_i),
+                                                               _mm_max_ps(_mm_loadu_ps(&prev.xmin[j]), xmin_i)));
+                    __m128 height = _mm_max_ps(zero, _mm_sub_ps(_mm_min_ps(_mm_loadu_ps(&prev.ymax[j]), ymax_i),
+                                                                _mm_max_ps(_mm_loadu_ps(&prev.ymin[j]), ymin_i)));
+                    __m128 inter = _mm_mul_ps(width, height);
+                    __m128 uni = _mm_sub_ps(_mm_add_ps(_mm_loadu_ps(&prev.area[j]), area_i), inter);
+                    __m128 overlap = _mm_cmpge_ps(inter, _mm_mul_ps(min_iou, uni));
+                    __m128i same = _mm_cmpeq_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&prev.classes[j])), class_i);
+                    uint32_t mask = _mm_movemask_ps(_mm_and_ps(overlap, _mm_castsi128_ps(same)));
+                    matched_prev[j / Boxes::lanes] |= mask << (j % Boxes::lanes);
+                    matched |= mask;
+                }
+                breaks += matched == 0;
+            }
+            return breaks + unmatched(prev, matched_prev);
+        }
+
+        TARGET_AVX2 static uint32_t breaksAvx2(const Boxes& prev, const Boxes& cur, uint32_t* matched_prev)
+        {
+            const uint32_t num_chunks = prev.numChunks();
+            std::fill(matched_prev, matched_prev + num_chunks, 0);
+            const __m256 zero = _mm256_setzero_ps();
+            const __m256 min_iou = _mm256_set1_ps(minIou);
+            uint32_t breaks = 0;
+            for (uint32_t i = 0; i < cur.size; i++)
+            {
+                __m256 xmin_i = _mm256_set1_ps(cur.xmin[i]);
+                __m256 xmax_i = _mm256_set1_ps(cur.xmax[i]);
+                __m256 ymin_i = _mm256_set1_ps(cur.ymin[i]);
+                __m256 ymax_i = _mm256_set1_ps(cur.ymax[i]);
+                __m256 area_i = _mm256_set1_ps(cur.area[i]);
+                __m256i class_i = _mm256_set1_epi32(cur.classes[i]);
+                uint32_t matched = 0;
+                for (uint32_t c = 0; c < num_chunks; c++) /* for each chunk */
+                {
+                    uint32_t j = c * Boxes::lanes;
+                    __m256 width = _mm256_max_ps(zero, _mm256_sub_ps(_mm256_min_ps(_mm256_loadu_ps(&prev.xmax[j]), xmax_i),
+                                                                     _mm256_max_ps(_mm256_loadu_ps(&prev.xmin[j]), xmin_i)));
+                    __m256 height = _mm256_max_ps(zero, _mm256_sub_ps(_mm256_min_ps(_mm256_loadu_ps(&prev.ymax[j]), ymax_i),
+                                                                      _mm256_max_ps(_mm256_loadu_ps(&prev.ymin[j]), ymin_i)));
+                    __m256 inter = _mm256_mul_ps(width, height);
+                    __m256 uni = _mm256_sub_ps(_mm256_add_ps(_mm256_loadu_ps(&prev.area[j]), area_i), inter);
+                    __m256 overlap = _mm256_cmp_ps(inter, _mm256_mul_ps(min_iou, uni), _CMP_GE_OQ);
+                    __m256i same = _mm256_cmpeq_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i_u*>(&prev.classes[j])), class_i);
+                    uint32_t mask = _mm256_movemask_ps(_mm256_and_ps(overlap, _mm256_castsi256_ps(same)));
+                    matched_prev[c] |= mask;
+                    matched |= mask;
+                }
+                breaks += matched == 0;
+            }
+            return breaks + unmatched(prev, matched_prev);
+        }
+#endif
+};
+
+#endif /* EVAL_BOX_FLICKER_H_ */
@@ -0,0 +1,192 @@
+/**
+ * Compile-time configurations of evaluators.
+ *
+ * A configuration fixes the classes and the ascending score thresholds, that
+ * an evaluator counts, as template arguments. Kernels instantiated for a
+ * configuration broadcast the class ids and thresholds once and unroll the
+ * loops over them completely.
+ *
+ * The kernels of the configurations used by a deployment are prebuilt and
+ * added to a KernelRegistry. At runtime, the kernel matching the requested
+ * classes and thresholds is taken from the registry, any other request is
+ * served by the generic kernels.
+ */
+
+#ifndef EVAL_CONFIG_H_
+#define EVAL_CONFIG_H_
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * \brief Classes counted by an evaluator
+ */
+template<int... Ids>
+struct ClassSet
+{
+    static constexpr uint32_t size = sizeof...(Ids);
+    static constexpr std::array<int, size> ids = {Ids...};
+};
+
+/**
+ * \brief Ascending score thresholds [0..100], a detection counts for each threshold below its score
+ */
+template<int... Values>
+struct ThresholdSet
+{
+    static constexpr uint32_t size = sizeof...(Values);
+    static constexpr std::array<int, size> values = {Values...};
+
+    static constexpr bool ascending()
+    {
+        for (uint32_t l = 1; l < size; l++)
+        {
+            if (values[l] <= values[l - 1])
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+    static_assert(ascending(), "Thresholds have to be ascending");
+
+    /**
+     * \brief Distance between consecutive thresholds, 0 if they are not equally spaced
+     */
+    static constexpr int step()
+    {
+        if (size < 2)
+        {
+            return 0;
+        }
+        for (uint32_t l = 2; l < size; l++)
+        {
+            if (values[l] - values[l - 1] != values[1] - values[0])
+            {
+                return 0;
+            }
+        }
+        return values[1] - values[0];
+    }
+};
+
+namespace EvalConfigDetail
+{
+    template<int First, int Step, typename TSeq>
+    struct ThresholdRange;
+
+    template<int First, int Step, int... I>
+    struct ThresholdRange<First, Step, std::integer_sequence<int, I...>>
+    {
+        typedef ThresholdSet<(First + I * Step)...> type;
+    };
+};
+
+/**
+ * \brief Thresholds First, First + Step, ... up to Last
+ */
+template<int First, int Last, int Step>
+using ThresholdRange = typename EvalConfigDetail::ThresholdRange<First, Step,
+        std::make_integer_sequence<int, (Last - First) / Step + 1>>::type;
+
+template<typename TClasses, typename TThresholds>
+struct EvalConfig
+{
+    typedef TClasses Classes;
+    typedef TThresholds Thresholds;
+    static constexpr uint32_t numClasses = TClasses::size;
+    static constexpr uint32_t numThresholds = TThresholds::size;
+
+    /**
+     * \brief Classes and thresholds as readable text, e.g. for log messages
+     */
+    static std::string name()
+    {
+        std::string text = "classes";
+        for (int id : TClasses::ids)
+        {
+            text += " " + std::to_string(id);
+        }
+        text += ", thresholds";
+        for (int value : TThresholds::values)
+        {
+            text += " " + std::to_string(value);
+        }
+        return text;
+    }
+};
+
+/**
+ * \brief Kernels of prebuilt configurations, looked up by classes and thresholds
+ *
+ * \details
+ *      Filled once and only read afterwards, lookups may run concurrently.
+ */
+template<typename TKernel>
+class KernelRegistry
+{
+    public:
+        /**
+         * \brief Register the kernel of a configuration, nullptr kernels are ignored
+         */
+        template<typename TConfig>
+        void add(TKernel kernel)
+        {
+            if (kernel == nullptr)
+            {
+                return;
+            }
+            Entry entry;
+            entry.name = TConfig::name();
+            entry.classIds.assign(TConfig::Classes::ids.begin(), TConfig::Classes::ids.end());
+            entry.thresholds.assign(TConfig::Thresholds::values.begin(), TConfig::Thresholds::values.end());
+            entry.kernel = kernel;
+            m_entries.push_back(entry);
+        }
+
+        /**
+         * \brief Kernel of the configuration with exactly these classes and thresholds
+         *
+         * \return nullptr, if no such configuration has been registered
+         */
+        TKernel find(const int* class_ids, uint32_t num_classes, const int* thresholds, uint32_t num_thresholds) const
+        {
+            for (const Entry& entry : m_entries)
+            {
+                if ( entry.classIds.size() == num_classes && entry.thresholds.size() == num_thresholds &&
+                     std::equal(entry.classIds.begin(), entry.classIds.end(), class_ids) &&
+                     std::equal(entry.thresholds.begin(), entry.thresholds.end(), thresholds) )
+                {
+                    return entry.kernel;
+                }
+            }
+            return nullptr;
+        }
+
+        size_t size() const
+        {
+            return m_entries.size();
+        }
+
+        const std::string& name(size_t idx) const
+        {
+            return m_entries[idx].name;
+        }
+
+    private:
+        struct Entry
+        {
+            std::string name;
+            std::vector<int> classIds;
+            std::vector<int> thresholds;
+            TKernel kernel = nullptr;
+        };
+
+        std::vector<Entry> m_entries;
+};
+
+#endif /* EVAL_CONFIG_H_ */
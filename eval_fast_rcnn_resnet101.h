@@ -1,92 +1,716 @@
 #ifndef EVAL_FAST_RCNN_RESTNET101_H_
 #define EVAL_FAST_RCNN_RESTNET101_H_
 
-#include <immintrin.h>
 #include <cassert>
+#include <cstring>
+#include <algorithm>
+#include <limits>
 
 #include "detection_results_v2.pb.h"
+#include "example_view.h"
+#include "cpu_dispatch.h"
+#include "eval_config.h"
 
 struct EvalFastRcnnResnet101
 {
     typedef object_detection::Example UParser;
+    /* decoder used while scanning, only the fields below are decoded */
+    typedef ExampleView UScanView;
+    static constexpr uint32_t scanFields = ExampleView::NUM_DETECTIONS | ExampleView::SCORES | ExampleView::CLASSES;
+    /* identifies results of this evaluator, e.g. in caches */
+    static constexpr const char* name = "EvalFastRcnnResnet101";
+    /* classes and score levels counted by the data model by default */
+    typedef EvalConfig< ClassSet<1,2>, ThresholdRange<0,100,5> > DefaultConfig;
 
     /**
      * \brief Extracts detections results from a single example
      *
      * The classes and scores are assumed to be int8[]
      *
-     * \param example
+     * \param example Either UParser or UScanView
      * \param class_ids The classes, for which number of detections is evaluated
      * \param valid_det Number of detections above threshold
      * \param threshold [0..100]
      */
-    static bool calcNumDetections(UParser& example, const std::vector<int>& class_ids, 
+    template<typename TExample>
+    static bool calcNumDetections(const TExample& example, const std::vector<int>& class_ids, 
             std::vector<int>& valid_det, int threshold)
     {
-        static uint32_t num_detections_old = 0;
-        static char* scores_aligned = nullptr;
-        static char* classes_aligned = nullptr;
-
         assert(class_ids.size() == valid_det.size() &&
                 "For each class-id, we need to the the number of detections");
-        uint32_t num_detections = example.num_detections();
-        /* we process 32 int8-integers at a time */
-        const size_t chunk_size = 32;
-        const size_t alignment = 32; // required by AVX256 instructions
-        /* calculate number of chucks by ceiling */
-        auto rational_ceil = [](size_t num, size_t denom) { return (num + denom - 1) / denom; };
-        uint32_t chunks = rational_ceil(num_detections,chunk_size);
-        size_t size = chunk_size * chunks;
-        if (num_detections != num_detections_old)
-        {
-            delete scores_aligned;
-            delete classes_aligned;
-            scores_aligned = (char*)aligned_alloc( alignment, size );
-            classes_aligned = (char*)aligned_alloc( alignment, size );
-            if (scores_aligned == nullptr || classes_aligned == nullptr)
-            {
-                // memory allocation failed
-                num_detections_old = 0;
-                return false;
-            }
-            num_detections_old = num_detections;
-        }
-        memset(scores_aligned, 0, size);
-        assert(num_detections <= size && "Not enough memory for all detections");
-        memcpy(scores_aligned, (example.scores()).c_str(), num_detections);
-        memset(classes_aligned, 0, size);
-        assert(num_detections <= size && "Not enough memory for all detections");
-        memcpy(classes_aligned, (example.classes()).c_str(), num_detections);
-        
-        for (uint32_t m = 0; m < class_ids.size(); m++) /* for each class */
-        {
-            int ref_class = class_ids[m];
-            valid_det[m] = 0;
-            for (size_t n = 0; n < chunks; n++) /* for each chunk is the list of all detections */
-            {
-                __m256i classes8 = _mm256_load_si256((__m256i_u const *)(classes_aligned + n*chunk_size));
-                __m256i scores8  = _mm256_load_si256((__m256i_u const *)(scores_aligned + n*chunk_size));
-                /* we work on chunks of 32 x int8_t */
-                /* create vector with reference class in each entry */
-                __m128i ref_class_128 = _mm_set_epi64x(0, ref_class);
-                __m256i ref_class_vec = _mm256_broadcastb_epi8 (ref_class_128);
-                /* compare reference class with detected class */
-                __m256i class_matches = _mm256_cmpeq_epi8 (ref_class_vec, classes8);
-
-                /* we check if score is above detection threshold */
-                __m128i threshold_128 = _mm_set_epi64x(0, threshold);
-                __m256i threshold_vec = _mm256_broadcastb_epi8 (threshold_128);
-                __m256i score_above_thres32 = _mm256_cmpgt_epi8 (scores8, threshold_vec);
-
-                /* if class matches, and score is above threshold, the result is valid */
-                int score_above_thres_mask = _mm256_movemask_epi8(score_above_thres32);
-                int class_mask = _mm256_movemask_epi8(class_matches);
-                int num_det_tmp = __builtin_popcount(score_above_thres_mask & class_mask);
-                valid_det[m] += num_det_tmp;
+        const TExample* examples[] = { &example };
+        std::vector<int*> columns(class_ids.size());
+        for (uint32_t m = 0; m < class_ids.size(); m++)
+        {
+            columns[m] = &valid_det[m];
+        }
+        return calcNumDetections(examples, 1, class_ids, threshold, columns.data());
+    }
+
+    /**
+     * \brief Kernel counting the detections of num_classes classes with a score above
+     *        each of num_thresholds ascending thresholds
+     *
+     * \details
+     *      Scores and classes are num_detections int8 values, they may be null if there
+     *      are none. counts[m * num_thresholds + l] is set to the number of detections of
+     *      class_ids[m] with a score above thresholds[l].
+     */
+    typedef void (*CountKernel)(const char* scores, const char* classes, uint32_t num_detections,
+            const int* thresholds, uint32_t num_thresholds, const int* class_ids, uint32_t num_classes,
+            uint32_t* counts);
+
+    /**
+     * \brief Extracts detection results from a batch of examples
+     *
+     * Reentrant, all state lives in the arguments. Results are written as one
+     * column per class (SoA). Each example is read once, regardless of the
+     * number of classes: few classes are compared chunk by chunk, many classes
+     * are counted via a lookup of the class index. The kernel is selected once
+     * from the instruction sets supported by the CPU.
+     *
+     * \param examples num_examples pointers to UParser or UScanView
+     * \param class_ids The classes, for which number of detections is evaluated
+     * \param threshold [0..100]
+     * \param valid_det For each class-id, a column of at least num_examples counts.
+     *                  valid_det[m][k] is the number of detections of class_ids[m] in examples[k]
+     */
+    template<typename TExample, typename TCount>
+    static bool calcNumDetections(const TExample* const* examples, size_t num_examples,
+            const std::vector<int>& class_ids, int threshold, TCount* const* valid_det)
+    {
+        const uint32_t num_classes = class_ids.size();
+        std::vector<uint32_t> counts(num_classes);
+        const CountKernel kernel = selectKernel(class_ids, &threshold, 1);
+        for (size_t k = 0; k < num_examples; k++) /* for each example */
+        {
+            count(kernel, *examples[k], &threshold, 1, class_ids, counts.data());
+            for (uint32_t m = 0; m < num_classes; m++)
+            {
+                valid_det[m][k] = counts[m];
             }
         }
         return true;
     }
+
+    /**
+     * \brief Number of detections above each of several thresholds for a batch of examples
+     *
+     * Allows to derive the number of detections for any of the thresholds later on,
+     * without evaluating the examples again.
+     *
+     * \param thresholds Ascending thresholds [0..100]
+     * \param levels For each class-id, a column of at least num_examples * thresholds.size()
+     *               counts. levels[m][k * thresholds.size() + l] is the number of detections of
+     *               class_ids[m] in examples[k] with a score above thresholds[l], saturated to
+     *               the range of TCount.
+     */
+    template<typename TExample, typename TCount>
+    static bool calcScoreLevels(const TExample* const* examples, size_t num_examples,
+            const std::vector<int>& class_ids, const std::vector<int>& thresholds, TCount* const* levels)
+    {
+        const uint32_t num_classes = class_ids.size();
+        const uint32_t num_thresholds = thresholds.size();
+        std::vector<uint32_t> counts(num_classes * num_thresholds);
+        const CountKernel kernel = selectKernel(class_ids, thresholds.data(), num_thresholds);
+        for (size_t k = 0; k < num_examples; k++) /* for each example */
+        {
+            count(kernel, *examples[k], thresholds.data(), num_thresholds, class_ids, counts.data());
+            for (uint32_t m = 0; m < num_classes; m++)
+            {
+                for (uint32_t l = 0; l < num_thresholds; l++)
+                {
+                    uint32_t val = std::min<uint32_t>(counts[m * num_thresholds + l], std::numeric_limits<TCount>::max());
+                    levels[m][k * num_thresholds + l] = val;
+                }
+            }
+        }
+        return true;
+    }
+
+    /**
+     * \brief Kernel for an instruction set, the next less capable one if there is none
+     */
+    static CountKernel countKernel(CpuDispatch::Isa isa)
+    {
+#if CPU_DISPATCH_X86
+        switch (isa)
+        {
+            case CpuDispatch::Isa::Avx512: return countAvx512;
+            case CpuDispatch::Isa::Avx2:   return countAvx2;
+            case CpuDispatch::Isa::Sse42:  return countSse42;
+            default:                       break;
+        }
+#endif
+        (void)isa;
+        return countScalar;
+    }
+
+    /**
+     * \brief Kernel specialized for the classes and thresholds of TConfig
+     *
+     * \details
+     *      The kernel ignores the class ids and thresholds passed at runtime.
+     *
+     * \return nullptr, if there is no specialization for the instruction set
+     */
+    template<typename TConfig>
+    static CountKernel fixedCountKernel(CpuDispatch::Isa isa)
+    {
+        static_assert(TConfig::numClasses <= maxCompareClasses,
+                "More classes are counted by the generic kernels");
+#if CPU_DISPATCH_X86
+        switch (isa)
+        {
+            case CpuDispatch::Isa::Avx512: return countFixedAvx512<TConfig>;
+            case CpuDispatch::Isa::Avx2:   return countFixedAvx2<TConfig>;
+            case CpuDispatch::Isa::Sse42:  return countFixedSse42<TConfig>;
+            default:                       break;
+        }
+#endif
+        (void)isa;
+        return nullptr;
+    }
+
+    /**
+     * \brief Prebuilt specializations for the instruction set used by all kernels
+     */
+    static const KernelRegistry<CountKernel>& registry()
+    {
+        static const KernelRegistry<CountKernel> kernels = makeRegistry(CpuDispatch::isa());
+        return kernels;
+    }
+
+    private:
+        /* up to this number of classes, comparing each chunk against every class is cheaper than a lookup */
+        static constexpr uint32_t maxCompareClasses = 4;
+
+        static KernelRegistry<CountKernel> makeRegistry(CpuDispatch::Isa isa)
+        {
+            KernelRegistry<CountKernel> kernels;
+            kernels.add<DefaultConfig>(fixedCountKernel<DefaultConfig>(isa));
+            kernels.add< EvalConfig< ClassSet<1>, ThresholdRange<0,100,5> > >(
+                    fixedCountKernel< EvalConfig< ClassSet<1>, ThresholdRange<0,100,5> > >(isa));
+            kernels.add< EvalConfig< ClassSet<2>, ThresholdRange<0,100,5> > >(
+                    fixedCountKernel< EvalConfig< ClassSet<2>, ThresholdRange<0,100,5> > >(isa));
+            return kernels;
+        }
+
+        /**
+         * \brief Prebuilt kernel for class_ids and thresholds, the generic kernel if there is none
+         */
+        static CountKernel selectKernel(const std::vector<int>& class_ids, const int* thresholds, uint32_t num_thresholds)
+        {
+            static const CountKernel generic = countKernel(CpuDispatch::isa());
+            CountKernel fixed = registry().find(class_ids.data(), class_ids.size(), thresholds, num_thresholds);
+            return fixed != nullptr ? fixed : generic;
+        }
+
+        template<typename TExample>
+        static void count(CountKernel kernel, const TExample& example, const int* thresholds, uint32_t num_thresholds,
+                const std::vector<int>& class_ids, uint32_t* counts)
+        {
+            /* never read beyond the serialized scores and classes */
+            uint32_t num_detections = std::min<size_t>({example.num_detections(),
+                    example.scores().size(), example.classes().size()});
+            kernel(example.scores().data(), example.classes().data(), num_detections,
+                   thresholds, num_thresholds, class_ids.data(), class_ids.size(), counts);
+        }
+
+        /**
+         * \brief Map each class value to the index of its first occurrence in class_ids, -1 if none
+         */
+        static void buildClassLut(const int* class_ids, uint32_t num_classes, int16_t* lut)
+        {
+            std::fill(lut, lut + 256, -1);
+            for (uint32_t m = num_classes; m-- > 0; )
+            {
+                lut[uint8_t(class_ids[m])] = m;
+            }
+        }
+
+        /**
+         * \brief Count a detection for every threshold below its score
+         */
+        static void countDetection(char score, int16_t class_idx, const int* thresholds,
+                uint32_t num_thresholds, uint32_t* counts)
+        {
+            if (class_idx < 0)
+            {
+                return;
+            }
+            uint32_t* row = counts + class_idx * num_thresholds;
+            for (uint32_t l = 0; l < num_thresholds && int8_t(score) > int8_t(thresholds[l]); l++)
+            {
+                row[l]++;
+            }
+        }
+
+        /**
+         * \brief Counts of classes listed more than once are only gathered for the first occurrence
+         */
+        static void copyDuplicateClasses(const int* class_ids, uint32_t num_classes, const int16_t* lut,
+                uint32_t num_thresholds, uint32_t* counts)
+        {
+            for (uint32_t m = 0; m < num_classes; m++)
+            {
+                uint32_t first = lut[uint8_t(class_ids[m])];
+                if (first != m)
+                {
+                    std::copy_n(counts + first * num_thresholds, num_thresholds, counts + m * num_thresholds);
+                }
+            }
+        }
+
+        static void countScalar(const char* scores, const char* classes, uint32_t num_detections,
+                const int* thresholds, uint32_t num_thresholds, const int* class_ids, uint32_t num_classes,
+                uint32_t* counts)
+        {
+            std::fill(counts, counts + num_classes * num_thresholds, 0);
+            if (num_detections == 0)
+            {
+                return;
+            }
+            int16_t lut[256];
+            buildClassLut(class_ids, num_classes, lut);
+            for (uint32_t n = 0; n < num_detections; n++)
+            {
+                countDetection(scores[n], lut[uint8_t(classes[n])], thresholds, num_thresholds, counts);
+            }
+            copyDuplicateClasses(class_ids, num_classes, lut, num_thresholds, counts);
+        }
+
+#if CPU_DISPATCH_X86
+        /*
+         * The SIMD kernels read scores and classes in place with unaligned loads.
+         * The last partial chunk is handled by loading the final chunk_size bytes
+         * again and masking the lanes, which have been counted already. Only lists
+         * shorter than one chunk are copied to the stack, AVX-512 uses masked
+         * loads instead.
+         *
+         * Up to maxCompareClasses, the class masks of a chunk are computed once and
+         * combined with the score mask of each threshold. Beyond, the detections
+         * above the lowest threshold are visited one by one.
+         */
+
+        TARGET_SSE42 static void countSse42(const char* scores, const char* classes, uint32_t num_detections,
+                const int* thresholds, uint32_t num_thresholds, const int* class_ids, uint32_t num_classes,
+                uint32_t* counts)
+        {
+            std::fill(counts, counts + num_classes * num_thresholds, 0);
+            if (num_detections == 0)
+            {
+                return;
+            }
+            const uint32_t chunk_size = 16;
+            alignas(16) char scores_tail[chunk_size] = {0};
+            alignas(16) char classes_tail[chunk_size] = {0};
+            if (num_detections < chunk_size)
+            {
+                memcpy(scores_tail, scores, num_detections);
+                memcpy(classes_tail, classes, num_detections);
+                scores = scores_tail;
+                classes = classes_tail;
+            }
+            const bool compare = num_classes <= maxCompareClasses;
+            int16_t lut[256];
+            __m128i ref_class_vec[maxCompareClasses];
+            if (compare)
+            {
+                for (uint32_t m = 0; m < num_classes; m++)
+                {
+                    ref_class_vec[m] = _mm_set1_epi8(static_cast<char>(class_ids[m]));
+                }
+            }
+            else
+            {
+                buildClassLut(class_ids, num_classes, lut);
+            }
+            for (uint32_t off = 0; off < num_detections && num_thresholds > 0; off += chunk_size) /* for each chunk */
+            {
+                uint32_t lanes = 0xffff;
+                uint32_t first = off;
+                if (num_detections < chunk_size)
+                {
+                    lanes = (1u << num_detections) - 1;
+                }
+                else if (num_detections - off < chunk_size)
+                {
+                    /* the last lanes of the final chunk have not been counted yet */
+                    first = num_detections - chunk_size;
+                    lanes = (0xffff << (off - first)) & 0xffff;
+                }
+                __m128i classes8 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(classes + first));
+                __m128i scores8  = _mm_loadu_si128(reinterpret_cast<const __m128i*>(scores + first));
+                if (compare)
+                {
+                    uint32_t class_mask[maxCompareClasses];
+                    for (uint32_t m = 0; m < num_classes; m++)
+                    {
+                        class_mask[m] = _mm_movemask_epi8(_mm_cmpeq_epi8(ref_class_vec[m], classes8));
+                    }
+                    for (uint32_t l = 0; l < num_thresholds; l++)
+                    {
+                        /* we check if score is above detection threshold */
+                        __m128i threshold_vec = _mm_set1_epi8(static_cast<char>(thresholds[l]));
+                        uint32_t valid = _mm_movemask_epi8(_mm_cmpgt_epi8(scores8, threshold_vec)) & lanes;
+                        if (valid == 0)
+                        {
+                            /* no score is above any of the higher thresholds either */
+                            break;
+                        }
+                        for (uint32_t m = 0; m < num_classes; m++)
+                        {
+                            counts[m * num_thresholds + l] += __builtin_popcount(class_mask[m] & valid);
+                        }
+                    }
+                    continue;
+                }
+                __m128i threshold_vec = _mm_set1_epi8(static_cast<char>(thresholds[0]));
+                uint32_t valid = _mm_movemask_epi8(_mm_cmpgt_epi8(scores8, threshold_vec)) & lanes;
+                for (; valid != 0; valid &= valid - 1)
+                {
+                    uint32_t n = first + __builtin_ctz(valid);
+                    countDetection(scores[n], lut[uint8_t(classes[n])], thresholds, num_thresholds, counts);
+                }
+            }
+            if (!compare)
+            {
+                copyDuplicateClasses(class_ids, num_classes, lut, num_thresholds, counts);
+            }
+        }
+
+        TARGET_AVX2 static void countAvx2(const char* scores, const char* classes, uint32_t num_detections,
+                const int* thresholds, uint32_t num_thresholds, const int* class_ids, uint32_t num_classes,
+                uint32_t* counts)
+        {
+            std::fill(counts, counts + num_classes * num_thresholds, 0);
+            if (num_detections == 0)
+            {
+                return;
+            }
+            /* we process 32 int8-integers at a time */
+            const uint32_t chunk_size = 32;
+            alignas(32) char scores_tail[chunk_size] = {0};
+            alignas(32) char classes_tail[chunk_size] = {0};
+            if (num_detections < chunk_size)
+            {
+                memcpy(scores_tail, scores, num_detections);
+                memcpy(classes_tail, classes, num_detections);
+                scores = scores_tail;
+                classes = classes_tail;
+            }
+            const bool compare = num_classes <= maxCompareClasses;
+            int16_t lut[256];
+            __m256i ref_class_vec[maxCompareClasses];
+            if (compare)
+            {
+                /* create vectors with a reference class in each entry */
+                for (uint32_t m = 0; m < num_classes; m++)
+                {
+                    ref_class_vec[m] = _mm256_set1_epi8(static_cast<char>(class_ids[m]));
+                }
+            }
+            else
+            {
+                buildClassLut(class_ids, num_classes, lut);
+            }
+            for (uint32_t off = 0; off < num_detections && num_thresholds > 0; off += chunk_size) /* for each chunk */
+            {
+                uint32_t lanes = ~0u;
+                uint32_t first = off;
+                if (num_detections < chunk_size)
+                {
+                    lanes = (1u << num_detections) - 1;
+                }
+                else if (num_detections - off < chunk_size)
+                {
+                    /* the last lanes of the final chunk have not been counted yet */
+                    first = num_detections - chunk_size;
+                    lanes = ~0u << (off - first);
+                }
+                __m256i classes8 = _mm256_loadu_si256(reinterpret_cast<const __m256i_u*>(classes + first));
+                __m256i scores8  = _mm256_loadu_si256(reinterpret_cast<const __m256i_u*>(scores + first));
+                if (compare)
+                {
+                    uint32_t class_mask[maxCompareClasses];
+                    for (uint32_t m = 0; m < num_classes; m++)
+                    {
+                        class_mask[m] = _mm256_movemask_epi8(_mm256_cmpeq_epi8(ref_class_vec[m], classes8));
+                    }
+                    for (uint32_t l = 0; l < num_thresholds; l++)
+                    {
+                        /* we check if score is above detection threshold */
+                        __m256i threshold_vec = _mm256_set1_epi8(static_cast<char>(thresholds[l]));
+                        uint32_t valid = _mm256_movemask_epi8(_mm256_cmpgt_epi8(scores8, threshold_vec)) & lanes;
+                        if (valid == 0)
+                        {
+                            /* no score is above any of the higher thresholds either */
+                            break;
+                        }
+                        /* if class matches, and score is above threshold, the result is valid */
+                        for (uint32_t m = 0; m < num_classes; m++)
+                        {
+                            counts[m * num_thresholds + l] += __builtin_popcount(class_mask[m] & valid);
+                        }
+                    }
+                    continue;
+                }
+                __m256i threshold_vec = _mm256_set1_epi8(static_cast<char>(thresholds[0]));
+                uint32_t valid = _mm256_movemask_epi8(_mm256_cmpgt_epi8(scores8, threshold_vec)) & lanes;
+                /* only detections above the lowest threshold are visited */
+                for (; valid != 0; valid &= valid - 1)
+                {
+                    uint32_t n = first + __builtin_ctz(valid);
+                    countDetection(scores[n], lut[uint8_t(classes[n])], thresholds, num_thresholds, counts);
+                }
+            }
+            if (!compare)
+            {
+                copyDuplicateClasses(class_ids, num_classes, lut, num_thresholds, counts);
+            }
+        }
+
+        TARGET_AVX512 static void countAvx512(const char* scores, const char* classes, uint32_t num_detections,
+                const int* thresholds, uint32_t num_thresholds, const int* class_ids, uint32_t num_classes,
+                uint32_t* counts)
+        {
+            std::fill(counts, counts + num_classes * num_thresholds, 0);
+            if (num_detections == 0)
+            {
+                return;
+            }
+            const uint32_t chunk_size = 64;
+            const bool compare = num_classes <= maxCompareClasses;
+            int16_t lut[256];
+            __m512i ref_class_vec[maxCompareClasses];
+            if (compare)
+            {
+                for (uint32_t m = 0; m < num_classes; m++)
+                {
+                    ref_class_vec[m] = _mm512_set1_epi8(static_cast<char>(class_ids[m]));
+                }
+            }
+            else
+            {
+                buildClassLut(class_ids, num_classes, lut);
+            }
+            for (uint32_t off = 0; off < num_detections && num_thresholds > 0; off += chunk_size) /* for each chunk */
+            {
+                uint32_t num_lanes = std::min(chunk_size, num_detections - off);
+                __mmask64 lanes = (num_lanes == chunk_size) ? ~0ull : (1ull << num_lanes) - 1;
+                /* masked loads never touch the bytes behind the last detection */
+                __m512i classes8 = _mm512_maskz_loadu_epi8(lanes, classes + off);
+                __m512i scores8  = _mm512_maskz_loadu_epi8(lanes, scores + off);
+                if (compare)
+                {
+                    uint64_t class_mask[maxCompareClasses];
+                    for (uint32_t m = 0; m < num_classes; m++)
+                    {
+                        class_mask[m] = _mm512_mask_cmpeq_epi8_mask(lanes, ref_class_vec[m], classes8);
+                    }
+                    for (uint32_t l = 0; l < num_thresholds; l++)
+                    {
+                        __m512i threshold_vec = _mm512_set1_epi8(static_cast<char>(thresholds[l]));
+                        uint64_t valid = _mm512_mask_cmpgt_epi8_mask(lanes, scores8, threshold_vec);
+                        if (valid == 0)
+                        {
+                            /* no score is above any of the higher thresholds either */
+                            break;
+                        }
+                        for (uint32_t m = 0; m < num_classes; m++)
+                        {
+                            counts[m * num_thresholds + l] += __builtin_popcountll(class_mask[m] & valid);
+                        }
+                    }
+                    continue;
+                }
+                __m512i threshold_vec = _mm512_set1_epi8(static_cast<char>(thresholds[0]));
+                uint64_t valid = _mm512_mask_cmpgt_epi8_mask(lanes, scores8, threshold_vec);
+                for (; valid != 0; valid &= valid - 1)
+                {
+                    uint32_t n = off + __builtin_ctzll(valid);
+                    countDetection(scores[n], lut[uint8_t(classes[n])], thresholds, num_thresholds, counts);
+                }
+            }
+            if (!compare)
+            {
+                copyDuplicateClasses(class_ids, num_classes, lut, num_thresholds, counts);
+            }
+        }
+
+        /*
+         * Kernels specialized for a configuration: the class and threshold vectors
+         * are constants and the loops over classes and thresholds are unrolled.
+         * Chunks and tails are handled as by the generic kernels.
+         */
+
+        template<typename TConfig>
+        TARGET_SSE42 static void countFixedSse42(const char* scores, const char* classes, uint32_t num_detections,
+                const int*, uint32_t, const int*, uint32_t, uint32_t* counts)
+        {
+            constexpr uint32_t num_classes = TConfig::numClasses;
+            constexpr uint32_t num_thresholds = TConfig::numThresholds;
+            constexpr auto& class_ids = TConfig::Classes::ids;
+            constexpr auto& thresholds = TConfig::Thresholds::values;
+            std::fill(counts, counts + num_classes * num_thresholds, 0);
+            if (num_detections == 0)
+            {
+                return;
+            }
+            const uint32_t chunk_size = 16;
+            alignas(16) char scores_tail[chunk_size] = {0};
+            alignas(16) char classes_tail[chunk_size] = {0};
+            if (num_detections < chunk_size)
+            {
+                memcpy(scores_tail, scores, num_detections);
+                memcpy(classes_tail, classes, num_detections);
+                scores = scores_tail;
+                classes = classes_tail;
+            }
+            for (uint32_t off = 0; off < num_detections; off += chunk_size) /* for each chunk */
+            {
+                uint32_t lanes = 0xffff;
+                uint32_t first = off;
+                if (num_detections < chunk_size)
+                {
+                    lanes = (1u << num_detections) - 1;
+                }
+                else if (num_detections - off < chunk_size)
+                {
+                    first = num_detections - chunk_size;
+                    lanes = (0xffff << (off - first)) & 0xffff;
+                }
+                __m128i classes8 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(classes + first));
+                __m128i scores8  = _mm_loadu_si128(reinterpret_cast<const __m128i*>(scores + first));
+                uint32_t class_mask[num_classes];
+#pragma GCC unroll 16
+                for (uint32_t m = 0; m < num_classes; m++)
+                {
+                    class_mask[m] = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(static_cast<char>(class_ids[m])), classes8));
+                }
+#pragma GCC unroll 128
+                for (uint32_t l = 0; l < num_thresholds; l++)
+                {
+                    uint32_t valid = _mm_movemask_epi8(_mm_cmpgt_epi8(scores8, _mm_set1_epi8(static_cast<char>(thresholds[l])))) & lanes;
+                    if (valid == 0)
+                    {
+                        break;
+                    }
+#pragma GCC unroll 16
+                    for (uint32_t m = 0; m < num_classes; m++)
+                    {
+                        counts[m * num_thresholds + l] += __builtin_popcount(class_mask[m] & valid);
+                    }
+                }
+            }
+        }
+
+        template<typename TConfig>
+        TARGET_AVX2 static void countFixedAvx2(const char* scores, const char* classes, uint32_t num_detections,
+                const int*, uint32_t, const int*, uint32_t, uint32_t* counts)
+        {
+            constexpr uint32_t num_classes = TConfig::numClasses;
+            constexpr uint32_t num_thresholds = TConfig::numThresholds;
+            constexpr auto& class_ids = TConfig::Classes::ids;
+            constexpr auto& thresholds = TConfig::Thresholds::values;
+            std::fill(counts, counts + num_classes * num_thresholds, 0);
+            if (num_detections == 0)
+            {
+                return;
+            }
+            const uint32_t chunk_size = 32;
+            alignas(32) char scores_tail[chunk_size] = {0};
+            alignas(32) char classes_tail[chunk_size] = {0};
+            if (num_detections < chunk_size)
+            {
+                memcpy(scores_tail, scores, num_detections);
+                memcpy(classes_tail, classes, num_detections);
+                scores = scores_tail;
+                classes = classes_tail;
+            }
+            for (uint32_t off = 0; off < num_detections; off += chunk_size) /* for each chunk */
+            {
+                uint32_t lanes = ~0u;
+                uint32_t first = off;
+                if (num_detections < chunk_size)
+                {
+                    lanes = (1u << num_detections) - 1;
+                }
+                else if (num_detections - off < chunk_size)
+                {
+                    first = num_detections - chunk_size;
+                    lanes = ~0u << (off - first);
+                }
+                __m256i classes8 = _mm256_loadu_si256(reinterpret_cast<const __m256i_u*>(classes + first));
+                __m256i scores8  = _mm256_loadu_si256(reinterpret_cast<const __m256i_u*>(scores + first));
+                uint32_t class_mask[num_classes];
+#pragma GCC unroll 16
+                for (uint32_t m = 0; m < num_classes; m++)
+                {
+                    class_mask[m] = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_set1_epi8(static_cast<char>(class_ids[m])), classes8));
+                }
+#pragma GCC unroll 128
+                for (uint32_t l = 0; l < num_thresholds; l++)
+                {
+                    uint32_t valid = _mm256_movemask_epi8(_mm256_cmpgt_epi8(scores8, _mm256_set1_epi8(static_cast<char>(thresholds[l])))) & lanes;
+                    if (valid == 0)
+                    {
+                        /* no score is above any of the higher thresholds either */
+                        break;
+                    }
+#pragma GCC unroll 16
+                    for (uint32_t m = 0; m < num_classes; m++)
+                    {
+                        counts[m * num_thresholds + l] += __builtin_popcount(class_mask[m] & valid);
+                    }
+                }
+            }
+        }
+
+        template<typename TConfig>
+        TARGET_AVX512 static void countFixedAvx512(const char* scores, const char* classes, uint32_t num_detections,
+                const int*, uint32_t, const int*, uint32_t, uint32_t* counts)
+        {
+            constexpr uint32_t num_classes = TConfig::numClasses;
+            constexpr uint32_t num_thresholds = TConfig::numThresholds;
+            constexpr auto& class_ids = TConfig::Classes::ids;
+            constexpr auto& thresholds = TConfig::Thresholds::values;
+            std::fill(counts, counts + num_classes * num_thresholds, 0);
+            if (num_detections == 0)
+            {
+                return;
+            }
+            const uint32_t chunk_size = 64;
+            for (uint32_t off = 0; off < num_detections; off += chunk_size) /* for each chunk */
+            {
+                uint32_t num_lanes = std::min(chunk_size, num_detections - off);
+                __mmask64 lanes = (num_lanes == chunk_size) ? ~0ull : (1ull << num_lanes) - 1;
+                __m512i classes8 = _mm512_maskz_loadu_epi8(lanes, classes + off);
+                __m512i scores8  = _mm512_maskz_loadu_epi8(lanes, scores + off);
+                uint64_t class_mask[num_classes];
+#pragma GCC unroll 16
+                for (uint32_t m = 0; m < num_classes; m++)
+                {
+                    class_mask[m] = _mm512_mask_cmpeq_epi8_mask(lanes, _mm512_set1_epi8(static_cast<char>(class_ids[m])), classes8);
+                }
+#pragma GCC unroll 128
+                for (uint32_t l = 0; l < num_thresholds; l++)
+                {
+                    uint64_t valid = _mm512_mask_cmpgt_epi8_mask(lanes, scores8, _mm512_set1_epi8(static_cast<char>(thresholds[l])));
+                    if (valid == 0)
+                    {
+                        break;
+                    }
+#pragma GCC unroll 16
+                    for (uint32_t m = 0; m < num_classes; m++)
+                    {
+                        counts[m * num_thresholds + l] += __builtin_popcountll(class_mask[m] & valid);
+                    }
+                }
+            }
+        }
+#endif
 };
 
 #endif /* EVAL_FAST_RCNN_RESTNET101_H_ */
@@ -0,0 +1,355 @@
+/**
+ * Evaluation of the detections against ground truth.
+ *
+ * The ground truth is a GroundTruth message with the objects of a subset of
+ * the images, keyed by the filename of the example. Detections of an image
+ * are matched greedily per class: in the order of descending score, each
+ * detection takes the unmatched object of its class with the highest IoU. A
+ * detection is a true positive, if that IoU reaches minIou, else a false
+ * positive.
+ *
+ * Since detections above a threshold are a prefix of that order, the matching
+ * does not depend on the threshold. True and false positives are therefore
+ * counted per score, the precision/recall curve for all thresholds follows
+ * from a single pass over the records.
+ */
+
+#ifndef EVAL_GROUND_TRUTH_H_
+#define EVAL_GROUND_TRUTH_H_
+
+#include <cstdint>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <numeric>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+#include <filesystem>
+
+#include "detection_results_v2.pb.h"
+#include "ground_truth.pb.h"
+#include "example_view.h"
+
+using namespace std;
+namespace fs = std::filesystem;
+
+struct EvalGroundTruth
+{
+    typedef object_detection::Example UParser;
+    typedef ExampleView UScanView;
+    typedef ground_truth::GroundTruth UGroundTruth;
+    /* fields decoded while evaluating */
+    static constexpr uint32_t scanFields = ExampleView::FILENAME | ExampleView::NUM_DETECTIONS |
+                                           ExampleView::SCORES | ExampleView::CLASSES | ExampleView::BOXES;
+    /* detections overlapping an object at least this much are true positives */
+    static constexpr float minIou = 0.5f;
+    /* scores are [0..maxScore], a detection counts for each threshold below its score */
+    static constexpr int maxScore = 100;
+    static constexpr int numScores = maxScore + 1;
+
+    /**
+     * \brief Ground truth, that can be looked up by filename without copying it
+     */
+    class Index
+    {
+        public:
+            /**
+             * \brief Parse a ground truth file
+             */
+            bool load(const fs::path& fname)
+            {
+                m_frames.clear();
+                ifstream file(fname, ios::binary | ios::in);
+                if ( !file || !m_groundTruth.ParseFromIstream(&file) )
+                {
+                    std::cerr << "Failed to parse ground truth " << fname << std::endl;
+                    return false;
+                }
+                for (auto& [filename, frame] : m_groundTruth.frames())
+                {
+                    m_frames.emplace(std::string_view(filename), &frame);
+                }
+                return true;
+            }
+
+            /**
+             * \return Ground truth of an image, nullptr if there is none
+             */
+            const UGroundTruth::Frame* find(std::string_view filename) const
+            {
+                auto it = m_frames.find(filename);
+                return (it != m_frames.end()) ? it->second : nullptr;
+            }
+
+            size_t size() const
+            {
+                return m_frames.size();
+            }
+
+        private:
+            UGroundTruth m_groundTruth;
+            /* keys are views of the filenames in m_groundTruth */
+            std::unordered_map<std::string_view, const UGroundTruth::Frame*> m_frames;
+    };
+
+    /**
+     * \brief True and false positives per class and score, numbers of objects per class
+     *
+     * \details
+     *      Filled independently per range of images and merged afterwards.
+     */
+    struct Counts
+    {
+        std::vector<uint64_t> truePositives;  // [class][score]
+        std::vector<uint64_t> falsePositives; // [class][score]
+        std::vector<uint64_t> numObjects;     // [class]
+        uint64_t numImages = 0;
+
+        explicit Counts(size_t numClasses = 0)
+            : truePositives(numClasses * numScores), falsePositives(numClasses * numScores),
+              numObjects(numClasses)
+        {
+        }
+
+        Counts& operator+=(const Counts& other)
+        {
+            std::transform(truePositives.begin(), truePositives.end(), other.truePositives.begin(),
+                           truePositives.begin(), std::plus<uint64_t>());
+            std::transform(falsePositives.begin(), falsePositives.end(), other.falsePositives.begin(),
+                           falsePositives.begin(), std::plus<uint64_t>());
+            std::transform(numObjects.begin(), numObjects.end(), other.numObjects.begin(),
+                           numObjects.begin(), std::plus<uint64_t>());
+            numImages += other.numImages;
+            return *this;
+        }
+    };
+
+    /**
+     * \brief Precision and recall of a class for each threshold
+     */
+    struct PrCurve
+    {
+        int classId = 0;
+        uint64_t numObjects = 0;
+        /* index is the threshold, a detection counts if its score is above */
+        std::vector<double> precision;
+        std::vector<double> recall;
+        /* area under the interpolated precision/recall curve */
+        double averagePrecision = 0.0;
+    };
+
+    struct Result
+    {
+        std::vector<PrCurve> curves;
+        /* mean of the average precision of all classes with objects */
+        double meanAveragePrecision = 0.0;
+        uint64_t numImages = 0;
+
+        /**
+         * \brief Write the curves as CSV: class, threshold, precision, recall, average precision
+         */
+        bool save(const fs::path& fname) const
+        {
+            ofstream output(fname, ios::out | ios::trunc);
+            output << "class,threshold,precision,recall,ap" << std::endl;
+            for (auto& curve : curves)
+            {
+                for (int t = 0; t < numScores; t++)
+                {
+                    output << curve.classId << ',' << t << ',' << curve.precision[t] << ','
+                           << curve.recall[t] << ',' << curve.averagePrecision << '\n';
+                }
+            }
+            return bool(output);
+        }
+    };
+
+    /**
+     * \brief Match the detections of an image against its ground truth
+     *
+     * \param example UParser or UScanView
+     * \param class_ids Classes evaluated, column m of counts refers to class_ids[m]
+     */
+    template<typename TExample>
+    static void matchDetections(const TExample& example, const UGroundTruth::Frame& frame,
+            const std::vector<int>& class_ids, Counts& counts)
+    {
+        std::vector<Box> detections;
+        gatherDetections(example, detections);
+        std::vector<Box> objects;
+        std::vector<bool> taken;
+        for (uint32_t m = 0; m < class_ids.size(); m++)
+        {
+            objects.clear();
+            for (auto& object : frame.objects())
+            {
+                if (int(object.class_id()) == class_ids[m])
+                {
+                    objects.push_back({object.xmin(), object.xmax(), object.ymin(), object.ymax(), class_ids[m], 0});
+                }
+            }
+            counts.numObjects[m] += objects.size();
+            taken.assign(objects.size(), false);
+            uint64_t* truePositives = counts.truePositives.data() + m * numScores;
+            uint64_t* falsePositives = counts.falsePositives.data() + m * numScores;
+            for (auto& detection : detections) /* by descending score */
+            {
+                if (detection.classId != class_ids[m])
+                {
+                    continue;
+                }
+                int best = -1;
+                float bestIou = minIou;
+                for (uint32_t k = 0; k < objects.size(); k++)
+                {
+                    float val = iou(detection, objects[k]);
+                    if (!taken[k] && val >= bestIou)
+                    {
+                        best = k;
+                        bestIou = val;
+                    }
+                }
+                if (best >= 0)
+                {
+                    taken[best] = true;
+                    truePositives[detection.score]++;
+                }
+                else
+                {
+                    falsePositives[detection.score]++;
+                }
+            }
+        }
+        counts.numImages++;
+    }
+
+    /**
+     * \brief Precision/recall curves and average precision of each class
+     */
+    static Result summarize(const Counts& counts, const std::vector<int>& class_ids)
+    {
+        Result result;
+        result.numImages = counts.numImages;
+        uint32_t numClassesWithObjects = 0;
+        for (uint32_t m = 0; m < class_ids.size(); m++)
+        {
+            PrCurve curve;
+            curve.classId = class_ids[m];
+            curve.numObjects = counts.numObjects[m];
+            curve.precision.resize(numScores);
+            curve.recall.resize(numScores);
+            const uint64_t* truePositives = counts.truePositives.data() + m * numScores;
+            const uint64_t* falsePositives = counts.falsePositives.data() + m * numScores;
+            /* detections with a score above t, from the highest threshold down */
+            uint64_t tp = 0;
+            uint64_t fp = 0;
+            for (int t = maxScore; t >= 0; t--)
+            {
+                if (t < maxScore)
+                {
+                    tp += truePositives[t + 1];
+                    fp += falsePositives[t + 1];
+                }
+                curve.precision[t] = (tp + fp > 0) ? double(tp) / (tp + fp) : 1.0;
+                curve.recall[t] = (curve.numObjects > 0) ? double(tp) / curve.numObjects : 0.0;
+            }
+            curve.averagePrecision = averagePrecision(curve);
+            if (curve.numObjects > 0)
+            {
+                result.meanAveragePrecision += curve.averagePrecision;
+                numClassesWithObjects++;
+            }
+            result.curves.push_back(std::move(curve));
+        }
+        if (numClassesWithObjects > 0)
+        {
+            result.meanAveragePrecision /= numClassesWithObjects;
+        }
+        return result;
+    }
+
+    private:
+        struct Box
+        {
+            float xmin, xmax, ymin, ymax;
+            int classId;
+            int score;
+        };
+
+        static float iou(const Box& a, const Box& b)
+        {
+            float width = std::max(0.0f, std::min(a.xmax, b.xmax) - std::max(a.xmin, b.xmin));
+            float height = std::max(0.0f, std::min(a.ymax, b.ymax) - std::max(a.ymin, b.ymin));
+            float inter = width * height;
+            float areaA = std::max(0.0f, a.xmax - a.xmin) * std::max(0.0f, a.ymax - a.ymin);
+            float areaB = std::max(0.0f, b.xmax - b.xmin) * std::max(0.0f, b.ymax - b.ymin);
+            float uni = areaA + areaB - inter;
+            return (uni > 0.0f) ? inter / uni : 0.0f;
+        }
+
+        /**
+         * \brief Detections of an image with their boxes, ordered by descending score
+         */
+        template<typename TExample>
+        static void gatherDetections(const TExample& example, std::vector<Box>& detections)
+        {
+            uint32_t num_detections = std::min<size_t>({example.num_detections(),
+                    example.scores().size(), example.classes().size()});
+            const char* scores = example.scores().data();
+            const char* classes = example.classes().data();
+            auto add = [&](uint32_t n, float x0, float x1, float y0, float y1) {
+                int score = std::clamp<int>(int8_t(scores[n]), 0, maxScore);
+                detections.push_back({x0, x1, y0, y1, uint8_t(classes[n]), score});
+            };
+            if constexpr (std::is_same_v<TExample, ExampleView>)
+            {
+                ExampleView::BoxReader reader = example.boxes();
+                float x0, x1, y0, y1;
+                for (uint32_t n = 0; n < num_detections && reader.next(); n++)
+                {
+                    if ( reader.decode(x0, x1, y0, y1) )
+                    {
+                        add(n, x0, x1, y0, y1);
+                    }
+                }
+            }
+            else
+            {
+                num_detections = std::min<uint32_t>(num_detections, example.boxes_size());
+                for (uint32_t n = 0; n < num_detections; n++)
+                {
+                    auto& box = example.boxes(n);
+                    add(n, box.xmin(), box.xmax(), box.ymin(), box.ymax());
+                }
+            }
+            std::stable_sort(detections.begin(), detections.end(),
+                             [](const Box& a, const Box& b) { return a.score > b.score; });
+        }
+
+        /**
+         * \brief All-point interpolated average precision (VOC 2010 and later)
+         */
+        static double averagePrecision(const PrCurve& curve)
+        {
+            if (curve.numObjects == 0)
+            {
+                return 0.0;
+            }
+            /* the recall grows towards lower thresholds, the precision is interpolated
+               by the highest precision at any lower threshold */
+            double ap = 0.0;
+            double prevRecall = 0.0;
+            for (int t = maxScore; t >= 0; t--)
+            {
+                double interpolated = *std::max_element(curve.precision.begin(), curve.precision.begin() + t + 1);
+                ap += (curve.recall[t] - prevRecall) * interpolated;
+                prevRecall = curve.recall[t];
+            }
+            return ap;
+        }
+};
+
+#endif /* EVAL_GROUND_TRUTH_H_ */
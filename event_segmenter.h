@@ -0,0 +1,304 @@
+/**
+ * Segmentation of a count column into events.
+ *
+ * An event starts at the first image with at least enter detections and lasts
+ * while the count stays at or above exit (exit <= enter). The gap between the
+ * two thresholds suppresses events caused by a count flickering around a
+ * single threshold. Events separated by at most maxGap images are merged and
+ * merged events shorter than minLength images are dropped.
+ *
+ * The counts are compared with both thresholds in vectors, yielding one bit
+ * per image. The state machine then only visits the images where an event
+ * starts or ends, by scanning the bit masks 64 images at a time.
+ */
+
+#ifndef EVENT_SEGMENTER_H_
+#define EVENT_SEGMENTER_H_
+
+#include <cstdint>
+#include <algorithm>
+#include <vector>
+
+#include "algo.h"
+
+using namespace std;
+
+/**
+ * \brief Images [first, last) of an event
+ */
+struct Segment
+{
+    uint32_t first = 0;
+    uint32_t last = 0;
+
+    uint32_t length() const
+    {
+        return last - first;
+    }
+
+    bool operator==(const Segment& other) const
+    {
+        return first == other.first && last == other.last;
+    }
+};
+
+struct SegmentParams
+{
+    /* number of detections, that starts an event */
+    int16_t enter = 1;
+    /* number of detections, below which an event ends, clamped to enter */
+    int16_t exit = 1;
+    /* events shorter than this are dropped after merging */
+    uint32_t minLength = 1;
+    /* events separated by at most this many images are merged */
+    uint32_t maxGap = 0;
+};
+
+/**
+ * \brief Incremental segmentation of a count column into events
+ *
+ * \details
+ *      The column is passed in consecutive pieces, either as a whole or as new
+ *      images arrive. An event is final, once no later image can extend it.
+ */
+class EventSegmenter
+{
+    public:
+        explicit EventSegmenter(const SegmentParams& params = SegmentParams())
+            : m_params(params)
+        {
+            m_params.exit = std::min(m_params.exit, m_params.enter);
+        }
+
+        const SegmentParams& params() const
+        {
+            return m_params;
+        }
+
+        /**
+         * \brief Forget all images and events
+         */
+        void reset()
+        {
+            m_segments.clear();
+            m_numFrames = 0;
+            m_state = State::Idle;
+        }
+
+        /**
+         * \brief Number of images passed so far
+         */
+        uint32_t numFrames() const
+        {
+            return m_numFrames;
+        }
+
+        /**
+         * \brief Final events, ordered by time
+         */
+        const std::vector<Segment>& segments() const
+        {
+            return m_segments;
+        }
+
+        /**
+         * \brief Event, that may still be extended by later images, as if the column ended now
+         *
+         * \return false, if there is none or it is shorter than minLength
+         */
+        bool pending(Segment& segment) const
+        {
+            if (m_state == State::Idle)
+            {
+                return false;
+            }
+            segment.first = m_start;
+            segment.last = (m_state == State::Open) ? m_numFrames : m_end;
+            return segment.length() >= m_params.minLength;
+        }
+
+        /**
+         * \brief Final and pending events
+         */
+        std::vector<Segment> allSegments() const
+        {
+            std::vector<Segment> segments = m_segments;
+            Segment segment;
+            if ( pending(segment) )
+            {
+                segments.push_back(segment);
+            }
+            return segments;
+        }
+
+        /**
+         * \brief First or last image of an event, whichever comes first behind idx
+         *
+         * \details
+         *      Events are ordered and disjoint, so the event is found by binary search.
+         *
+         * \return false, if there is none
+         */
+        bool nextBoundary(uint32_t idx, uint32_t& boundary) const
+        {
+            auto it = std::partition_point(m_segments.begin(), m_segments.end(),
+                                           [idx](const Segment& s) { return s.last - 1 <= idx; });
+            Segment segment;
+            if (it != m_segments.end())
+            {
+                segment = *it;
+            }
+            else if ( !pending(segment) || segment.last - 1 <= idx )
+            {
+                return false;
+            }
+            boundary = (segment.first > idx) ? segment.first : segment.last - 1;
+            return true;
+        }
+
+        /**
+         * \brief First or last image of an event, whichever comes last in front of idx
+         *
+         * \return false, if there is none
+         */
+        bool prevBoundary(uint32_t idx, uint32_t& boundary) const
+        {
+            Segment segment;
+            if ( !pending(segment) || segment.first >= idx )
+            {
+                auto it = std::partition_point(m_segments.begin(), m_segments.end(),
+                                               [idx](const Segment& s) { return s.first < idx; });
+                if (it == m_segments.begin())
+                {
+                    return false;
+                }
+                segment = *(it - 1);
+            }
+            boundary = (segment.last - 1 < idx) ? segment.last - 1 : segment.first;
+            return true;
+        }
+
+        /**
+         * \brief Segment the counts of the next n images
+         */
+        void append(const int16_t* counts, uint32_t n)
+        {
+            for (uint32_t from = 0; from < n; from += blockSize)
+            {
+                uint32_t num = std::min(blockSize, n - from);
+                Algo::thresholdMask(counts + from, num, m_params.enter, m_enterBits);
+                Algo::thresholdMask(counts + from, num, m_params.exit, m_stayBits);
+                scanBlock(num);
+            }
+        }
+
+        /**
+         * \brief Events of a whole column
+         */
+        static std::vector<Segment> segment(const int16_t* counts, uint32_t n, const SegmentParams& params)
+        {
+            EventSegmenter segmenter(params);
+            segmenter.append(counts, n);
+            return segmenter.allSegments();
+        }
+
+    private:
+        enum class State
+        {
+            /* no event since the last final one */
+            Idle,
+            /* an event started at m_start and lasts up to the last image */
+            Open,
+            /* an event lasted [m_start, m_end), a following one may be merged */
+            Closed
+        };
+
+        /* images segmented per call of the mask kernels */
+        static constexpr uint32_t blockSize = 4096;
+
+        /**
+         * \brief First image k in [from, n) of the current block, whose bit equals value, n if there is none
+         */
+        static uint32_t findBit(const uint64_t* bits, uint32_t from, uint32_t n, bool value)
+        {
+            uint64_t invert = value ? 0 : ~0ull;
+            for (uint32_t w = from / 64; w * 64 < n; w++)
+            {
+                uint64_t word = bits[w] ^ invert;
+                if (w == from / 64)
+                {
+                    word &= ~0ull << (from % 64);
+                }
+                if (word != 0)
+                {
+                    return std::min(n, w * 64 + __builtin_ctzll(word));
+                }
+            }
+            return n;
+        }
+
+        void emit(uint32_t first, uint32_t last)
+        {
+            if (last - first >= m_params.minLength)
+            {
+                m_segments.push_back({first, last});
+            }
+        }
+
+        /**
+         * \brief Advance the state machine over the n images of the current block
+         */
+        void scanBlock(uint32_t n)
+        {
+            const uint32_t base = m_numFrames;
+            uint32_t k = 0;
+            while (k < n)
+            {
+                if (m_state == State::Open)
+                {
+                    k = findBit(m_stayBits, k, n, false);
+                    if (k < n)
+                    {
+                        m_end = base + k;
+                        m_state = State::Closed;
+                    }
+                }
+                else
+                {
+                    k = findBit(m_enterBits, k, n, true);
+                    if (k < n)
+                    {
+                        if (m_state == State::Closed && base + k - m_end > m_params.maxGap)
+                        {
+                            emit(m_start, m_end);
+                            m_state = State::Idle;
+                        }
+                        if (m_state == State::Idle)
+                        {
+                            m_start = base + k;
+                        }
+                        /* else merge with the closed event */
+                        m_state = State::Open;
+                    }
+                }
+            }
+            m_numFrames = base + n;
+            /* no later event can be merged anymore */
+            if (m_state == State::Closed && m_numFrames - m_end > m_params.maxGap)
+            {
+                emit(m_start, m_end);
+                m_state = State::Idle;
+            }
+        }
+
+        SegmentParams m_params;
+        std::vector<Segment> m_segments;
+        uint32_t m_numFrames = 0;
+        State m_state = State::Idle;
+        uint32_t m_start = 0;
+        uint32_t m_end = 0;
+        uint64_t m_enterBits[blockSize / 64];
+        uint64_t m_stayBits[blockSize / 64];
+};
+
+#endif /* EVENT_SEGMENTER_H_ */
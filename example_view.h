@@ -0,0 +1,316 @@
+/**
+ * Field-selective decoder for serialized object_detection::Example messages.
+ *
+ * Walks the protobuf wire format of detection_results_v2.proto and only
+ * decodes the fields requested by the caller. Strings and bytes are returned
+ * as views into the serialized buffer, nothing is copied or allocated. The
+ * accessors are named like those of object_detection::Example, so that
+ * evaluators can be written for both.
+ */
+
+#ifndef EXAMPLE_VIEW_H_
+#define EXAMPLE_VIEW_H_
+
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+class ExampleView
+{
+    public:
+        /* fields of object_detection::Example, to be combined as bitmask */
+        enum Field : uint32_t
+        {
+            FILENAME       = 1u << 1,
+            TIMESTAMP      = 1u << 2,
+            NUM_DETECTIONS = 1u << 3,
+            SCORES         = 1u << 4,
+            CLASSES        = 1u << 5,
+            BOXES          = 1u << 6,
+            ALL            = FILENAME | TIMESTAMP | NUM_DETECTIONS | SCORES | CLASSES | BOXES
+        };
+
+        /**
+         * \brief Sequential decoder of the repeated boxes field
+         *
+         * \details
+         *      Only the boxes, that are actually decoded, cost more than skipping
+         *      their length prefix.
+         */
+        class BoxReader
+        {
+            public:
+                explicit BoxReader(std::string_view data)
+                    : m_p(reinterpret_cast<const uint8_t*>(data.data())), m_end(m_p + data.size())
+                {
+                }
+
+                /**
+                 * \brief Advance to the next box
+                 *
+                 * \return false behind the last box or if the message is invalid
+                 */
+                bool next()
+                {
+                    /* fast path: tag and length of a box with all coordinates, as written by protobuf */
+                    if (m_end - m_p >= 22 && m_p[0] == (BOXES_FIELD << 3 | WIRETYPE_LENGTH_DELIMITED) && m_p[1] == 20)
+                    {
+                        m_box = m_p + 2;
+                        m_boxEnd = m_box + 20;
+                        m_p = m_boxEnd;
+                        return true;
+                    }
+                    while (m_p < m_end)
+                    {
+                        uint64_t tag;
+                        if (!readVarint(m_p, m_end, tag))
+                        {
+                            return false;
+                        }
+                        if (tag == (BOXES_FIELD << 3 | WIRETYPE_LENGTH_DELIMITED))
+                        {
+                            uint64_t len;
+                            if (!readVarint(m_p, m_end, len) || len > uint64_t(m_end - m_p))
+                            {
+                                return false;
+                            }
+                            m_box = m_p;
+                            m_boxEnd = m_p + len;
+                            m_p += len;
+                            return true;
+                        }
+                        if (!skipField(m_p, m_end, tag & 0x7))
+                        {
+                            return false;
+                        }
+                    }
+                    return false;
+                }
+
+                /**
+                 * \brief Decode the current box, missing coordinates are 0
+                 */
+                bool decode(float& xmin, float& xmax, float& ymin, float& ymax) const
+                {
+                    /* fixed32 is little-endian on the wire, like the host */
+                    const uint8_t* p = m_box;
+                    if (m_boxEnd - p == 20 && p[0] == 0x0d && p[5] == 0x15 && p[10] == 0x1d && p[15] == 0x25)
+                    {
+                        /* all coordinates in field order, as written by protobuf */
+                        memcpy(&xmin, p + 1, sizeof(float));
+                        memcpy(&xmax, p + 6, sizeof(float));
+                        memcpy(&ymin, p + 11, sizeof(float));
+                        memcpy(&ymax, p + 16, sizeof(float));
+                        return true;
+                    }
+                    return decodeFields(xmin, xmax, ymin, ymax);
+                }
+
+            private:
+                /**
+                 * \brief Decode a box field by field, zero coordinates are omitted by protobuf
+                 */
+                bool decodeFields(float& xmin, float& xmax, float& ymin, float& ymax) const
+                {
+                    float coords[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+                    const uint8_t* p = m_box;
+                    while (p < m_boxEnd)
+                    {
+                        uint64_t tag;
+                        if (!readVarint(p, m_boxEnd, tag))
+                        {
+                            return false;
+                        }
+                        uint64_t field = tag >> 3;
+                        if ((tag & 0x7) == WIRETYPE_FIXED32 && field >= 1 && field <= 4 && m_boxEnd - p >= 4)
+                        {
+                            memcpy(&coords[field - 1], p, sizeof(float));
+                            p += 4;
+                        }
+                        else if (!skipField(p, m_boxEnd, tag & 0x7))
+                        {
+                            return false;
+                        }
+                    }
+                    xmin = coords[0];
+                    xmax = coords[1];
+                    ymin = coords[2];
+                    ymax = coords[3];
+                    return true;
+                }
+
+                const uint8_t* m_p;
+                const uint8_t* m_end;
+                const uint8_t* m_box = nullptr;
+                const uint8_t* m_boxEnd = nullptr;
+        };
+
+        /**
+         * \brief Decode the requested fields of a serialized Example
+         *
+         * \details
+         *      Fields not contained in the bitmask are skipped. The views stay valid
+         *      as long as the serialized buffer does.
+         *
+         * \return false if the buffer is not a valid message
+         */
+        bool parse(const char* data, size_t n, uint32_t fields = ALL)
+        {
+            *this = ExampleView();
+            const uint8_t* p = reinterpret_cast<const uint8_t*>(data);
+            const uint8_t* end = p + n;
+            while (p < end)
+            {
+                const uint8_t* fieldBegin = p;
+                uint64_t tag;
+                if (!readVarint(p, end, tag))
+                {
+                    return false;
+                }
+                uint32_t field = tag >> 3;
+                uint32_t mask = (field < 32) ? (1u << field) : 0;
+                switch (tag & 0x7)
+                {
+                    case WIRETYPE_VARINT:
+                    {
+                        uint64_t val;
+                        if (!readVarint(p, end, val))
+                        {
+                            return false;
+                        }
+                        if (mask & fields & TIMESTAMP)
+                        {
+                            m_timestamp = val;
+                        }
+                        else if (mask & fields & NUM_DETECTIONS)
+                        {
+                            m_numDetections = uint32_t(val);
+                        }
+                        break;
+                    }
+                    case WIRETYPE_LENGTH_DELIMITED:
+                    {
+                        uint64_t len;
+                        if (!readVarint(p, end, len) || len > uint64_t(end - p))
+                        {
+                            return false;
+                        }
+                        std::string_view val(reinterpret_cast<const char*>(p), len);
+                        if (mask & fields & FILENAME)
+                        {
+                            m_filename = val;
+                        }
+                        else if (mask & fields & SCORES)
+                        {
+                            m_scores = val;
+                        }
+                        else if (mask & fields & CLASSES)
+                        {
+                            m_classes = val;
+                        }
+                        else if (mask & fields & BOXES)
+                        {
+                            /* from the first to the end of the last box, decoded by BoxReader */
+                            const char* boxesBegin = m_boxes.empty() ? reinterpret_cast<const char*>(fieldBegin) : m_boxes.data();
+                            m_boxes = std::string_view(boxesBegin, val.data() + val.size() - boxesBegin);
+                        }
+                        p += len;
+                        break;
+                    }
+                    case WIRETYPE_FIXED64:
+                        if (end - p < 8)
+                        {
+                            return false;
+                        }
+                        p += 8;
+                        break;
+                    case WIRETYPE_FIXED32:
+                        if (end - p < 4)
+                        {
+                            return false;
+                        }
+                        p += 4;
+                        break;
+                    default:
+                        /* groups are not used by proto3 */
+                        return false;
+                }
+            }
+            return true;
+        }
+
+        std::string_view filename() const { return m_filename; }
+        uint64_t timestamp() const { return m_timestamp; }
+        uint32_t num_detections() const { return m_numDetections; }
+        std::string_view scores() const { return m_scores; }
+        std::string_view classes() const { return m_classes; }
+        BoxReader boxes() const { return BoxReader(m_boxes); }
+
+    private:
+        enum WireType
+        {
+            WIRETYPE_VARINT = 0,
+            WIRETYPE_FIXED64 = 1,
+            WIRETYPE_LENGTH_DELIMITED = 2,
+            WIRETYPE_FIXED32 = 5
+        };
+        static constexpr uint64_t BOXES_FIELD = 6;
+
+        /**
+         * \brief Skip the value of a field, whose tag has been read already
+         */
+        static bool skipField(const uint8_t*& p, const uint8_t* end, uint64_t wireType)
+        {
+            uint64_t len;
+            switch (wireType)
+            {
+                case WIRETYPE_VARINT:
+                    return readVarint(p, end, len);
+                case WIRETYPE_LENGTH_DELIMITED:
+                    if (!readVarint(p, end, len) || len > uint64_t(end - p))
+                    {
+                        return false;
+                    }
+                    p += len;
+                    return true;
+                case WIRETYPE_FIXED64:
+                    len = 8;
+                    break;
+                case WIRETYPE_FIXED32:
+                    len = 4;
+                    break;
+                default:
+                    return false;
+            }
+            if (uint64_t(end - p) < len)
+            {
+                return false;
+            }
+            p += len;
+            return true;
+        }
+
+        static bool readVarint(const uint8_t*& p, const uint8_t* end, uint64_t& val)
+        {
+            val = 0;
+            for (unsigned shift = 0; shift < 64 && p < end; shift += 7)
+            {
+                uint8_t byte = *p++;
+                val |= uint64_t(byte & 0x7f) << shift;
+                if ((byte & 0x80) == 0)
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        std::string_view m_filename;
+        uint64_t m_timestamp = 0;
+        uint32_t m_numDetections = 0;
+        std::string_view m_scores;
+        std::string_view m_classes;
+        std::string_view m_boxes;
+};
+
+#endif /* EXAMPLE_VIEW_H_ */
@@ -0,0 +1,161 @@
+/**
+ * A multi-resolution summary of an append-only column:
+ *  * a single producer
+ *  * multiple consumers, that never lock
+ *
+ * Level 0 holds the minimum and maximum of each leaf, e.g. a block of a
+ * column, appended by the producer. Each entry of level l + 1 summarizes
+ * fanout entries of level l and is appended as soon as they are complete.
+ * The minimum and maximum of any range of leaves are found by climbing up the
+ * levels: only the entries at both ends of the range, that are not aligned to
+ * the next level, are read on each level. A range of n leaves thus takes
+ * about 2 fanout log(n) / log(fanout) reads instead of n.
+ */
+
+#ifndef MIN_MAX_PYRAMID_H_
+#define MIN_MAX_PYRAMID_H_
+
+#include <cstdint>
+#include <algorithm>
+
+#include "data_vector.h"
+
+using namespace std;
+
+/**
+ * \brief Minimum and maximum of a range of values, empty if min > max
+ */
+struct MinMax
+{
+    int16_t min = INT16_MAX;
+    int16_t max = INT16_MIN;
+
+    bool empty() const
+    {
+        return min > max;
+    }
+
+    void add(int16_t value)
+    {
+        min = std::min(min, value);
+        max = std::max(max, value);
+    }
+
+    void add(const MinMax& other)
+    {
+        min = std::min(min, other.min);
+        max = std::max(max, other.max);
+    }
+
+    bool operator==(const MinMax& other) const
+    {
+        return min == other.min && max == other.max;
+    }
+};
+
+class MinMaxPyramid
+{
+    public:
+        /* entries of a level summarized by an entry of the next level */
+        static constexpr uint32_t fanout = 16;
+        static constexpr uint32_t numLevels = 6;
+
+        /**
+         * \brief Number of published leaves
+         */
+        size_t size() const noexcept
+        {
+            return m_levels[0].size();
+        }
+
+        /**
+         * \brief Bytes taken by the entries of all levels
+         */
+        size_t memoryUsage() const
+        {
+            size_t n = 0;
+            for (const auto& level : m_levels)
+            {
+                n += level.size();
+            }
+            return n * sizeof(MinMax);
+        }
+
+        /**
+         * \brief Append the summary of the next leaf, only called by the producer
+         *
+         * \details
+         *      A completed entry is published before the entry of the next level,
+         *      that covers it.
+         */
+        void push_back(const MinMax& leaf)
+        {
+            MinMax entry = leaf;
+            for (uint32_t l = 0; l < numLevels; l++)
+            {
+                m_levels[l].push_back(entry);
+                if (l + 1 == numLevels)
+                {
+                    break;
+                }
+                m_pending[l].add(entry);
+                if (m_levels[l].size() % fanout != 0)
+                {
+                    break;
+                }
+                entry = m_pending[l];
+                m_pending[l] = MinMax();
+            }
+        }
+
+        /**
+         * \brief Minimum and maximum of the leaves [from, to), to is clamped to the published size
+         */
+        MinMax range(size_t from, size_t to) const
+        {
+            MinMax result;
+            to = std::min(to, size());
+            size_t unit = 1;
+            uint32_t l = 0;
+            /* [from, to) is always covered by the published entries of level l */
+            while (from < to)
+            {
+                if (l + 1 < numLevels)
+                {
+                    size_t next = unit * fanout;
+                    size_t lo = (from + next - 1) / next * next;
+                    size_t hi = std::min(to / next, m_levels[l + 1].size()) * next;
+                    if (lo < hi)
+                    {
+                        addEntries(l, from / unit, lo / unit, result);
+                        addEntries(l, hi / unit, to / unit, result);
+                        from = lo;
+                        to = hi;
+                        unit = next;
+                        l++;
+                        continue;
+                    }
+                }
+                addEntries(l, from / unit, to / unit, result);
+                break;
+            }
+            return result;
+        }
+
+    private:
+        void addEntries(uint32_t l, size_t from, size_t to, MinMax& result) const
+        {
+            m_levels[l].forEachSegment(from, to, [&result](const MinMax* entries, size_t n) {
+                for (size_t k = 0; k < n; k++)
+                {
+                    result.add(entries[k]);
+                }
+            });
+        }
+
+        DataVector<MinMax, 1 << 10> m_levels[numLevels];
+        /* summary of the entries of level l, that are not covered by level l + 1 yet */
+        MinMax m_pending[numLevels];
+};
+
+#endif /* MIN_MAX_PYRAMID_H_ */
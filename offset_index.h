@@ -0,0 +1,252 @@
+/**
+ * Dense index of record offsets within a record file.
+ *
+ * The index is either built while scanning the record file (single producer,
+ * multiple consumers) or memory-mapped from a sidecar file, that has been
+ * written by a previous scan. The sidecar is only accepted if size and
+ * modification time of the record file did not change in the meantime.
+ * Records appended to the file later on are added behind the mapped part.
+ * They are stored in a DataVector, so lookups never lock.
+ *
+ * Sidecar layout: Header, followed by uint64_t offsets[numRecords]
+ */
+
+#ifndef OFFSET_INDEX_H_
+#define OFFSET_INDEX_H_
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <vector>
+#include <filesystem>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "data_vector.h"
+
+using namespace std;
+namespace fs = std::filesystem;
+
+/**
+ * \brief Identifies a particular version of a file
+ */
+struct FileStamp
+{
+    uint64_t size = 0;
+    int64_t mtime = 0; // [ns]
+
+    static bool fromFile(const fs::path& fname, FileStamp& stamp)
+    {
+        struct stat st;
+        if (stat(fname.c_str(), &st) != 0)
+        {
+            return false;
+        }
+        stamp.size = st.st_size;
+        stamp.mtime = int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+        return true;
+    }
+
+    bool operator==(const FileStamp& other) const
+    {
+        return size == other.size && mtime == other.mtime;
+    }
+};
+
+class OffsetIndex
+{
+    public:
+        static constexpr char MAGIC[8] = {'I','A','O','F','F','I','D','X'};
+        static constexpr uint32_t VERSION = 1;
+
+        struct Header
+        {
+            char magic[8];
+            uint32_t version;
+            uint32_t reserved;
+            uint64_t fileSize;
+            int64_t fileMtime;
+            uint64_t numRecords;
+        };
+
+        OffsetIndex() = default;
+        OffsetIndex(const OffsetIndex&) = delete;
+        OffsetIndex& operator=(const OffsetIndex&) = delete;
+
+        ~OffsetIndex()
+        {
+            clear();
+        }
+
+        static fs::path sidecarPath(const fs::path& recordFile)
+        {
+            fs::path p(recordFile);
+            p += ".idx";
+            return p;
+        }
+
+        /**
+         * \brief Drop all offsets, must not be called concurrently with readers
+         */
+        void clear()
+        {
+            unmap();
+            m_offsets = std::make_unique<UOffsets>();
+        }
+
+        /**
+         * \brief The index has been loaded from a sidecar
+         */
+        bool isMapped() const
+        {
+            return m_mapped != nullptr;
+        }
+
+        size_t size() const
+        {
+            return m_numMapped + m_offsets->size();
+        }
+
+        /**
+         * \brief Append the offset of the next record (producer only)
+         */
+        void push_back(uint64_t off)
+        {
+            m_offsets->push_back(off);
+        }
+
+        /**
+         * \brief Append the offsets of the next n records (producer only)
+         */
+        void append(const uint64_t* offs, size_t n)
+        {
+            m_offsets->append(offs, n);
+        }
+
+        /**
+         * \brief Offset of record idx
+         *
+         * \return false, if idx has not been indexed (yet)
+         */
+        bool lookup(uint64_t idx, uint64_t& off) const
+        {
+            if (idx < m_numMapped)
+            {
+                off = m_mapped[idx];
+                return true;
+            }
+            idx -= m_numMapped;
+            if (idx >= m_offsets->size())
+            {
+                return false;
+            }
+            off = (*m_offsets)[idx];
+            return true;
+        }
+
+        /**
+         * \brief Memory-map a sidecar, if it matches the given version of the record file
+         *
+         * \details
+         *      Must not be called concurrently with readers.
+         */
+        bool load(const fs::path& sidecar, const FileStamp& stamp)
+        {
+            clear();
+            int fd = ::open(sidecar.c_str(), O_RDONLY);
+            if (fd < 0)
+            {
+                return false;
+            }
+            struct stat st;
+            if (fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(Header))
+            {
+                ::close(fd);
+                return false;
+            }
+            void* addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            ::close(fd);
+            if (addr == MAP_FAILED)
+            {
+                return false;
+            }
+            const Header* hdr = static_cast<const Header*>(addr);
+            bool valid = memcmp(hdr->magic, MAGIC, sizeof(MAGIC)) == 0 &&
+                         hdr->version == VERSION &&
+                         hdr->fileSize == stamp.size &&
+                         hdr->fileMtime == stamp.mtime &&
+                         size_t(st.st_size) == sizeof(Header) + hdr->numRecords * sizeof(uint64_t);
+            if (!valid)
+            {
+                munmap(addr, st.st_size);
+                return false;
+            }
+            m_mapping = addr;
+            m_mappingSize = st.st_size;
+            m_numMapped = hdr->numRecords;
+            m_mapped = reinterpret_cast<const uint64_t*>(static_cast<const char*>(addr) + sizeof(Header));
+            return true;
+        }
+
+        /**
+         * \brief Write the index to a sidecar (producer only)
+         */
+        bool save(const fs::path& sidecar, const FileStamp& stamp) const
+        {
+            Header hdr;
+            memcpy(hdr.magic, MAGIC, sizeof(MAGIC));
+            hdr.version = VERSION;
+            hdr.reserved = 0;
+            hdr.fileSize = stamp.size;
+            hdr.fileMtime = stamp.mtime;
+            hdr.numRecords = size();
+
+            /* write to a temporary file first, so that readers never see a partial index */
+            fs::path tmp(sidecar);
+            tmp += ".tmp";
+            {
+                ofstream output(tmp, ios::out | ios::trunc | ios::binary);
+                output.write(reinterpret_cast<const char*>(&hdr), sizeof(hdr));
+                output.write(reinterpret_cast<const char*>(m_mapped), m_numMapped * sizeof(uint64_t));
+                m_offsets->forEachSegment(0, hdr.numRecords - m_numMapped, [&output](const uint64_t* offs, size_t n) {
+                    output.write(reinterpret_cast<const char*>(offs), n * sizeof(uint64_t));
+                });
+                if ( !output )
+                {
+                    std::cerr << "Failed to write offset index " << sidecar << std::endl;
+                    return false;
+                }
+            }
+            std::error_code ec;
+            fs::rename(tmp, sidecar, ec);
+            return !ec;
+        }
+
+    private:
+        void unmap()
+        {
+            if (m_mapping != nullptr)
+            {
+                munmap(m_mapping, m_mappingSize);
+                m_mapping = nullptr;
+                m_mapped = nullptr;
+                m_numMapped = 0;
+            }
+        }
+
+        typedef DataVector<uint64_t, 1 << 14> UOffsets;
+
+        /* offsets behind the mapped part */
+        std::unique_ptr<UOffsets> m_offsets = std::make_unique<UOffsets>();
+        void* m_mapping = nullptr;
+        size_t m_mappingSize = 0;
+        const uint64_t* m_mapped = nullptr;
+        uint64_t m_numMapped = 0;
+};
+
+#endif /* OFFSET_INDEX_H_ */
@@ -0,0 +1,316 @@
+/**
+ * Read access to a file of length-prefixed protobuf records.
+ *
+ * Each record consists of a serialized object_detection::Size header
+ * (field descriptor + fixed64) followed by a payload of that size.
+ *
+ * Two modes are supported:
+ *  * Mmap:   the file is mapped into memory, reads return pointers into the
+ *            mapping. No copies, no locking; any number of concurrent readers.
+ *  * Stream: fallback based on std::ifstream, reads are copied into a growable
+ *            buffer provided by the caller and serialized by a mutex.
+ *
+ * Files that are still being written can be picked up again with refresh().
+ * The file is mapped into a reserved address range twice its size, growth only
+ * maps the new pages behind the mapped part, so that pointers handed out to
+ * readers stay valid. Only a file outgrowing its reservation is mapped again
+ * into a new one of twice the size. Like the directories of a DataVector,
+ * replaced reservations are kept until close(), their number grows only
+ * logarithmically with the file size.
+ */
+
+#ifndef RECORD_READER_H_
+#define RECORD_READER_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <filesystem>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+namespace fs = std::filesystem;
+
+class RecordReader
+{
+    public:
+        enum class Mode { Mmap, Stream };
+
+        static constexpr unsigned SIZE_BYTES = 8;
+        static constexpr unsigned FIELD_DESCR = 1;
+        static constexpr unsigned HEADER_BYTES = FIELD_DESCR + SIZE_BYTES;
+
+        RecordReader() = default;
+        RecordReader(const RecordReader&) = delete;
+        RecordReader& operator=(const RecordReader&) = delete;
+
+        ~RecordReader()
+        {
+            close();
+        }
+
+        /**
+         * \brief Open a record file
+         *
+         * \details
+         *      If mapping the file fails in Mmap mode, the reader falls back to Stream mode.
+         */
+        bool open(const fs::path& fname, Mode mode = Mode::Mmap)
+        {
+            close();
+            m_fname = fname;
+            m_mode = mode;
+            if (mode == Mode::Mmap && map())
+            {
+                return true;
+            }
+            m_file = make_unique<ifstream>(fname, ios::binary);
+            if ( (m_file->rdstate() & std::ifstream::failbit ) != 0 )
+            {
+                m_file.reset();
+                return false;
+            }
+            m_file->seekg(0, ios::end);
+            m_size = m_file->tellg();
+            m_file->seekg(0);
+            return true;
+        }
+
+        void close()
+        {
+            for (auto& reservation : m_reservations)
+            {
+                munmap(reservation.first, reservation.second);
+            }
+            m_reservations.clear();
+            m_mappedSize = 0;
+            m_data = nullptr;
+            m_file.reset();
+            m_size = 0;
+        }
+
+        /**
+         * \brief Make data appended to the file since the last call available
+         *
+         * \details
+         *      Must not be called concurrently with open(), close() or itself.
+         *
+         * \return true if the file has grown
+         */
+        bool refresh()
+        {
+            uint64_t old_size = m_size;
+            /* a file, that was empty when opened, is mapped as soon as it has content */
+            if (m_mode == Mode::Mmap && map())
+            {
+                return true;
+            }
+            if (m_file && !isMapped())
+            {
+                std::lock_guard<std::mutex> lck (m_fileMtx);
+                m_file->clear();
+                m_file->seekg(0, ios::end);
+                if ( *m_file )
+                {
+                    m_size = m_file->tellg();
+                }
+            }
+            return m_size > old_size;
+        }
+
+        bool isOpen() const
+        {
+            return isMapped() || (m_file && m_file->is_open());
+        }
+
+        bool isMapped() const
+        {
+            return m_data != nullptr;
+        }
+
+        uint64_t size() const
+        {
+            return m_size;
+        }
+
+        /**
+         * \brief Access n bytes at offset off
+         *
+         * \param buffer Destination in Stream mode, grown to n bytes if needed.
+         *               Unused in Mmap mode. Reuse it across calls to avoid allocations.
+         * \return Pointer to the requested bytes, nullptr if they are not available
+         */
+        const char* read(uint64_t off, size_t n, std::vector<char>& buffer)
+        {
+            /* a corrupt size header must not turn into a huge allocation */
+            if ( !contains(off, n) )
+            {
+                return nullptr;
+            }
+            if (!isMapped() && buffer.size() < n)
+            {
+                buffer.resize(n);
+            }
+            return read(off, n, buffer.data());
+        }
+
+        /**
+         * \brief Decode the size header of the record starting at offset off
+         */
+        bool readHeader(uint64_t off, uint64_t& record_size)
+        {
+            char size_field[HEADER_BYTES];
+            const char* hdr = read(off, HEADER_BYTES, size_field);
+            /* field 1, wire-type fixed64 */
+            if (hdr == nullptr || hdr[0] != 0x09)
+            {
+                return false;
+            }
+            memcpy(&record_size, hdr + FIELD_DESCR, SIZE_BYTES);
+            return true;
+        }
+
+        /**
+         * \brief Whether the n bytes at offset off are within the file
+         */
+        bool contains(uint64_t off, uint64_t n) const
+        {
+            /* size is published after the mapping, see map() */
+            uint64_t size = m_size.load(std::memory_order_acquire);
+            return off <= size && n <= size - off;
+        }
+
+    private:
+        /**
+         * \brief Access n bytes at offset off, buffer must hold n bytes in Stream mode
+         */
+        const char* read(uint64_t off, size_t n, char* buffer)
+        {
+            if ( !contains(off, n) )
+            {
+                return nullptr;
+            }
+            if (isMapped())
+            {
+                return m_data.load(std::memory_order_acquire) + off;
+            }
+            return readFromFile(buffer, n, off) ? buffer : nullptr;
+        }
+
+        /**
+         * \brief Map the part of the file behind the current mapping
+         */
+        bool map()
+        {
+            int fd = ::open(m_fname.c_str(), O_RDONLY);
+            if (fd < 0)
+            {
+                return false;
+            }
+            struct stat st;
+            if (fstat(fd, &st) != 0 || uint64_t(st.st_size) <= m_size)
+            {
+                ::close(fd);
+                return false;
+            }
+            const uint64_t size = st.st_size;
+            const uint64_t pageSize = sysconf(_SC_PAGESIZE);
+            const uint64_t mappedSize = (size + pageSize - 1) / pageSize * pageSize;
+            bool mapped = false;
+            if ( !m_reservations.empty() && mappedSize <= m_reservations.back().second )
+            {
+                /* the last page mapped before shows the appended bytes as well, as the mapping is shared */
+                char* base = static_cast<char*>(m_reservations.back().first);
+                mapped = mappedSize == m_mappedSize ||
+                         mmap(base + m_mappedSize, mappedSize - m_mappedSize, PROT_READ,
+                              MAP_SHARED | MAP_FIXED, fd, m_mappedSize) != MAP_FAILED;
+            }
+            else
+            {
+                mapped = reserve(std::max(2 * mappedSize, minReservation)) &&
+                         mmap(m_reservations.back().first, mappedSize, PROT_READ,
+                              MAP_SHARED | MAP_FIXED, fd, 0) != MAP_FAILED;
+            }
+            /* the mapping stays valid after closing the descriptor */
+            ::close(fd);
+            if (!mapped)
+            {
+                return false;
+            }
+            m_mappedSize = mappedSize;
+            /* readers observing the new size are guaranteed to see the new mapping */
+            m_data.store(static_cast<const char*>(m_reservations.back().first), std::memory_order_release);
+            m_size.store(size, std::memory_order_release);
+            return true;
+        }
+
+        /**
+         * \brief Reserve n bytes of address space, the file is mapped into
+         */
+        bool reserve(uint64_t n)
+        {
+            void* addr = mmap(nullptr, n, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+            if (addr == MAP_FAILED)
+            {
+                return false;
+            }
+            m_reservations.emplace_back(addr, n);
+            m_mappedSize = 0;
+            return true;
+        }
+
+        bool readFromFile(char* buffer, size_t n, size_t seek_off)
+        {
+            bool ret_val = false;
+            std::lock_guard<std::mutex> lck (m_fileMtx);
+            m_file->clear();
+            if ( m_file->is_open() )
+            {
+                m_file->seekg(seek_off);
+                if ( !(*m_file) )
+                {
+                    return ret_val;
+                }
+                m_file->read(buffer, n);
+                if ( !(*m_file) )
+                {
+                    return ret_val;
+                }
+                else
+                {
+                    ret_val = true;
+                }
+            }
+            else
+            {
+                std::cout << "File unexpetedly closed" << std::endl;
+            }
+            return ret_val;
+        }
+
+        fs::path m_fname;
+        Mode m_mode = Mode::Mmap;
+        std::atomic<const char*> m_data = nullptr;
+        std::atomic<uint64_t> m_size = 0;
+        /* smallest address range reserved for a file */
+        static constexpr uint64_t minReservation = uint64_t(1) << 20;
+
+        /* address ranges reserved since open(), the file is mapped into the last one */
+        std::vector< std::pair<void*, size_t> > m_reservations;
+        /* bytes of the last reservation mapped, a multiple of the page size */
+        uint64_t m_mappedSize = 0;
+        unique_ptr<ifstream> m_file;
+        std::mutex m_fileMtx;
+};
+
+#endif /* RECORD_READER_H_ */
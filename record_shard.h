@@ -0,0 +1,205 @@
+/**
+ * A single record file of a dataset together with its offset index.
+ *
+ * A dataset consists of one or more shards, e.g. the files of a recorder that
+ * rotates its output every few minutes. Records are addressed by their index
+ * within the shard.
+ */
+
+#ifndef RECORD_SHARD_H_
+#define RECORD_SHARD_H_
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+#include <filesystem>
+
+#include "record_reader.h"
+#include "offset_index.h"
+#include "column_cache.h"
+#include "example_view.h"
+
+using namespace std;
+namespace fs = std::filesystem;
+
+class RecordShard
+{
+    public:
+        RecordShard() = default;
+        RecordShard(const RecordShard&) = delete;
+        RecordShard& operator=(const RecordShard&) = delete;
+
+        /**
+         * \brief Open the record file and reuse the offset index of a previous scan,
+         *        if the file did not change
+         */
+        bool open(const fs::path& fname, RecordReader::Mode mode)
+        {
+            m_fname = fname;
+            if ( !m_reader.open(fname, mode) )
+            {
+                return false;
+            }
+            FileStamp stamp;
+            if ( FileStamp::fromFile(m_fname, stamp) )
+            {
+                m_offsets.load(OffsetIndex::sidecarPath(m_fname), stamp);
+            }
+            m_numIndexSaved = m_offsets.size();
+            return true;
+        }
+
+        const fs::path& fname() const
+        {
+            return m_fname;
+        }
+
+        /**
+         * \brief Directory, relative to which image filenames are resolved
+         */
+        fs::path dir() const
+        {
+            return m_fname.parent_path();
+        }
+
+        RecordReader& reader()
+        {
+            return m_reader;
+        }
+
+        OffsetIndex& offsets()
+        {
+            return m_offsets;
+        }
+
+        ColumnCache& cache()
+        {
+            return m_cache;
+        }
+
+        /**
+         * \brief Number of bytes covered by the indexed records
+         */
+        uint64_t indexedSize()
+        {
+            uint64_t off = 0;
+            uint64_t record_size = 0;
+            uint64_t numIndexed = m_offsets.size();
+            if ( numIndexed == 0 || !m_offsets.lookup(numIndexed - 1, off) ||
+                 !m_reader.readHeader(off, record_size) )
+            {
+                return 0;
+            }
+            return off + RecordReader::HEADER_BYTES + record_size;
+        }
+
+        /**
+         * \brief Locate records by reading only the headers
+         *
+         * \details
+         *      Indexing continues behind the last indexed record and stops in front of
+         *      a record, that has not been written completely.
+         *
+         * \param cancel Indexing stops early, once it is set
+         * \return Number of records added to the index
+         */
+        uint64_t indexRecords(const std::atomic<bool>* cancel = nullptr)
+        {
+            uint64_t numIndexed = m_offsets.size();
+            uint64_t off = indexedSize();
+            uint64_t record_size = 0;
+            if ( numIndexed > 0 && off == 0 )
+            {
+                return 0;
+            }
+            while ( (cancel == nullptr || !*cancel) && m_reader.readHeader(off, record_size) )
+            {
+                /* compared against the remaining bytes, a corrupt size must not wrap around;
+                 * a followed file is expected to end in a partial record, so this is silent */
+                if ( !m_reader.contains(off + RecordReader::HEADER_BYTES, record_size) )
+                {
+                    break;
+                }
+                m_offsets.push_back(off);
+                off += RecordReader::HEADER_BYTES + record_size;
+            }
+            return m_offsets.size() - numIndexed;
+        }
+
+        /**
+         * \brief Write the offset index to its sidecar, if records have been added
+         */
+        void saveIndex()
+        {
+            FileStamp stamp;
+            uint64_t numIndexed = m_offsets.size();
+            if ( numIndexed != m_numIndexSaved && FileStamp::fromFile(m_fname, stamp) &&
+                 m_offsets.save(OffsetIndex::sidecarPath(m_fname), stamp) )
+            {
+                m_numIndexSaved = numIndexed;
+            }
+        }
+
+        /**
+         * \brief Payload of record idx
+         *
+         * \details
+         *      Records, that have not been indexed yet, are found by walking the
+         *      headers from the last indexed record.
+         *
+         * \param buffer See RecordReader::read()
+         * \return Pointer to the payload, nullptr if the record is not available
+         */
+        const char* readRecord(uint64_t idx, std::vector<char>& buffer, uint64_t& record_size)
+        {
+            uint64_t off = 0;
+            if ( !m_offsets.lookup(idx, off) )
+            {
+                uint64_t numIndexed = m_offsets.size();
+                if ( numIndexed > 0 )
+                {
+                    m_offsets.lookup(numIndexed - 1, off);
+                    idx -= numIndexed - 1;
+                }
+                for (uint64_t k = 0; k < idx; k++) {
+                    if ( !m_reader.readHeader(off, record_size) ||
+                         !m_reader.contains(off + RecordReader::HEADER_BYTES, record_size) )
+                    {
+                        return nullptr;
+                    }
+                    off += RecordReader::HEADER_BYTES + record_size;
+                }
+            }
+            if ( !m_reader.readHeader(off, record_size) )
+            {
+                return nullptr;
+            }
+            return m_reader.read(off + RecordReader::HEADER_BYTES, record_size, buffer);
+        }
+
+        /**
+         * \brief Timestamp of the first record, used to order the shards of a dataset
+         */
+        bool firstTimestamp(uint64_t& timestamp)
+        {
+            std::vector<char> buffer;
+            uint64_t record_size = 0;
+            const char* payload = readRecord(0, buffer, record_size);
+            ExampleView view;
+            if ( payload == nullptr || !view.parse(payload, record_size, ExampleView::TIMESTAMP) )
+            {
+                return false;
+            }
+            timestamp = view.timestamp();
+            return true;
+        }
+
+    private:
+        fs::path m_fname;
+        RecordReader m_reader;
+        OffsetIndex m_offsets;
+        uint64_t m_numIndexSaved = 0;
+        ColumnCache m_cache;
+};
+
+#endif /* RECORD_SHARD_H_ */
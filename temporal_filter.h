@@ -0,0 +1,384 @@
+/**
+ * Streaming filters of detection count columns.
+ *
+ * The filters are causal: the output of an image only depends on this image
+ * and its predecessors, so a column can be filtered in pieces as new images
+ * arrive and yields the same output as filtering it as a whole. The window
+ * of the first images is completed by repeating the first count.
+ *
+ *      MaxPool         maximum of the last window counts, holds a count for
+ *                      window - 1 images
+ *      Median          median of the last window counts (odd, up to
+ *                      maxMedianWindow), removes spikes shorter than
+ *                      window / 2 images and delays changes by window / 2
+ *      Ema             exponential moving average with weight alpha of the
+ *                      newest count, rounded to the nearest count
+ *
+ * Max-pooling and the median compare the window shifted by one image at a
+ * time in vectors. The median sorts the shifted vectors with an odd-even
+ * transposition network. The average is a recurrence and is computed
+ * sequentially.
+ */
+
+#ifndef TEMPORAL_FILTER_H_
+#define TEMPORAL_FILTER_H_
+
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include <vector>
+
+#include "cpu_dispatch.h"
+
+using namespace std;
+
+struct FilterParams
+{
+    enum class Type
+    {
+        None,
+        MaxPool,
+        Median,
+        Ema
+    };
+
+    Type type = Type::None;
+    /* number of images of MaxPool and Median */
+    uint32_t window = 5;
+    /* weight of the newest count of Ema, (0, 1] */
+    float alpha = 0.25f;
+};
+
+namespace TemporalFilterKernels
+{
+    /**
+     * \brief Kernel writing the filtered count of each of n images to out
+     *
+     * \details
+     *      in holds window - 1 preceding counts followed by the counts of the n
+     *      images, out[k] is computed from in[k, k + window).
+     */
+    typedef void (*WindowKernel)(const int16_t* in, uint32_t n, uint32_t window, int16_t* out);
+
+    static constexpr uint32_t maxMedianWindow = 15;
+
+    inline void maxPoolScalar(const int16_t* in, uint32_t n, uint32_t window, int16_t* out)
+    {
+        for (uint32_t k = 0; k < n; k++)
+        {
+            out[k] = *std::max_element(in + k, in + k + window);
+        }
+    }
+
+    inline void medianScalar(const int16_t* in, uint32_t n, uint32_t window, int16_t* out)
+    {
+        int16_t sorted[maxMedianWindow];
+        for (uint32_t k = 0; k < n; k++)
+        {
+            std::copy(in + k, in + k + window, sorted);
+            std::nth_element(sorted, sorted + window / 2, sorted + window);
+            out[k] = sorted[window / 2];
+        }
+    }
+
+#if CPU_DISPATCH_X86
+    /*
+     * Each kernel filters a vector of images per iteration from window unaligned
+     * loads, each shifted by one image. The images behind the last full vector
+     * are filtered by the scalar kernel.
+     */
+
+    TARGET_SSE42 inline void maxPoolSse42(const int16_t* in, uint32_t n, uint32_t window, int16_t* out)
+    {
+        const uint32_t chunk_size = 8;
+        uint32_t k = 0;
+        for (; k + chunk_size <= n; k += chunk_size)
+        {
+            __m128i acc = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + k));
+            for (uint32_t j = 1; j < window; j++)
+            {
+                acc = _mm_max_epi16(acc, _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + k + j)));
+            }
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + k), acc);
+        }
+        maxPoolScalar(in + k, n - k, window, out + k);
+    }
+
+    TARGET_AVX2 inline void maxPoolAvx2(const int16_t* in, uint32_t n, uint32_t window, int16_t* out)
+    {
+        const uint32_t chunk_size = 16;
+        uint32_t k = 0;
+        for (; k + chunk_size <= n; k += chunk_size)
+        {
+            __m256i acc = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + k));
+            for (uint32_t j = 1; j < window; j++)
+            {
+                acc = _mm256_max_epi16(acc, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + k + j)));
+            }
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + k), acc);
+        }
+        maxPoolSse42(in + k, n - k, window, out + k);
+    }
+
+    TARGET_AVX512 inline void maxPoolAvx512(const int16_t* in, uint32_t n, uint32_t window, int16_t* out)
+    {
+        const uint32_t chunk_size = 32;
+        uint32_t k = 0;
+        for (; k + chunk_size <= n; k += chunk_size)
+        {
+            __m512i acc = _mm512_loadu_si512(in + k);
+            for (uint32_t j = 1; j < window; j++)
+            {
+                acc = _mm512_max_epi16(acc, _mm512_loadu_si512(in + k + j));
+            }
+            _mm512_storeu_si512(out + k, acc);
+        }
+        maxPoolAvx2(in + k, n - k, window, out + k);
+    }
+
+    template<uint32_t Window>
+    TARGET_SSE42 inline void medianSse42(const int16_t* in, uint32_t n, int16_t* out)
+    {
+        const uint32_t chunk_size = 8;
+        uint32_t k = 0;
+        for (; k + chunk_size <= n; k += chunk_size)
+        {
+            __m128i v[Window];
+#pragma GCC unroll 16
+            for (uint32_t j = 0; j < Window; j++)
+            {
+                v[j] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + k + j));
+            }
+#pragma GCC unroll 16
+            for (uint32_t pass = 0; pass < Window; pass++)
+            {
+#pragma GCC unroll 16
+                for (uint32_t j = pass % 2; j + 1 < Window; j += 2)
+                {
+                    __m128i lo = _mm_min_epi16(v[j], v[j + 1]);
+                    v[j + 1] = _mm_max_epi16(v[j], v[j + 1]);
+                    v[j] = lo;
+                }
+            }
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + k), v[Window / 2]);
+        }
+        medianScalar(in + k, n - k, Window, out + k);
+    }
+
+    template<uint32_t Window>
+    TARGET_AVX2 inline void medianAvx2(const int16_t* in, uint32_t n, int16_t* out)
+    {
+        const uint32_t chunk_size = 16;
+        uint32_t k = 0;
+        for (; k + chunk_size <= n; k += chunk_size)
+        {
+            __m256i v[Window];
+#pragma GCC unroll 16
+            for (uint32_t j = 0; j < Window; j++)
+            {
+                v[j] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + k + j));
+            }
+#pragma GCC unroll 16
+            for (uint32_t pass = 0; pass < Window; pass++)
+            {
+#pragma GCC unroll 16
+                for (uint32_t j = pass % 2; j + 1 < Window; j += 2)
+                {
+                    __m256i lo = _mm256_min_epi16(v[j], v[j + 1]);
+                    v[j + 1] = _mm256_max_epi16(v[j], v[j + 1]);
+                    v[j] = lo;
+                }
+            }
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + k), v[Window / 2]);
+        }
+        medianSse42<Window>(in + k, n - k, out + k);
+    }
+
+    template<uint32_t Window>
+    TARGET_AVX512 inline void medianAvx512(const int16_t* in, uint32_t n, int16_t* out)
+    {
+        const uint32_t chunk_size = 32;
+        uint32_t k = 0;
+        for (; k + chunk_size <= n; k += chunk_size)
+        {
+            __m512i v[Window];
+#pragma GCC unroll 16
+            for (uint32_t j = 0; j < Window; j++)
+            {
+                v[j] = _mm512_loadu_si512(in + k + j);
+            }
+#pragma GCC unroll 16
+            for (uint32_t pass = 0; pass < Window; pass++)
+            {
+#pragma GCC unroll 16
+                for (uint32_t j = pass % 2; j + 1 < Window; j += 2)
+                {
+                    __m512i lo = _mm512_min_epi16(v[j], v[j + 1]);
+                    v[j + 1] = _mm512_max_epi16(v[j], v[j + 1]);
+                    v[j] = lo;
+                }
+            }
+            _mm512_storeu_si512(out + k, v[Window / 2]);
+        }
+        medianAvx2<Window>(in + k, n - k, out + k);
+    }
+
+    /**
+     * \brief Dispatch a median kernel by its window, which the sorting network is unrolled for
+     */
+#define MEDIAN_KERNEL(ISA) \
+    inline void median##ISA(const int16_t* in, uint32_t n, uint32_t window, int16_t* out) \
+    { \
+        switch (window) \
+        { \
+            case 3:  return median##ISA<3>(in, n, out); \
+            case 5:  return median##ISA<5>(in, n, out); \
+            case 7:  return median##ISA<7>(in, n, out); \
+            case 9:  return median##ISA<9>(in, n, out); \
+            case 11: return median##ISA<11>(in, n, out); \
+            case 13: return median##ISA<13>(in, n, out); \
+            case 15: return median##ISA<15>(in, n, out); \
+            default: return medianScalar(in, n, window, out); \
+        } \
+    }
+    MEDIAN_KERNEL(Sse42)
+    MEDIAN_KERNEL(Avx2)
+    MEDIAN_KERNEL(Avx512)
+#undef MEDIAN_KERNEL
+#endif
+
+    /**
+     * \brief Kernel of a filter for an instruction set, the next less capable one if there is none
+     */
+    inline WindowKernel windowKernel(FilterParams::Type type, CpuDispatch::Isa isa)
+    {
+        bool median = (type == FilterParams::Type::Median);
+#if CPU_DISPATCH_X86
+        switch (isa)
+        {
+            case CpuDispatch::Isa::Avx512: return median ? (WindowKernel)medianAvx512 : maxPoolAvx512;
+            case CpuDispatch::Isa::Avx2:   return median ? (WindowKernel)medianAvx2 : maxPoolAvx2;
+            case CpuDispatch::Isa::Sse42:  return median ? (WindowKernel)medianSse42 : maxPoolSse42;
+            default:                       break;
+        }
+#endif
+        (void)isa;
+        return median ? medianScalar : maxPoolScalar;
+    }
+};
+
+/**
+ * \brief Filter of a single count column, applied to consecutive pieces of the column
+ */
+class TemporalFilter
+{
+    public:
+        explicit TemporalFilter(const FilterParams& params = FilterParams())
+            : m_params(params)
+        {
+            if (m_params.type == FilterParams::Type::Median)
+            {
+                /* the median of an even window is not a count */
+                m_params.window = std::min(m_params.window | 1, TemporalFilterKernels::maxMedianWindow);
+            }
+            m_params.window = std::max(m_params.window, 1u);
+            m_params.alpha = std::clamp(m_params.alpha, 0.0f, 1.0f);
+            if (m_params.type == FilterParams::Type::MaxPool || m_params.type == FilterParams::Type::Median)
+            {
+                m_kernel = TemporalFilterKernels::windowKernel(m_params.type, CpuDispatch::isa());
+            }
+        }
+
+        const FilterParams& params() const
+        {
+            return m_params;
+        }
+
+        bool isEnabled() const
+        {
+            return m_params.type != FilterParams::Type::None;
+        }
+
+        /**
+         * \brief Start a new column
+         */
+        void reset()
+        {
+            m_history.clear();
+            m_numFrames = 0;
+        }
+
+        /**
+         * \brief Number of images filtered so far
+         */
+        uint64_t numFrames() const
+        {
+            return m_numFrames;
+        }
+
+        /**
+         * \brief Filter the counts of the next n images of the column
+         *
+         * \param out Filtered counts of the n images, may be the same as counts
+         */
+        void apply(const int16_t* counts, uint32_t n, int16_t* out)
+        {
+            if (n == 0)
+            {
+                return;
+            }
+            switch (m_params.type)
+            {
+                case FilterParams::Type::MaxPool:
+                case FilterParams::Type::Median:
+                    applyWindow(counts, n, out);
+                    break;
+                case FilterParams::Type::Ema:
+                    applyEma(counts, n, out);
+                    break;
+                default:
+                    std::copy(counts, counts + n, out);
+                    break;
+            }
+            m_numFrames += n;
+        }
+
+    private:
+        void applyWindow(const int16_t* counts, uint32_t n, int16_t* out)
+        {
+            const uint32_t numHistory = m_params.window - 1;
+            if (m_numFrames == 0)
+            {
+                m_history.assign(numHistory, counts[0]);
+            }
+            /* the kernel reads the window of the first images from the history */
+            m_history.insert(m_history.end(), counts, counts + n);
+            m_kernel(m_history.data(), n, m_params.window, out);
+            m_history.erase(m_history.begin(), m_history.end() - numHistory);
+        }
+
+        void applyEma(const int16_t* counts, uint32_t n, int16_t* out)
+        {
+            if (m_numFrames == 0)
+            {
+                m_average = counts[0];
+            }
+            const float alpha = m_params.alpha;
+            float average = m_average;
+            for (uint32_t k = 0; k < n; k++)
+            {
+                average += alpha * (counts[k] - average);
+                out[k] = int16_t(std::lround(average));
+            }
+            m_average = average;
+        }
+
+        FilterParams m_params;
+        TemporalFilterKernels::WindowKernel m_kernel = nullptr;
+        /* the last window - 1 counts, followed by the counts being filtered */
+        std::vector<int16_t> m_history;
+        float m_average = 0.0f;
+        uint64_t m_numFrames = 0;
+};
+
+#endif /* TEMPORAL_FILTER_H_ */
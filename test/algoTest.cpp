@@ -21,3 +21,106 @@ TEST (AlgoTest, TestForFailExample1)
         }
     }
 }
+
+template<typename T>
+static std::vector<T> makeSequence(uint32_t len)
+{
+    std::vector<T> seq;
+    for (uint32_t k = 0; k < len; k++)
+    {
+        seq.push_back((k * k / 7) % 3 == 0 ? T(1) : T(0));
+    }
+    return seq;
+}
+
+template<typename T>
+static void expectKernelsMatchScalarReference()
+{
+    /* lengths around the chunk sizes exercise the overlapping last chunk */
+    const std::vector<T> seq = makeSequence<T>(1000);
+    for (auto isa : {CpuDispatch::Isa::Sse42, CpuDispatch::Isa::Avx2, CpuDispatch::Isa::Avx512})
+    {
+        if (isa > CpuDispatch::detectIsa())
+        {
+            break;
+        }
+        for (uint32_t first : {0u, 1u, 5u})
+        {
+            for (uint32_t len : {0u, 1u, 2u, 5u, 8u, 9u, 15u, 16u, 17u, 31u, 32u, 33u, 63u, 64u, 65u, 1000u})
+            {
+                std::vector<uint32_t> expected(len), grads(len);
+                expected.resize(Algo::derivativeScalar(seq.data(), first, len, expected.data()));
+                grads.resize(Algo::derivativeKernel<T>(isa)(seq.data(), first, len, grads.data()));
+                ASSERT_EQ (expected, grads) << CpuDispatch::isaName(isa) << " sizeof " << sizeof(T)
+                                            << " first " << first << " length " << len;
+            }
+        }
+    }
+}
+
+TEST (AlgoTest, KernelsMatchScalarReference)
+{
+    expectKernelsMatchScalarReference<int8_t>();
+    expectKernelsMatchScalarReference<int16_t>();
+    expectKernelsMatchScalarReference<int32_t>();
+    expectKernelsMatchScalarReference<float>();
+}
+
+TEST (AlgoTest, RangesAddUpToWholeInput)
+{
+    std::vector<int16_t> seq = makeSequence<int16_t>(1000);
+    /* values only differing in the upper byte */
+    seq[500] = 0x100;
+    std::vector<uint32_t> expected, grads, combined;
+    Algo::stdVectorDerivative(seq, expected);
+    ASSERT_TRUE(std::find(expected.begin(), expected.end(), 499u) != expected.end());
+    for (uint32_t from = 0; from < seq.size(); from += 100)
+    {
+        Algo::derivativeRange(seq.data(), seq.size(), from, from + 100, grads);
+        for (auto k : grads)
+        {
+            ASSERT_GE (k, from);
+            ASSERT_LT (k, from + 100);
+        }
+        combined.insert(combined.end(), grads.begin(), grads.end());
+    }
+    EXPECT_EQ (expected, combined);
+
+    std::vector<float> empty;
+    Algo::stdVectorDerivative(empty, grads);
+    EXPECT_TRUE(grads.empty());
+}
+
+template<typename T>
+static void expectThresholdMaskKernelsMatchScalarReference(const std::vector<T>& thresholds)
+{
+    std::vector<T> seq;
+    for (uint32_t k = 0; k < 1000; k++)
+    {
+        seq.push_back(T(k * k / 7));
+    }
+    for (auto isa : {CpuDispatch::Isa::Sse42, CpuDispatch::Isa::Avx2, CpuDispatch::Isa::Avx512})
+    {
+        if (isa > CpuDispatch::detectIsa())
+        {
+            break;
+        }
+        for (T threshold : thresholds)
+        {
+            for (uint32_t len : {0u, 1u, 63u, 64u, 65u, 128u, 1000u})
+            {
+                std::vector<uint64_t> expected((len + 63) / 64), bits((len + 63) / 64);
+                Algo::thresholdMaskScalar(seq.data(), len, threshold, expected.data());
+                Algo::thresholdMaskKernel<T>(isa)(seq.data(), len, threshold, bits.data());
+                ASSERT_EQ (expected, bits) << CpuDispatch::isaName(isa) << " sizeof " << sizeof(T)
+                                           << " threshold " << int(threshold) << " length " << len;
+            }
+        }
+    }
+}
+
+TEST (AlgoTest, ThresholdMaskKernelsMatchScalarReference)
+{
+    expectThresholdMaskKernelsMatchScalarReference<int8_t>({-128, -1, 0, 5, 127});
+    expectThresholdMaskKernelsMatchScalarReference<int16_t>({-32768, -1, 0, 5, 127, 128, 300, 32767});
+}
@@ -0,0 +1,141 @@
+#include <iostream>
+#include <gtest/gtest.h>
+
+#include "eval_box_flicker.h"
+
+typedef EvalBoxFlicker::UParser Example;
+
+struct TestBox
+{
+    float xmin, xmax, ymin, ymax;
+    char cls;
+    char score;
+};
+
+static Example makeExample(const std::vector<TestBox>& boxes)
+{
+    Example example;
+    std::string scores, classes;
+    for (auto& b : boxes)
+    {
+        auto* box = example.add_boxes();
+        box->set_xmin(b.xmin);
+        box->set_xmax(b.xmax);
+        box->set_ymin(b.ymin);
+        box->set_ymax(b.ymax);
+        scores.push_back(b.score);
+        classes.push_back(b.cls);
+    }
+    example.set_num_detections(boxes.size());
+    example.set_scores(scores);
+    example.set_classes(classes);
+    return example;
+}
+
+static std::vector<uint8_t> trackBreaks(const std::vector<Example>& examples, const std::vector<int>& class_ids)
+{
+    std::vector<const Example*> batch;
+    for (auto& example : examples)
+    {
+        batch.push_back(&example);
+    }
+    std::vector<uint8_t> breaks(examples.size());
+    EvalBoxFlicker::State state;
+    EvalBoxFlicker::calcTrackBreaks(batch.data(), batch.size(), class_ids, state, breaks.data());
+    return breaks;
+}
+
+TEST (EvalBoxFlickerTest, CountsUnmatchedBoxes)
+{
+    const TestBox a{0.1f, 0.3f, 0.1f, 0.3f, 1, 90};
+    const TestBox b{0.5f, 0.7f, 0.5f, 0.7f, 2, 90};
+    // a moves slightly, then jumps
+    const TestBox a_moved{0.11f, 0.31f, 0.1f, 0.3f, 1, 90};
+    const TestBox a_jumped{0.6f, 0.8f, 0.1f, 0.3f, 1, 90};
+    // same position, but another class
+    const TestBox b_other{0.5f, 0.7f, 0.5f, 0.7f, 1, 90};
+    // below the score, that is matched
+    const TestBox b_weak{0.5f, 0.7f, 0.5f, 0.7f, 2, 10};
+
+    auto breaks = trackBreaks({makeExample({a, b}), makeExample({a_moved, b}), makeExample({a_jumped, b}),
+                               makeExample({a_jumped, b_other}), makeExample({a_jumped, b_weak})}, {1,2});
+    // the first image has no predecessor
+    ASSERT_EQ (breaks[0], 0);
+    ASSERT_EQ (breaks[1], 0);
+    // a disappeared and appeared elsewhere
+    ASSERT_EQ (breaks[2], 2);
+    ASSERT_EQ (breaks[3], 2);
+    ASSERT_EQ (breaks[4], 1);
+
+    // classes not evaluated are ignored
+    breaks = trackBreaks({makeExample({a, b}), makeExample({a_jumped, b})}, {2});
+    ASSERT_EQ (breaks[1], 0);
+}
+
+TEST (EvalBoxFlickerTest, ViewMatchesMessage)
+{
+    std::vector<Example> examples;
+    for (int k = 0; k < 20; k++)
+    {
+        std::vector<TestBox> boxes;
+        for (int n = 0; n < 30; n++)
+        {
+            // zero coordinates are omitted on the wire
+            float x = 0.05f * ((n * 7 + k) % 10);
+            boxes.push_back({x, x + 0.1f, 0.0f, 0.2f, char(1 + (n + k) % 3), char((n * 37 + k) % 101)});
+        }
+        examples.push_back(makeExample(boxes));
+    }
+    std::vector<std::string> serialized;
+    for (auto& example : examples)
+    {
+        serialized.push_back(example.SerializeAsString());
+    }
+    std::vector<ExampleView> views(examples.size());
+    std::vector<const ExampleView*> batch;
+    for (size_t k = 0; k < views.size(); k++)
+    {
+        ASSERT_TRUE (views[k].parse(serialized[k].data(), serialized[k].size(), EvalBoxFlicker::scanFields));
+        batch.push_back(&views[k]);
+    }
+    std::vector<uint8_t> breaks(views.size());
+    EvalBoxFlicker::State state;
+    EvalBoxFlicker::calcTrackBreaks(batch.data(), batch.size(), {1,2}, state, breaks.data());
+    ASSERT_EQ (breaks, trackBreaks(examples, {1,2}));
+}
+
+TEST (EvalBoxFlickerTest, KernelsMatchScalarReference)
+{
+    EvalBoxFlicker::Boxes prev, cur;
+    std::vector<uint32_t> matched, matched_ref;
+    for (uint32_t size : {0, 1, 7, 8, 9, 33, 100})
+    {
+        prev.reset(size);
+        cur.reset(size + 3);
+        for (uint32_t n = 0; n < size; n++)
+        {
+            float x = 0.01f * ((n * 37) % 90);
+            prev.add(x, x + 0.1f, 0.2f, 0.4f, 1 + n % 2);
+        }
+        for (uint32_t n = 0; n < size + 3; n++)
+        {
+            float x = 0.01f * ((n * 37 + 3) % 90);
+            cur.add(x, x + 0.1f, 0.2f, 0.4f, 1 + n % 2);
+        }
+        prev.pad();
+        cur.pad();
+        matched.resize(prev.numChunks());
+        matched_ref.resize(prev.numChunks());
+        uint32_t expected = EvalBoxFlicker::breakKernel(CpuDispatch::Isa::Scalar)(prev, cur, matched_ref.data());
+        for (auto isa : {CpuDispatch::Isa::Sse42, CpuDispatch::Isa::Avx2, CpuDispatch::Isa::Avx512})
+        {
+            if (isa > CpuDispatch::detectIsa())
+            {
+                break;
+            }
+            ASSERT_EQ (EvalBoxFlicker::breakKernel(isa)(prev, cur, matched.data()), expected)
+                << CpuDispatch::isaName(isa) << " size " << size;
+            ASSERT_EQ (matched, matched_ref) << CpuDispatch::isaName(isa) << " size " << size;
+        }
+    }
+}
@@ -0,0 +1,438 @@
+#include <iostream>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <limits>
+#include <thread>
+#include <gtest/gtest.h>
+
+#include "data_model.h"
+#include "data_model_protobuf.h"
+#include "eval_fast_rcnn_resnet101.h"
+#include "tempRecordFile.h"
+
+typedef DataModelProtoBuf<EvalFastRcnnResnet101> Model;
+
+/**
+ * \brief Counts per class of the records [first, first + n) written by appendRecords(),
+ *        evaluated one record after the other
+ */
+static std::vector< std::vector<int16_t> > sequentialCounts(uint64_t first, uint64_t n, uint32_t maxDetections,
+                                                            const std::vector<int>& classIds, int threshold)
+{
+    std::vector< std::vector<int16_t> > counts(classIds.size());
+    std::vector<int> valid(classIds.size());
+    for (uint64_t timestamp = first; timestamp < first + n; timestamp++)
+    {
+        auto example = makeRecord(timestamp, (timestamp * 31) % (maxDetections + 1));
+        EvalFastRcnnResnet101::calcNumDetections(example, classIds, valid, threshold);
+        for (size_t i = 0; i < classIds.size(); i++)
+        {
+            counts[i].push_back(valid[i]);
+        }
+    }
+    return counts;
+}
+
+class DataModelTest : public ::testing::Test
+{
+    protected:
+        void SetUp() override
+        {
+            m_model = Model::getInstance();
+            m_model->setLoadCallback(nullptr);
+            m_model->setFollowMode(false);
+        }
+
+        void TearDown() override
+        {
+            m_model->cancelLoad();
+            m_model->setLoadCallback(nullptr);
+        }
+
+        void expectCounts(uint64_t first, uint64_t n, uint32_t maxDetections)
+        {
+            auto expected = sequentialCounts(first, n, maxDetections, m_model->getClassIds(), m_model->getThreshold());
+            ASSERT_EQ (m_model->getNumLoaded(), n);
+            for (size_t i = 0; i < expected.size(); i++)
+            {
+                EXPECT_EQ (m_model->getNumDetections(i), expected[i]) << "class " << i;
+            }
+        }
+
+        shared_ptr< DataModel<Model> > m_model;
+};
+
+TEST_F (DataModelTest, ReopenWhileLoading)
+{
+    TempRecordFile large("reopen_large.pb");
+    TempRecordFile small("reopen_small.pb");
+    large.appendRecords(0, 60000, 30);
+    small.appendRecords(1000000, 3000, 30);
+
+    m_model->open(large.path().string());
+    std::promise<void> loading;
+    std::atomic<bool> reopening = false;
+    std::atomic<unsigned> numCallbacks = 0;
+    m_model->setLoadCallback([&](uint32_t, bool) {
+        if (numCallbacks++ == 0)
+        {
+            loading.set_value();
+            /* keep loading until open() is about to cancel it */
+            while (!reopening)
+            {
+                std::this_thread::yield();
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        }
+    });
+    std::thread loader([&]() { m_model->load(); });
+    loading.get_future().wait();
+    reopening = true;
+    m_model->open(small.path().string());
+    // open() has waited for the load of the previous file, that is never called back again
+    unsigned callbacksBeforeReopen = numCallbacks;
+    EXPECT_EQ (m_model->getNumLoaded(), 0u);
+    m_model->setLoadCallback(nullptr);
+    m_model->load();
+    loader.join();
+    EXPECT_EQ (numCallbacks, callbacksBeforeReopen);
+    expectCounts(1000000, 3000, 30);
+}
+
+/**
+ * \brief Track breaks of the records [first, first + n) written by appendRecords(),
+ *        evaluated one record after the other
+ */
+static std::vector<uint8_t> sequentialTrackBreaks(uint64_t first, uint64_t n, uint32_t maxDetections,
+                                                  const std::vector<int>& classIds)
+{
+    std::vector<uint8_t> breaks(n);
+    EvalBoxFlicker::State state;
+    for (uint64_t k = 0; k < n; k++)
+    {
+        auto example = makeRecord(first + k, ((first + k) * 31) % (maxDetections + 1));
+        const object_detection::Example* examples[] = {&example};
+        EvalBoxFlicker::calcTrackBreaks(examples, 1, classIds, state, breaks.data() + k);
+    }
+    return breaks;
+}
+
+TEST_F (DataModelTest, ParallelScanMatchesSequentialScan)
+{
+    // several scan blocks, the last one is incomplete
+    const uint64_t numRecords = 3 * 4096 + 17;
+    TempRecordFile file("scan.pb");
+    file.appendRecords(5000, numRecords, 40);
+    auto model = std::static_pointer_cast<Model>(m_model);
+    for (auto mode : {RecordReader::Mode::Mmap, RecordReader::Mode::Stream})
+    {
+        file.remove();
+        file.appendRecords(5000, numRecords, 40);
+        model->setReaderMode(mode);
+        m_model->open(file.path().string());
+        m_model->load();
+        expectCounts(5000, numRecords, 40);
+    }
+    model->setReaderMode(RecordReader::Mode::Mmap);
+}
+
+TEST_F (DataModelTest, BlocksAreStitchedAtTheirBoundaries)
+{
+    const uint64_t numRecords = 2 * 4096 + 100;
+    TempRecordFile file("stitch.pb");
+    file.appendRecords(0, numRecords, 12);
+    m_model->open(file.path().string());
+    m_model->load();
+    expectCounts(0, numRecords, 12);
+
+    // the track breaks of the first record of a block refer to the last record of the previous one
+    auto classIds = m_model->getClassIds();
+    EXPECT_EQ (m_model->getTrackBreaks(0, numRecords), sequentialTrackBreaks(0, numRecords, 12, classIds));
+
+    // POIs at the block boundaries are neither lost nor duplicated
+    auto counts = sequentialCounts(0, numRecords, 12, classIds, m_model->getThreshold());
+    auto breaks = sequentialTrackBreaks(0, numRecords, 12, classIds);
+    std::vector<uint32_t> expected;
+    for (uint32_t k = 1; k < numRecords; k++)
+    {
+        bool changed = breaks[k] > 0;
+        for (auto& classCounts : counts)
+        {
+            changed |= (k + 1 < numRecords) && classCounts[k] != classCounts[k + 1];
+        }
+        if (changed)
+        {
+            expected.push_back(k);
+        }
+    }
+    std::vector<uint32_t> found;
+    for (uint32_t idx = m_model->nextPoi(0); idx < numRecords; idx = m_model->nextPoi(idx))
+    {
+        found.push_back(idx);
+    }
+    EXPECT_EQ (found, expected);
+}
+
+/**
+ * \brief Write n records, whose detections all have the same score
+ */
+static void writeUniformScores(TempRecordFile& file, uint64_t n, char score)
+{
+    file.remove();
+    for (uint64_t k = 0; k < n; k++)
+    {
+        auto example = makeRecord(k, 5);
+        example.set_scores(std::string(5, score));
+        file.append(example);
+    }
+}
+
+TEST_F (DataModelTest, ReusesSidecarsOfUnchangedFile)
+{
+    const uint64_t numRecords = 5000;
+    TempRecordFile file("sidecars.pb");
+    writeUniformScores(file, numRecords, 90);
+    m_model->open(file.path().string());
+    m_model->load();
+    ASSERT_TRUE (fs::exists(file.path().string() + ".idx"));
+    ASSERT_TRUE (fs::exists(file.path().string() + ".cols"));
+    auto counts = m_model->getNumDetections(0);
+    ASSERT_EQ (counts.size(), numRecords);
+    EXPECT_GT (counts[0], 0);
+
+    // same size and modification time, but no detection above the threshold: the sidecars are used
+    auto mtime = fs::last_write_time(file.path());
+    std::string idx = file.path().string() + ".idx";
+    std::string cols = file.path().string() + ".cols";
+    fs::rename(idx, idx + ".keep");
+    fs::rename(cols, cols + ".keep");
+    writeUniformScores(file, numRecords, 0);
+    fs::rename(idx + ".keep", idx);
+    fs::rename(cols + ".keep", cols);
+    fs::last_write_time(file.path(), mtime);
+    m_model->open(file.path().string());
+    m_model->load();
+    EXPECT_EQ (m_model->getNumDetections(0), counts);
+    // a threshold, that was not cached, is derived from the cached levels
+    ASSERT_TRUE (m_model->setThreshold(95));
+    EXPECT_EQ (m_model->getNumDetections(0), std::vector<int16_t>(numRecords, 0));
+    ASSERT_TRUE (m_model->setThreshold(10));
+
+    // a new modification time invalidates both sidecars
+    fs::last_write_time(file.path(), mtime + std::chrono::seconds(1));
+    m_model->open(file.path().string());
+    m_model->load();
+    EXPECT_EQ (m_model->getNumDetections(0), std::vector<int16_t>(numRecords, 0));
+
+    // as does a new size
+    writeUniformScores(file, numRecords, 90);
+    auto example = makeRecord(numRecords, 5);
+    example.set_scores(std::string(5, 90));
+    file.append(example);
+    fs::last_write_time(file.path(), mtime + std::chrono::seconds(1));
+    m_model->open(file.path().string());
+    m_model->load();
+    counts.push_back(counts.back());
+    EXPECT_EQ (m_model->getNumDetections(0), counts);
+}
+
+TEST_F (DataModelTest, OrdersShardsByFirstTimestamp)
+{
+    fs::path dir = fs::temp_directory_path() / "imageanalysis_test_shards";
+    fs::remove_all(dir);
+    fs::create_directory(dir);
+    {
+        // alphabetical order differs from the order in time
+        TempRecordFile a("shards/a.pb");
+        TempRecordFile b("shards/b.pb");
+        TempRecordFile c("shards/c.pb");
+        TempRecordFile other("shards/other.txt");
+        a.appendRecords(20000, 1000, 20);
+        b.appendRecords(0, 5000, 20);
+        c.appendRecords(10000, 3000, 20);
+        other.appendRecords(30000, 10, 20);
+
+        auto expected = sequentialCounts(0, 5000, 20, m_model->getClassIds(), m_model->getThreshold());
+        for (auto [first, n] : std::vector< std::pair<uint64_t, uint64_t> >{{10000, 3000}, {20000, 1000}})
+        {
+            auto shardCounts = sequentialCounts(first, n, 20, m_model->getClassIds(), m_model->getThreshold());
+            for (size_t i = 0; i < expected.size(); i++)
+            {
+                expected[i].insert(expected[i].end(), shardCounts[i].begin(), shardCounts[i].end());
+            }
+        }
+        for (std::string name : {dir.string(), (dir / "*.pb").string()})
+        {
+            m_model->open(name);
+            m_model->load();
+            ASSERT_EQ (m_model->getNumLoaded(), 9000u) << name;
+            for (size_t i = 0; i < expected.size(); i++)
+            {
+                EXPECT_EQ (m_model->getNumDetections(i), expected[i]) << name;
+            }
+            EXPECT_EQ (m_model->getItemByIdx(0), dir / "img_0.jpg");
+            EXPECT_EQ (m_model->getItemByIdx(5000), dir / "img_10000.jpg");
+            EXPECT_EQ (m_model->getItemByIdx(8999), dir / "img_20999.jpg");
+            // the first image of a shard has no predecessor
+            EXPECT_EQ (m_model->getTrackBreaks(5000, 5001), std::vector<uint8_t>{0});
+            EXPECT_EQ (m_model->getTrackBreaks(8000, 8001), std::vector<uint8_t>{0});
+        }
+        m_model->cancelLoad();
+    }
+    fs::remove_all(dir);
+}
+
+TEST_F (DataModelTest, FollowsAppendedRecords)
+{
+    TempRecordFile file("follow.pb");
+    file.appendRecords(0, 5000, 20);
+    m_model->open(file.path().string());
+    m_model->setFollowMode(true);
+    m_model->load();
+    ASSERT_EQ (m_model->getNumLoaded(), 5000u);
+
+    auto waitForImages = [this](uint32_t numImages) {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+        while (m_model->getNumLoaded() < numImages && std::chrono::steady_clock::now() < deadline)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        }
+    };
+    file.appendRecords(5000, 3000, 20);
+    waitForImages(8000);
+    expectCounts(0, 8000, 20);
+
+    // a record, that is still being written, is loaded once it is complete
+    std::string payload = makeRecord(8000, 7).SerializeAsString();
+    file.appendRaw(payload.substr(0, 10), payload.size());
+    std::this_thread::sleep_for(std::chrono::milliseconds(1200));
+    EXPECT_EQ (m_model->getNumLoaded(), 8000u);
+    file.appendBytes(payload.substr(10));
+    waitForImages(8001);
+    ASSERT_EQ (m_model->getNumLoaded(), 8001u);
+    m_model->setFollowMode(false);
+}
+
+TEST_F (DataModelTest, ChangesThresholdOnlyBetweenLoads)
+{
+    TempRecordFile file("threshold.pb");
+    file.appendRecords(0, 20000, 20);
+    m_model->open(file.path().string());
+    std::atomic<int> numCallbacks = 0;
+    std::atomic<int> numRefused = 0;
+    m_model->setLoadCallback([this, &numCallbacks, &numRefused](uint32_t, bool) {
+        numCallbacks++;
+        if ( !m_model->setThreshold(50) && !m_model->setFilter(FilterParams()) )
+        {
+            numRefused++;
+        }
+    });
+    m_model->load();
+    m_model->setLoadCallback(nullptr);
+    EXPECT_GT (numCallbacks, 0);
+    EXPECT_EQ (numRefused, numCallbacks);
+    EXPECT_EQ (m_model->getThreshold(), 10);
+    expectCounts(0, 20000, 20);
+
+    // the follow thread is stopped while the counts are replaced
+    m_model->setFollowMode(true);
+    // without new records, pausing it does not write the sidecars again
+    std::string cols = file.path().string() + ".cols";
+    auto colsTime = fs::last_write_time(cols);
+    ASSERT_TRUE (m_model->setThreshold(50));
+    ASSERT_TRUE (m_model->setThreshold(10));
+    EXPECT_EQ (fs::last_write_time(cols), colsTime);
+    std::thread writer([&file]() {
+        for (uint64_t first = 20000; first < 25000; first += 500)
+        {
+            file.appendRecords(first, 500, 20);
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        }
+    });
+    for (int k = 0; k < 20; k++)
+    {
+        ASSERT_TRUE (m_model->setThreshold((k % 2) ? 10 : 50));
+        std::this_thread::sleep_for(std::chrono::milliseconds(30));
+    }
+    writer.join();
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (m_model->getNumLoaded() < 25000 && std::chrono::steady_clock::now() < deadline)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+    ASSERT_TRUE (m_model->setThreshold(50));
+    expectCounts(0, 25000, 20);
+    m_model->setFollowMode(false);
+    ASSERT_TRUE (m_model->setThreshold(10));
+}
+
+TEST_F (DataModelTest, ResumesInterruptedFollowScan)
+{
+    TempRecordFile file("follow_resume.pb");
+    file.appendRecords(0, 1000, 20);
+    m_model->open(file.path().string());
+    m_model->setFollowMode(true);
+    m_model->load();
+    const uint32_t numRecords = 201000;
+    file.appendRecords(1000, numRecords - 1000, 20);
+    auto waitForImages = [this](uint32_t numImages) {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(30);
+        while (m_model->getNumLoaded() < numImages && std::chrono::steady_clock::now() < deadline)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    };
+    waitForImages(10000);
+    // the poll in progress stops at a block boundary instead of loading everything first
+    ASSERT_TRUE (m_model->setThreshold(50));
+    EXPECT_LT (m_model->getNumLoaded(), numRecords);
+    waitForImages(numRecords);
+    expectCounts(0, numRecords, 20);
+    m_model->setFollowMode(false);
+    ASSERT_TRUE (m_model->setThreshold(10));
+}
+
+TEST_F (DataModelTest, StopsAtCorruptSizeHeader)
+{
+    TempRecordFile file("corrupt_model.pb");
+    auto model = std::static_pointer_cast<Model>(m_model);
+    for (auto mode : {RecordReader::Mode::Mmap, RecordReader::Mode::Stream})
+    {
+        file.remove();
+        file.appendRecords(0, 4500, 20);
+        file.appendRaw("garbage", std::numeric_limits<uint64_t>::max() - 3);
+        file.appendRecords(4500, 10, 20);
+        model->setReaderMode(mode);
+        m_model->open(file.path().string());
+        m_model->load();
+        expectCounts(0, 4500, 20);
+    }
+    model->setReaderMode(RecordReader::Mode::Mmap);
+}
+
+TEST_F (DataModelTest, LocatesRecordsWhileLoading)
+{
+    fs::path dir = fs::temp_directory_path() / "imageanalysis_test_locate";
+    fs::remove_all(dir);
+    fs::create_directory(dir);
+    {
+        TempRecordFile a("locate/a.pb");
+        TempRecordFile b("locate/b.pb");
+        a.appendRecords(0, 6000, 10);
+        b.appendRecords(6000, 6000, 10);
+        m_model->open(dir.string());
+        m_model->load();
+        // with the offset indices of the first load, the shard table is published by open() and again by load()
+        m_model->open(dir.string());
+        std::thread loader([this]() { m_model->load(); });
+        for (int k = 0; k < 2000; k++)
+        {
+            uint64_t idx = (k * 7919) % 12000;
+            ASSERT_EQ (m_model->getItemByIdx(idx), dir / ("img_" + std::to_string(idx) + ".jpg"));
+        }
+        loader.join();
+        m_model->cancelLoad();
+    }
+    fs::remove_all(dir);
+}
@@ -0,0 +1,97 @@
+#include <iostream>
+#include <thread>
+#include <gtest/gtest.h>
+
+#include "data_vector.h"
+
+TEST (DataVectorTest, AppendsAcrossChunks)
+{
+    DataVector<int32_t, 8> column;
+    std::vector<int32_t> expected;
+    for (int32_t k = 0; k < 100; k++)
+    {
+        expected.push_back(k);
+    }
+    column.push_back(0);
+    column.append(expected.data() + 1, 20);
+    column.append(expected.data() + 21, 79);
+    ASSERT_EQ (column.size(), 100u);
+    EXPECT_EQ (column.toStdVector(), expected);
+    EXPECT_EQ (column.toStdVector(5, 30), std::vector<int32_t>(expected.begin() + 5, expected.begin() + 30));
+    // ranges are clamped to the published size
+    EXPECT_EQ (column.toStdVector(90, 200).size(), 10u);
+    EXPECT_TRUE (column.toStdVector(120, 200).empty());
+    EXPECT_EQ (column(42), 42);
+
+    size_t numSegments = 0;
+    int32_t next = 3;
+    column.forEachSegment(3, 20, [&](const int32_t* values, size_t n) {
+        for (size_t k = 0; k < n; k++)
+        {
+            EXPECT_EQ (values[k], next++);
+        }
+        numSegments++;
+    });
+    EXPECT_EQ (next, 20);
+    // [3, 8), [8, 16), [16, 20)
+    EXPECT_EQ (numSegments, 3u);
+}
+
+TEST (DataVectorTest, ViewKeepsColumnAlive)
+{
+    auto column = std::make_shared< DataVector<int8_t, 4> >();
+    for (int8_t k = 0; k < 10; k++)
+    {
+        column->push_back(k);
+    }
+    DataVectorView<int8_t, 4> view(column, 2, 20);
+    // the owner replaces the column, later appends are not visible either
+    column->push_back(10);
+    column = std::make_shared< DataVector<int8_t, 4> >();
+
+    ASSERT_EQ (view.size(), 8u);
+    EXPECT_EQ (view.first(), 2u);
+    EXPECT_EQ (view[0], 2);
+    EXPECT_EQ (view.toStdVector(), std::vector<int8_t>({2, 3, 4, 5, 6, 7, 8, 9}));
+    EXPECT_EQ (std::vector<int8_t>(view.begin(), view.end()), view.toStdVector());
+    std::vector<size_t> sizes;
+    view.forEachSegment([&sizes](const int8_t*, size_t n) { sizes.push_back(n); });
+    EXPECT_EQ (sizes, std::vector<size_t>({2, 4, 2}));
+    EXPECT_TRUE ((DataVectorView<int8_t, 4>().empty()));
+}
+
+TEST (DataVectorTest, ReadersSeeConsistentSnapshots)
+{
+    DataVector<uint32_t, 64> column;
+    const uint32_t numValues = 200000;
+    std::atomic<bool> failed = false;
+    std::thread reader([&]() {
+        size_t size = 0;
+        while (size < numValues)
+        {
+            size = column.size();
+            /* every published value has been written */
+            auto values = column.toStdVector(size > 100 ? size - 100 : 0, size);
+            for (size_t k = 0; k < values.size(); k++)
+            {
+                if (values[k] != size - values.size() + k)
+                {
+                    failed = true;
+                }
+            }
+        }
+    });
+    std::vector<uint32_t> batch;
+    for (uint32_t k = 0; k < numValues; )
+    {
+        batch.clear();
+        for (uint32_t n = 0; n < 1 + k % 37 && k < numValues; n++)
+        {
+            batch.push_back(k++);
+        }
+        column.append(batch.data(), batch.size());
+    }
+    reader.join();
+    EXPECT_FALSE (failed);
+    EXPECT_EQ (column.size(), numValues);
+}
@@ -0,0 +1,176 @@
+#include <iostream>
+#include <thread>
+#include <gtest/gtest.h>
+
+#include "encoded_column.h"
+
+TEST (EncodedColumnTest, RoundTripsAllWidths)
+{
+    EncodedColumn column;
+    std::vector<int16_t> expected;
+    // one block per width, offset from a varying base, the last one spans the whole range
+    for (uint32_t bits = 0; bits <= 16; bits++)
+    {
+        for (uint32_t k = 0; k < EncodedColumn::blockSize; k++)
+        {
+            uint32_t range = (1u << bits) - 1;
+            int32_t base = (bits == 16) ? -32768 : int32_t(bits) * 100 - 700;
+            expected.push_back(int16_t(base + ((k * 2654435761u) >> 7) % (range + 1)));
+        }
+        expected[expected.size() - 1] = int16_t(expected[expected.size() - EncodedColumn::blockSize] + (1u << bits) - 1);
+    }
+    // a partial block stays raw
+    for (int16_t k = 0; k < 100; k++)
+    {
+        expected.push_back(k * 300);
+    }
+    column.append(expected.data(), 1000);
+    column.append(expected.data() + 1000, expected.size() - 1000);
+
+    ASSERT_EQ (column.size(), expected.size());
+    EXPECT_EQ (column.toStdVector(), expected);
+    EXPECT_EQ (column.toStdVector(250, 700), std::vector<int16_t>(expected.begin() + 250, expected.begin() + 700));
+    for (size_t k = 0; k < expected.size(); k += 37)
+    {
+        EXPECT_EQ (column[k], expected[k]) << k;
+    }
+}
+
+TEST (EncodedColumnTest, DecodeKernelsMatchScalarReference)
+{
+    using namespace BitPackKernels;
+    for (uint32_t bits = 0; bits <= 16; bits++)
+    {
+        int16_t values[blockSize];
+        for (uint32_t k = 0; k < blockSize; k++)
+        {
+            values[k] = int16_t(-5 + ((k * 40503u) % (1u << bits)));
+        }
+        PackedRow rows[16];
+        encode(values, -5, bits, rows);
+        int16_t expected[blockSize];
+        decodeScalar(rows, bits, -5, expected);
+        ASSERT_TRUE (std::equal(values, values + blockSize, expected)) << " bits " << bits;
+        for (auto isa : {CpuDispatch::Isa::Sse42, CpuDispatch::Isa::Avx2, CpuDispatch::Isa::Avx512})
+        {
+            if (isa > CpuDispatch::detectIsa())
+            {
+                break;
+            }
+            int16_t out[blockSize];
+            decodeKernel(isa)(rows, bits, -5, out);
+            ASSERT_TRUE (std::equal(out, out + blockSize, expected)) << CpuDispatch::isaName(isa) << " bits " << bits;
+        }
+    }
+}
+
+TEST (EncodedColumnTest, SmallerThanInt8OnSparseCounts)
+{
+    EncodedColumn column;
+    const uint32_t numValues = 1 << 20;
+    for (uint32_t k = 0; k < numValues; k++)
+    {
+        // mostly zero with rare short events, one of them crowded
+        int16_t count = (k % 5000 < 40) ? int16_t(1 + k % 3) : 0;
+        column.push_back((k / 5000 == 7 && count > 0) ? 400 : count);
+    }
+    EXPECT_LT (column.memoryUsage(), numValues / 4);
+    EXPECT_EQ (column[7 * 5000 + 1], 400);
+    EXPECT_EQ (column[8 * 5000 + 1], 3);
+}
+
+TEST (EncodedColumnTest, ReadersSeeConsistentSnapshots)
+{
+    EncodedColumn column;
+    const uint32_t numValues = 100000;
+    auto valueAt = [](size_t k) { return int16_t((k % 1000 < 300) ? k % 200 : 0); };
+    std::atomic<bool> failed = false;
+    std::thread reader([&]() {
+        size_t size = 0;
+        while (size < numValues)
+        {
+            size = column.size();
+            /* includes the raw block, which may be encoded while it is read */
+            size_t from = size > 300 ? size - 300 : 0;
+            auto values = column.toStdVector(from, size);
+            for (size_t k = 0; k < values.size(); k++)
+            {
+                if (values[k] != valueAt(from + k))
+                {
+                    failed = true;
+                }
+            }
+        }
+    });
+    std::vector<int16_t> batch;
+    for (uint32_t k = 0; k < numValues; )
+    {
+        batch.clear();
+        for (uint32_t n = 0; n < 1 + k % 37 && k < numValues; n++)
+        {
+            batch.push_back(valueAt(k++));
+        }
+        column.append(batch.data(), batch.size());
+    }
+    reader.join();
+    EXPECT_FALSE (failed);
+    EXPECT_EQ (column.toStdVector().size(), numValues);
+}
+
+TEST (EncodedColumnTest, StoredBlocksRoundTrip)
+{
+    EncodedColumn column;
+    std::vector<int16_t> expected;
+    for (uint32_t k = 0; k < 20 * EncodedColumn::blockSize + 77; k++)
+    {
+        expected.push_back(int16_t((k / 700) % 2 ? (k * 37) % 1000 - 500 : k % 3));
+    }
+    column.append(expected.data(), expected.size());
+    auto store = [&column](size_t from, size_t to) {
+        std::string data;
+        column.write(from, to, [&data](const void* p, size_t n) { data.append(static_cast<const char*>(p), n); });
+        return data;
+    };
+
+    // from the start of a block, at the end of a block and behind a partial block
+    for (size_t from : {size_t(0), size_t(3 * EncodedColumn::blockSize), size_t(1000)})
+    {
+        std::string data = store(from, expected.size());
+        uint64_t numValues = 0;
+        ASSERT_TRUE (EncodedColumn::checkStored(data.data(), data.size(), numValues));
+        EXPECT_EQ (numValues, expected.size() - from);
+        for (size_t prefix : {size_t(0), size_t(EncodedColumn::blockSize), size_t(100)})
+        {
+            EncodedColumn copy;
+            copy.append(expected.data(), prefix);
+            ASSERT_TRUE (copy.appendStored(data.data(), data.size()));
+            std::vector<int16_t> values(expected.begin(), expected.begin() + prefix);
+            values.insert(values.end(), expected.begin() + from, expected.end());
+            EXPECT_EQ (copy.toStdVector(), values) << from << " " << prefix;
+            // the summaries of the blocks are taken over
+            MinMax range;
+            for (int16_t value : values)
+            {
+                range.add(value);
+            }
+            EXPECT_EQ (copy.minMax(0, copy.size()), range);
+            copy.push_back(7);
+            EXPECT_EQ (copy[values.size()], 7);
+        }
+    }
+    // encoded blocks are written as they are
+    std::string data = store(0, expected.size());
+    EXPECT_LT (data.size(), expected.size() * sizeof(int16_t) * 3 / 4);
+
+    // corrupt headers and truncated data are rejected without appending
+    EncodedColumn copy;
+    uint64_t numValues = 0;
+    EXPECT_FALSE (copy.appendStored(data.data(), data.size() - 1));
+    std::string corrupt = data;
+    corrupt[0] ^= 1;
+    EXPECT_FALSE (copy.appendStored(corrupt.data(), corrupt.size()));
+    corrupt = data;
+    corrupt[sizeof(uint64_t)] = char(0xff);
+    EXPECT_FALSE (EncodedColumn::checkStored(corrupt.data(), corrupt.size(), numValues));
+    EXPECT_EQ (copy.size(), 0u);
+}
@@ -0,0 +1,106 @@
+#include <iostream>
+#include <gtest/gtest.h>
+
+#include "event_segmenter.h"
+
+static std::vector<Segment> segment(const std::vector<int16_t>& counts, const SegmentParams& params)
+{
+    return EventSegmenter::segment(counts.data(), counts.size(), params);
+}
+
+TEST (EventSegmenterTest, Hysteresis)
+{
+    //                                0  1  2  3  4  5  6  7  8  9 10 11
+    const std::vector<int16_t> counts{0, 1, 2, 3, 1, 2, 3, 0, 0, 2, 1, 0};
+    SegmentParams params;
+    params.enter = 2;
+    params.exit = 2;
+    EXPECT_EQ (segment(counts, params), (std::vector<Segment>{{2, 4}, {5, 7}, {9, 10}}));
+    // staying above exit keeps the event open
+    params.exit = 1;
+    EXPECT_EQ (segment(counts, params), (std::vector<Segment>{{2, 7}, {9, 11}}));
+    // exit is clamped to enter
+    params.enter = 3;
+    params.exit = 5;
+    EXPECT_EQ (segment(counts, params), (std::vector<Segment>{{3, 4}, {6, 7}}));
+    // crowded scenes beyond the range of int8_t
+    const std::vector<int16_t> crowded{0, 200, 130, 300, 90, 127};
+    params.enter = 150;
+    params.exit = 128;
+    EXPECT_EQ (segment(crowded, params), (std::vector<Segment>{{1, 4}}));
+}
+
+TEST (EventSegmenterTest, MergesGapsAndDropsShortEvents)
+{
+    //                                0  1  2  3  4  5  6  7  8  9 10 11 12
+    const std::vector<int16_t> counts{1, 1, 0, 1, 0, 0, 0, 1, 0, 0, 0, 0, 1};
+    SegmentParams params;
+    params.maxGap = 1;
+    EXPECT_EQ (segment(counts, params), (std::vector<Segment>{{0, 4}, {7, 8}, {12, 13}}));
+    params.maxGap = 3;
+    EXPECT_EQ (segment(counts, params), (std::vector<Segment>{{0, 8}, {12, 13}}));
+    params.minLength = 2;
+    EXPECT_EQ (segment(counts, params), (std::vector<Segment>{{0, 8}}));
+    // an event reaching the last image is pending, but already reported
+    params.minLength = 1;
+    EventSegmenter segmenter(params);
+    segmenter.append(counts.data(), counts.size());
+    EXPECT_EQ (segmenter.segments(), (std::vector<Segment>{{0, 8}}));
+    Segment pending;
+    ASSERT_TRUE (segmenter.pending(pending));
+    EXPECT_EQ (pending, (Segment{12, 13}));
+}
+
+TEST (EventSegmenterTest, IncrementalMatchesWholeColumn)
+{
+    std::vector<int16_t> counts;
+    for (uint32_t k = 0; k < 20000; k++)
+    {
+        counts.push_back(int16_t((k * k / 13 + k / 700) % 5) - 1);
+    }
+    SegmentParams params;
+    params.enter = 2;
+    params.exit = 1;
+    params.minLength = 3;
+    params.maxGap = 2;
+    auto expected = segment(counts, params);
+    ASSERT_FALSE (expected.empty());
+    // pieces not aligned to the blocks and words of the masks
+    EventSegmenter segmenter(params);
+    for (uint32_t from = 0; from < counts.size(); from += 777)
+    {
+        uint32_t n = std::min<uint32_t>(777, counts.size() - from);
+        segmenter.append(counts.data() + from, n);
+    }
+    EXPECT_EQ (segmenter.numFrames(), counts.size());
+    EXPECT_EQ (segmenter.allSegments(), expected);
+
+    segmenter.reset();
+    EXPECT_TRUE (segmenter.allSegments().empty());
+}
+
+TEST (EventSegmenterTest, FindsBoundaries)
+{
+    //                                0  1  2  3  4  5  6  7  8  9
+    const std::vector<int16_t> counts{0, 1, 1, 1, 0, 1, 0, 0, 1, 1};
+    EventSegmenter segmenter;
+    segmenter.append(counts.data(), counts.size());
+    // the last event is pending
+    ASSERT_EQ (segmenter.segments().size(), 2u);
+    std::vector<uint32_t> expectedNext{1, 3, 3, 5, 5, 8, 8, 8, 9};
+    for (uint32_t idx = 0; idx < expectedNext.size(); idx++)
+    {
+        uint32_t boundary = 0;
+        ASSERT_TRUE (segmenter.nextBoundary(idx, boundary)) << idx;
+        EXPECT_EQ (boundary, expectedNext[idx]) << idx;
+    }
+    uint32_t boundary = 0;
+    EXPECT_FALSE (segmenter.nextBoundary(9, boundary));
+    std::vector<uint32_t> expectedPrev{0, 1, 1, 3, 3, 5, 5, 5, 8, 9};
+    EXPECT_FALSE (segmenter.prevBoundary(1, boundary));
+    for (uint32_t idx = 2; idx < expectedPrev.size(); idx++)
+    {
+        ASSERT_TRUE (segmenter.prevBoundary(idx, boundary)) << idx;
+        EXPECT_EQ (boundary, expectedPrev[idx - 1]) << idx;
+    }
+}
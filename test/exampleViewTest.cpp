@@ -0,0 +1,93 @@
+#include <iostream>
+#include <gtest/gtest.h>
+
+#include "example_view.h"
+#include "detection_results_v2.pb.h"
+
+#define NUM_DETS 9
+
+static std::string serializedExample()
+{
+    object_detection::Example example;
+    example.set_filename("img_0042.jpg");
+    example.set_timestamp(1234567890123ull);
+    example.set_num_detections(NUM_DETS);
+    const char scores[NUM_DETS]  = {80, 40, 80, 0, 20, 10, 5, 0, 60 };
+    const char classes[NUM_DETS] = { 2,  1,  2, 1,  1,  1, 2, 2,  2 };
+    example.set_scores(std::string(scores, sizeof(scores)));
+    example.set_classes(std::string(classes, sizeof(classes)));
+    for (int k = 0; k < 3; k++)
+    {
+        auto* box = example.add_boxes();
+        box->set_xmin(0.1f * k);
+        box->set_xmax(0.1f * k + 0.2f);
+    }
+    return example.SerializeAsString();
+}
+
+TEST (ExampleViewTest, DecodesAllFields)
+{
+    std::string data = serializedExample();
+    object_detection::Example example;
+    ASSERT_TRUE (example.ParseFromString(data));
+
+    ExampleView view;
+    ASSERT_TRUE (view.parse(data.data(), data.size()));
+    ASSERT_EQ (view.filename(), example.filename());
+    ASSERT_EQ (view.timestamp(), example.timestamp());
+    ASSERT_EQ (view.num_detections(), example.num_detections());
+    ASSERT_EQ (view.scores(), example.scores());
+    ASSERT_EQ (view.classes(), example.classes());
+    // views point into the serialized buffer
+    ASSERT_GE (view.scores().data(), data.data());
+    ASSERT_LT (view.scores().data(), data.data() + data.size());
+}
+
+TEST (ExampleViewTest, DecodesSelectedFieldsOnly)
+{
+    std::string data = serializedExample();
+    ExampleView view;
+    ASSERT_TRUE (view.parse(data.data(), data.size(), ExampleView::NUM_DETECTIONS | ExampleView::CLASSES));
+    ASSERT_EQ (view.num_detections(), NUM_DETS);
+    ASSERT_EQ (view.classes().size(), NUM_DETS);
+    ASSERT_TRUE (view.filename().empty());
+    ASSERT_TRUE (view.scores().empty());
+    ASSERT_EQ (view.timestamp(), 0);
+}
+
+TEST (ExampleViewTest, DecodesBoxes)
+{
+    std::string data = serializedExample();
+    object_detection::Example example;
+    ASSERT_TRUE (example.ParseFromString(data));
+
+    ExampleView view;
+    ASSERT_TRUE (view.parse(data.data(), data.size(), ExampleView::BOXES));
+    ExampleView::BoxReader reader = view.boxes();
+    float xmin, xmax, ymin, ymax;
+    for (int k = 0; k < example.boxes_size(); k++)
+    {
+        ASSERT_TRUE (reader.next());
+        // zero coordinates are omitted on the wire
+        ASSERT_TRUE (reader.decode(xmin, xmax, ymin, ymax));
+        ASSERT_EQ (xmin, example.boxes(k).xmin());
+        ASSERT_EQ (xmax, example.boxes(k).xmax());
+        ASSERT_EQ (ymin, example.boxes(k).ymin());
+        ASSERT_EQ (ymax, example.boxes(k).ymax());
+    }
+    ASSERT_FALSE (reader.next());
+
+    // boxes are not decoded unless requested
+    ASSERT_TRUE (view.parse(data.data(), data.size(), ExampleView::SCORES));
+    ASSERT_FALSE (view.boxes().next());
+}
+
+TEST (ExampleViewTest, RejectsTruncatedMessage)
+{
+    std::string data = serializedExample();
+    ExampleView view;
+    for (size_t n : {size_t(1), size_t(5), data.size() - 1})
+    {
+        ASSERT_FALSE (view.parse(data.data(), n));
+    }
+}
@@ -0,0 +1,125 @@
+#include <iostream>
+#include <gtest/gtest.h>
+
+#include "eval_ground_truth.h"
+
+typedef EvalGroundTruth::UParser Example;
+typedef EvalGroundTruth::UGroundTruth::Frame Frame;
+
+struct TestBox
+{
+    float xmin, xmax, ymin, ymax;
+    char cls;
+    char score;
+};
+
+static Example makeExample(const std::vector<TestBox>& boxes)
+{
+    Example example;
+    std::string scores, classes;
+    for (auto& b : boxes)
+    {
+        auto* box = example.add_boxes();
+        box->set_xmin(b.xmin);
+        box->set_xmax(b.xmax);
+        box->set_ymin(b.ymin);
+        box->set_ymax(b.ymax);
+        scores.push_back(b.score);
+        classes.push_back(b.cls);
+    }
+    example.set_num_detections(boxes.size());
+    example.set_scores(scores);
+    example.set_classes(classes);
+    return example;
+}
+
+static Frame makeFrame(const std::vector<TestBox>& boxes)
+{
+    Frame frame;
+    for (auto& b : boxes)
+    {
+        auto* object = frame.add_objects();
+        object->set_class_id(b.cls);
+        object->set_xmin(b.xmin);
+        object->set_xmax(b.xmax);
+        object->set_ymin(b.ymin);
+        object->set_ymax(b.ymax);
+    }
+    return frame;
+}
+
+TEST (EvalGroundTruthTest, PerfectDetector)
+{
+    const std::vector<int> class_ids{1, 2};
+    const TestBox a{0.1f, 0.3f, 0.1f, 0.3f, 1, 90};
+    const TestBox b{0.5f, 0.7f, 0.5f, 0.7f, 2, 60};
+
+    EvalGroundTruth::Counts counts(class_ids.size());
+    EvalGroundTruth::matchDetections(makeExample({a, b}), makeFrame({a, b}), class_ids, counts);
+    EvalGroundTruth::matchDetections(makeExample({a}), makeFrame({a}), class_ids, counts);
+    auto result = EvalGroundTruth::summarize(counts, class_ids);
+
+    EXPECT_EQ(result.numImages, 2u);
+    ASSERT_EQ(result.curves.size(), 2u);
+    EXPECT_EQ(result.curves[0].numObjects, 2u);
+    EXPECT_EQ(result.curves[1].numObjects, 1u);
+    EXPECT_DOUBLE_EQ(result.curves[0].averagePrecision, 1.0);
+    EXPECT_DOUBLE_EQ(result.curves[1].averagePrecision, 1.0);
+    EXPECT_DOUBLE_EQ(result.meanAveragePrecision, 1.0);
+    // b is lost above its score
+    EXPECT_DOUBLE_EQ(result.curves[1].recall[59], 1.0);
+    EXPECT_DOUBLE_EQ(result.curves[1].recall[60], 0.0);
+}
+
+TEST (EvalGroundTruthTest, MatchesGreedilyByScore)
+{
+    const std::vector<int> class_ids{1};
+    const TestBox object{0.1f, 0.3f, 0.1f, 0.3f, 1, 0};
+    // both overlap the object, the stronger one takes it even though the weaker one fits better
+    const TestBox strong{0.12f, 0.32f, 0.1f, 0.3f, 1, 80};
+    const TestBox weak{0.1f, 0.3f, 0.1f, 0.3f, 1, 40};
+    // misses the object, and another class
+    const TestBox miss{0.6f, 0.8f, 0.6f, 0.8f, 1, 70};
+    const TestBox other{0.1f, 0.3f, 0.1f, 0.3f, 2, 90};
+
+    EvalGroundTruth::Counts counts(class_ids.size());
+    EvalGroundTruth::matchDetections(makeExample({weak, miss, strong, other}), makeFrame({object}), class_ids, counts);
+
+    EXPECT_EQ(counts.numObjects[0], 1u);
+    EXPECT_EQ(counts.truePositives[80], 1u);
+    EXPECT_EQ(counts.falsePositives[70], 1u);
+    EXPECT_EQ(counts.falsePositives[40], 1u);
+    EXPECT_EQ(std::accumulate(counts.truePositives.begin(), counts.truePositives.end(), uint64_t(0)), 1u);
+    EXPECT_EQ(std::accumulate(counts.falsePositives.begin(), counts.falsePositives.end(), uint64_t(0)), 2u);
+}
+
+TEST (EvalGroundTruthTest, PrecisionRecallOverThresholds)
+{
+    const std::vector<int> class_ids{1};
+    const TestBox a{0.1f, 0.3f, 0.1f, 0.3f, 1, 90};
+    const TestBox b{0.5f, 0.7f, 0.5f, 0.7f, 1, 30};
+    const TestBox miss{0.6f, 0.8f, 0.1f, 0.3f, 1, 50};
+
+    EvalGroundTruth::Counts counts(class_ids.size());
+    EvalGroundTruth::matchDetections(makeExample({a, miss, b}), makeFrame({a, b}), class_ids, counts);
+    // counts of separate ranges of images add up
+    EvalGroundTruth::Counts more(class_ids.size());
+    EvalGroundTruth::matchDetections(makeExample({}), makeFrame({a}), class_ids, more);
+    counts += more;
+    auto curve = EvalGroundTruth::summarize(counts, class_ids).curves[0];
+
+    ASSERT_EQ(curve.numObjects, 3u);
+    // above 90: nothing detected
+    EXPECT_DOUBLE_EQ(curve.precision[90], 1.0);
+    EXPECT_DOUBLE_EQ(curve.recall[90], 0.0);
+    // a
+    EXPECT_DOUBLE_EQ(curve.precision[50], 1.0);
+    EXPECT_DOUBLE_EQ(curve.recall[50], 1.0 / 3);
+    // a, miss
+    EXPECT_DOUBLE_EQ(curve.precision[30], 0.5);
+    EXPECT_DOUBLE_EQ(curve.recall[30], 1.0 / 3);
+    // a, miss, b
+    EXPECT_DOUBLE_EQ(curve.precision[0], 2.0 / 3);
+    EXPECT_DOUBLE_EQ(curve.recall[0], 2.0 / 3);
+    EXPECT_DOUBLE_EQ(curve.averagePrecision, 1.0 / 3 + 1.0 / 3 * 2.0 / 3);
+}
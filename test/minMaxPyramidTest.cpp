@@ -0,0 +1,79 @@
+#include <iostream>
+#include <random>
+#include <gtest/gtest.h>
+
+#include "min_max_pyramid.h"
+#include "encoded_column.h"
+
+static MinMax bruteForce(const std::vector<int16_t>& values, size_t from, size_t to)
+{
+    MinMax result;
+    for (size_t k = from; k < std::min(to, values.size()); k++)
+    {
+        result.add(values[k]);
+    }
+    return result;
+}
+
+TEST (MinMaxPyramidTest, RangesMatchBruteForce)
+{
+    MinMaxPyramid pyramid;
+    std::vector<int16_t> leaves;
+    std::mt19937 rng(7);
+    // spans several levels, the last entries of each level are incomplete
+    const size_t numLeaves = 5 * 16 * 16 * 16 + 7 * 16 + 3;
+    for (size_t k = 0; k < numLeaves; k++)
+    {
+        int16_t value = int16_t(rng() % 2000) - 1000;
+        leaves.push_back(value);
+        pyramid.push_back({value, value});
+    }
+    ASSERT_EQ (pyramid.size(), numLeaves);
+    EXPECT_TRUE (pyramid.range(10, 10).empty());
+    EXPECT_EQ (pyramid.range(0, numLeaves + 100), bruteForce(leaves, 0, numLeaves));
+    for (int k = 0; k < 2000; k++)
+    {
+        size_t from = rng() % numLeaves;
+        size_t to = from + rng() % (numLeaves - from + 1);
+        MinMax expected = bruteForce(leaves, from, to);
+        MinMax found = pyramid.range(from, to);
+        ASSERT_EQ (found, expected) << from << " " << to;
+    }
+}
+
+TEST (MinMaxPyramidTest, ColumnEnvelope)
+{
+    auto column = std::make_shared<EncodedColumn>();
+    std::vector<int16_t> values;
+    // mostly zero, a few events, and a raw block at the end
+    for (size_t k = 0; k < 300 * EncodedColumn::blockSize + 100; k++)
+    {
+        int16_t count = (k % 7000 < 50) ? int16_t(k % 13) : 0;
+        values.push_back((k == 40000) ? -3 : count);
+    }
+    column->append(values.data(), values.size());
+
+    for (auto [from, to] : std::vector< std::pair<size_t, size_t> >{{0, values.size()}, {1, 255}, {250, 300},
+                                                                     {39000, 76900}, {76700, values.size()}})
+    {
+        EXPECT_EQ (column->minMax(from, to), bruteForce(values, from, to)) << from << " " << to;
+    }
+
+    ColumnView<EncodedColumn> view(column, 1000, values.size());
+    auto bins = view.envelope(500);
+    ASSERT_EQ (bins.size(), 500u);
+    size_t from = 1000;
+    for (size_t b = 0; b < bins.size(); b++)
+    {
+        size_t to = 1000 + view.size() * (b + 1) / bins.size();
+        EXPECT_EQ (bins[b], bruteForce(values, from, to)) << b;
+        from = to;
+    }
+    EXPECT_EQ (from, values.size());
+
+    // a short view yields a bin per value
+    auto values10 = ColumnView<EncodedColumn>(column, 40000, 40010).envelope(500);
+    ASSERT_EQ (values10.size(), 10u);
+    EXPECT_EQ (values10[0].min, -3);
+    EXPECT_EQ (values10[0].max, -3);
+}
@@ -0,0 +1,211 @@
+#include <iostream>
+#include <fstream>
+#include <limits>
+#include <thread>
+#include <gtest/gtest.h>
+
+#include "record_reader.h"
+#include "record_shard.h"
+#include "tempRecordFile.h"
+
+TEST (RecordFileTest, IndexesAllRecords)
+{
+    TempRecordFile file("index.pb");
+    for (uint64_t k = 0; k < 10; k++)
+    {
+        file.append(makeRecord(1000 + k));
+    }
+    for (auto mode : {RecordReader::Mode::Mmap, RecordReader::Mode::Stream})
+    {
+        RecordShard shard;
+        ASSERT_TRUE (shard.open(file.path(), mode));
+        EXPECT_EQ (shard.indexRecords(), 10u);
+        EXPECT_EQ (shard.indexedSize(), fs::file_size(file.path()));
+        uint64_t timestamp = 0;
+        ASSERT_TRUE (shard.firstTimestamp(timestamp));
+        EXPECT_EQ (timestamp, 1000u);
+    }
+}
+
+TEST (RecordFileTest, StopsAtTruncatedRecord)
+{
+    TempRecordFile file("truncated.pb");
+    file.append(makeRecord(1));
+    file.append(makeRecord(2));
+    std::string payload = makeRecord(3).SerializeAsString();
+    // the writer has not finished the last record yet
+    file.appendRaw(payload.substr(0, payload.size() / 2), payload.size());
+    for (auto mode : {RecordReader::Mode::Mmap, RecordReader::Mode::Stream})
+    {
+        RecordShard shard;
+        ASSERT_TRUE (shard.open(file.path(), mode));
+        EXPECT_EQ (shard.indexRecords(), 2u);
+        std::vector<char> buffer;
+        uint64_t record_size = 0;
+        EXPECT_NE (shard.readRecord(1, buffer, record_size), nullptr);
+        EXPECT_EQ (shard.readRecord(2, buffer, record_size), nullptr);
+        EXPECT_EQ (shard.readRecord(3, buffer, record_size), nullptr);
+    }
+}
+
+TEST (RecordFileTest, RejectsCorruptSizeHeader)
+{
+    TempRecordFile file("corrupt.pb");
+    // sizes, that would wrap around the end of the address range or exceed the file
+    const uint64_t sizes[] = { std::numeric_limits<uint64_t>::max(),
+                               std::numeric_limits<uint64_t>::max() - RecordReader::HEADER_BYTES,
+                               uint64_t(1) << 40 };
+    for (uint64_t record_size : sizes)
+    {
+        fs::remove(file.path());
+        file.append(makeRecord(1));
+        file.appendRaw("garbage", record_size);
+        file.append(makeRecord(3));
+        for (auto mode : {RecordReader::Mode::Mmap, RecordReader::Mode::Stream})
+        {
+            RecordShard shard;
+            ASSERT_TRUE (shard.open(file.path(), mode));
+            EXPECT_EQ (shard.indexRecords(), 1u) << record_size;
+            std::vector<char> buffer;
+            uint64_t size = 0;
+            EXPECT_EQ (shard.readRecord(1, buffer, size), nullptr) << record_size;
+            EXPECT_EQ (shard.readRecord(2, buffer, size), nullptr) << record_size;
+            // nothing is allocated for the corrupt size
+            EXPECT_LT (buffer.capacity(), 1024u) << record_size;
+        }
+    }
+}
+
+TEST (RecordFileTest, ReadChecksBoundsBeforeAllocating)
+{
+    TempRecordFile file("bounds.pb");
+    file.append(makeRecord(1));
+    uint64_t fileSize = fs::file_size(file.path());
+    for (auto mode : {RecordReader::Mode::Mmap, RecordReader::Mode::Stream})
+    {
+        RecordReader reader;
+        ASSERT_TRUE (reader.open(file.path(), mode));
+        std::vector<char> buffer;
+        EXPECT_EQ (reader.read(0, uint64_t(1) << 40, buffer), nullptr);
+        EXPECT_EQ (reader.read(fileSize, 1, buffer), nullptr);
+        EXPECT_EQ (reader.read(std::numeric_limits<uint64_t>::max(), 2, buffer), nullptr);
+        EXPECT_TRUE (buffer.empty());
+        EXPECT_NE (reader.read(0, fileSize, buffer), nullptr);
+    }
+}
+
+TEST (RecordFileTest, OffsetIndexSidecar)
+{
+    TempRecordFile file("sidecar.pb");
+    for (uint64_t k = 0; k < 100; k++)
+    {
+        file.append(makeRecord(k));
+    }
+    fs::path sidecar = OffsetIndex::sidecarPath(file.path());
+    FileStamp stamp;
+    ASSERT_TRUE (FileStamp::fromFile(file.path(), stamp));
+    std::vector<uint64_t> expected;
+    {
+        RecordShard shard;
+        ASSERT_TRUE (shard.open(file.path(), RecordReader::Mode::Mmap));
+        EXPECT_FALSE (shard.offsets().isMapped());
+        ASSERT_EQ (shard.indexRecords(), 100u);
+        for (uint64_t k = 0; k < 100; k++)
+        {
+            uint64_t off = 0;
+            ASSERT_TRUE (shard.offsets().lookup(k, off));
+            expected.push_back(off);
+        }
+        shard.saveIndex();
+    }
+
+    OffsetIndex index;
+    ASSERT_TRUE (index.load(sidecar, stamp));
+    ASSERT_EQ (index.size(), 100u);
+    // records appended later are added behind the mapped part
+    index.push_back(12345);
+    for (uint64_t k = 0; k < 100; k++)
+    {
+        uint64_t off = 0;
+        ASSERT_TRUE (index.lookup(k, off));
+        EXPECT_EQ (off, expected[k]);
+    }
+    uint64_t off = 0;
+    EXPECT_TRUE (index.lookup(100, off));
+    EXPECT_EQ (off, 12345u);
+    EXPECT_FALSE (index.lookup(101, off));
+
+    // a different version of the record file
+    FileStamp grown = stamp;
+    grown.size++;
+    EXPECT_FALSE (index.load(sidecar, grown));
+    EXPECT_EQ (index.size(), 0u);
+    FileStamp touched = stamp;
+    touched.mtime++;
+    EXPECT_FALSE (index.load(sidecar, touched));
+}
+
+TEST (RecordFileTest, OffsetIndexConcurrentLookup)
+{
+    OffsetIndex index;
+    const uint64_t numOffsets = 200000;
+    std::atomic<bool> mismatch = false;
+    std::thread reader([&]() {
+        uint64_t size = 0;
+        while (size < numOffsets)
+        {
+            size = index.size();
+            uint64_t off = 0;
+            // everything below the published size is readable and complete
+            if ( size > 0 && (!index.lookup(size - 1, off) || off != 3 * (size - 1)) )
+            {
+                mismatch = true;
+            }
+        }
+    });
+    for (uint64_t k = 0; k < numOffsets; k++)
+    {
+        index.push_back(3 * k);
+    }
+    reader.join();
+    EXPECT_FALSE (mismatch);
+}
+
+TEST (RecordFileTest, GrowingFileKeepsPointersValid)
+{
+    TempRecordFile file("growing.pb");
+    file.appendRecords(0, 10, 5);
+    RecordShard shard;
+    ASSERT_TRUE (shard.open(file.path(), RecordReader::Mode::Mmap));
+    ASSERT_TRUE (shard.reader().isMapped());
+    ASSERT_EQ (shard.indexRecords(), 10u);
+    std::vector<char> buffer;
+    uint64_t record_size = 0;
+    const char* first = shard.readRecord(0, buffer, record_size);
+    ASSERT_NE (first, nullptr);
+    std::string firstPayload(first, record_size);
+
+    // many small appends, crossing page boundaries and the initial reservation
+    uint64_t numRecords = 10;
+    for (int k = 0; k < 200; k++)
+    {
+        uint64_t n = (k < 150) ? 3 : 200;
+        file.appendRecords(numRecords, n, 40);
+        numRecords += n;
+        ASSERT_TRUE (shard.reader().refresh());
+        ASSERT_EQ (shard.reader().size(), fs::file_size(file.path()));
+        ASSERT_EQ (shard.indexRecords(), n);
+        // pointers taken before stay valid
+        ASSERT_EQ (std::string(first, firstPayload.size()), firstPayload);
+    }
+    ASSERT_GT (fs::file_size(file.path()), uint64_t(1) << 22);
+    EXPECT_FALSE (shard.reader().refresh());
+    for (uint64_t idx : {uint64_t(0), uint64_t(11), uint64_t(500), numRecords / 2, numRecords - 1})
+    {
+        const char* payload = shard.readRecord(idx, buffer, record_size);
+        ASSERT_NE (payload, nullptr);
+        ExampleView view;
+        ASSERT_TRUE (view.parse(payload, record_size, ExampleView::TIMESTAMP));
+        EXPECT_EQ (view.timestamp(), idx);
+    }
+}
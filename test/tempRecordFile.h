@@ -0,0 +1,127 @@
+#ifndef TEMP_RECORD_FILE_H_
+#define TEMP_RECORD_FILE_H_
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <filesystem>
+
+#include "record_reader.h"
+#include "detection_results_v2.pb.h"
+
+namespace fs = std::filesystem;
+
+/**
+ * \brief Record with numDetections detections of classes 1 to 3, derived from timestamp
+ */
+static inline object_detection::Example makeRecord(uint64_t timestamp, uint32_t numDetections = 0)
+{
+    object_detection::Example example;
+    example.set_filename("img_" + std::to_string(timestamp) + ".jpg");
+    example.set_timestamp(timestamp);
+    example.set_num_detections(numDetections);
+    std::string scores, classes;
+    for (uint32_t k = 0; k < numDetections; k++)
+    {
+        scores.push_back(char((timestamp * 7 + k * 13) % 101));
+        classes.push_back(char(1 + (timestamp / 3 + k) % 3));
+        /* the boxes move every few images, which causes track breaks */
+        auto* box = example.add_boxes();
+        float shift = 0.05f * ((timestamp / 5) % 4);
+        box->set_xmin(0.1f * (k % 8) + shift);
+        box->set_xmax(0.1f * (k % 8) + shift + 0.08f);
+        box->set_ymin(0.2f);
+        box->set_ymax(0.4f);
+    }
+    example.set_scores(scores);
+    example.set_classes(classes);
+    return example;
+}
+
+/**
+ * \brief Record file in the temp directory, removed together with its sidecars
+ */
+class TempRecordFile
+{
+    public:
+        explicit TempRecordFile(const std::string& name)
+            : m_path(fs::temp_directory_path() / ("imageanalysis_test_" + name))
+        {
+            remove();
+        }
+
+        ~TempRecordFile()
+        {
+            remove();
+        }
+
+        const fs::path& path() const
+        {
+            return m_path;
+        }
+
+        /**
+         * \brief Append a record with the raw size header value record_size
+         */
+        void appendRaw(const std::string& payload, uint64_t record_size)
+        {
+            std::ofstream f(m_path, std::ios::binary | std::ios::app);
+            writeRecord(f, payload, record_size);
+        }
+
+        void append(const object_detection::Example& example)
+        {
+            std::string payload = example.SerializeAsString();
+            appendRaw(payload, payload.size());
+        }
+
+        /**
+         * \brief Append raw bytes, e.g. the rest of a record written partially before
+         */
+        void appendBytes(const std::string& bytes)
+        {
+            std::ofstream f(m_path, std::ios::binary | std::ios::app);
+            f.write(bytes.data(), bytes.size());
+        }
+
+        /**
+         * \brief Append n records with the timestamps [first, first + n) and up to
+         *        maxDetections detections each
+         */
+        void appendRecords(uint64_t first, uint64_t n, uint32_t maxDetections)
+        {
+            std::ofstream f(m_path, std::ios::binary | std::ios::app);
+            for (uint64_t timestamp = first; timestamp < first + n; timestamp++)
+            {
+                std::string payload = makeRecord(timestamp, (timestamp * 31) % (maxDetections + 1)).SerializeAsString();
+                writeRecord(f, payload, payload.size());
+            }
+        }
+
+        /**
+         * \brief Remove the record file and its sidecars
+         */
+        void remove()
+        {
+            std::error_code ec;
+            for (const char* suffix : {"", ".idx", ".cols"})
+            {
+                fs::remove(m_path.string() + suffix, ec);
+            }
+        }
+
+    private:
+        static void writeRecord(std::ofstream& f, const std::string& payload, uint64_t record_size)
+        {
+            char header[RecordReader::HEADER_BYTES];
+            header[0] = 0x09;
+            memcpy(header + RecordReader::FIELD_DESCR, &record_size, RecordReader::SIZE_BYTES);
+            f.write(header, sizeof(header));
+            f.write(payload.data(), payload.size());
+        }
+
+        fs::path m_path;
+};
+
+#endif /* TEMP_RECORD_FILE_H_ */
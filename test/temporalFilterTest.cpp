@@ -0,0 +1,93 @@
+#include <iostream>
+#include <gtest/gtest.h>
+
+#include "temporal_filter.h"
+
+static std::vector<int16_t> filter(const std::vector<int16_t>& counts, const FilterParams& params)
+{
+    std::vector<int16_t> out(counts.size());
+    TemporalFilter(params).apply(counts.data(), counts.size(), out.data());
+    return out;
+}
+
+static FilterParams makeParams(FilterParams::Type type, uint32_t window, float alpha = 0.25f)
+{
+    FilterParams params;
+    params.type = type;
+    params.window = window;
+    params.alpha = alpha;
+    return params;
+}
+
+TEST (TemporalFilterTest, FiltersCounts)
+{
+    const std::vector<int16_t> counts{2, 2, 5, 2, 2, 0, 0, 3, 3, 3, 0};
+    EXPECT_EQ (filter(counts, makeParams(FilterParams::Type::MaxPool, 3)),
+               (std::vector<int16_t>{2, 2, 5, 5, 5, 2, 2, 3, 3, 3, 3}));
+    // the spike is removed, the step is delayed by one image
+    EXPECT_EQ (filter(counts, makeParams(FilterParams::Type::Median, 3)),
+               (std::vector<int16_t>{2, 2, 2, 2, 2, 2, 0, 0, 3, 3, 3}));
+    // even windows are rounded up
+    EXPECT_EQ (filter(counts, makeParams(FilterParams::Type::Median, 2)),
+               filter(counts, makeParams(FilterParams::Type::Median, 3)));
+    EXPECT_EQ (filter(counts, makeParams(FilterParams::Type::Ema, 0, 0.5f)),
+               (std::vector<int16_t>{2, 2, 4, 3, 2, 1, 1, 2, 2, 3, 1}));
+    EXPECT_EQ (filter(counts, makeParams(FilterParams::Type::None, 3)), counts);
+}
+
+TEST (TemporalFilterTest, KernelsMatchScalarReference)
+{
+    std::vector<int16_t> seq;
+    for (uint32_t k = 0; k < 1000; k++)
+    {
+        seq.push_back(int16_t(k * k / 7));
+    }
+    for (auto type : {FilterParams::Type::MaxPool, FilterParams::Type::Median})
+    {
+        for (auto isa : {CpuDispatch::Isa::Sse42, CpuDispatch::Isa::Avx2, CpuDispatch::Isa::Avx512})
+        {
+            if (isa > CpuDispatch::detectIsa())
+            {
+                break;
+            }
+            auto reference = TemporalFilterKernels::windowKernel(type, CpuDispatch::Isa::Scalar);
+            auto kernel = TemporalFilterKernels::windowKernel(type, isa);
+            for (uint32_t window : {1u, 3u, 5u, 9u, 15u})
+            {
+                for (uint32_t n : {0u, 1u, 15u, 16u, 33u, 65u, 900u})
+                {
+                    std::vector<int16_t> expected(n), out(n);
+                    reference(seq.data(), n, window, expected.data());
+                    kernel(seq.data(), n, window, out.data());
+                    ASSERT_EQ (expected, out) << CpuDispatch::isaName(isa) << " window " << window << " n " << n;
+                }
+            }
+        }
+    }
+}
+
+TEST (TemporalFilterTest, IncrementalMatchesWholeColumn)
+{
+    std::vector<int16_t> counts;
+    for (uint32_t k = 0; k < 5000; k++)
+    {
+        counts.push_back(int16_t((k * k / 13) % 9));
+    }
+    for (auto params : {makeParams(FilterParams::Type::MaxPool, 8), makeParams(FilterParams::Type::Median, 7),
+                        makeParams(FilterParams::Type::Ema, 0, 0.1f)})
+    {
+        auto expected = filter(counts, params);
+        TemporalFilter temporalFilter(params);
+        std::vector<int16_t> out(counts.size());
+        // pieces shorter than the window, filtered in place
+        std::copy(counts.begin(), counts.end(), out.begin());
+        for (uint32_t from = 0; from < counts.size(); )
+        {
+            uint32_t n = std::min<uint32_t>(1 + from % 97, counts.size() - from);
+            temporalFilter.apply(out.data() + from, n, out.data() + from);
+            from += n;
+        }
+        EXPECT_EQ (temporalFilter.numFrames(), counts.size());
+        EXPECT_EQ (expected, out);
+    }
+}
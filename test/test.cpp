@@ -29,6 +29,197 @@ TEST (EvalFastRcnnResnet101Test, Example1)
     }
 }
 
+/**
+ * \brief Compare the batch evaluation of class_ids against a scalar reference
+ */
+static void checkBatchAgainstReference(const std::vector<int>& class_ids)
+{
+    const int threshold = 30;
+    /* lengths around the chunk size exercise the masked tail */
+    const std::vector<uint32_t> lengths{0, 1, 9, 31, 32, 33, 63, 64, 65, 100, 300};
+    std::vector<EvalFastRcnnResnet101::UParser> examples(lengths.size());
+    std::vector<const EvalFastRcnnResnet101::UParser*> batch;
+    for (size_t k = 0; k < lengths.size(); k++)
+    {
+        std::string scores, classes;
+        for (uint32_t n = 0; n < lengths[k]; n++)
+        {
+            scores.push_back(static_cast<char>((n * 37 + k) % 101));
+            classes.push_back(static_cast<char>((n * 7 + k) % 97));
+        }
+        examples[k].set_num_detections(lengths[k]);
+        examples[k].set_scores(scores);
+        examples[k].set_classes(classes);
+        batch.push_back(&examples[k]);
+    }
+
+    std::vector< std::vector<int8_t> > columns(class_ids.size(), std::vector<int8_t>(batch.size()));
+    std::vector<int8_t*> valid_det;
+    for (auto& column : columns)
+    {
+        valid_det.push_back(column.data());
+    }
+    ASSERT_TRUE (EvalFastRcnnResnet101::calcNumDetections(batch.data(), batch.size(), class_ids,
+                                                           threshold, valid_det.data()));
+    /* score levels as used for the threshold slider */
+    std::vector<int> thresholds;
+    for (int t = 0; t <= 100; t += 5)
+    {
+        thresholds.push_back(t);
+    }
+    auto reference = [&](size_t k, int class_id, int t) {
+        int expected = 0;
+        for (uint32_t n = 0; n < lengths[k]; n++)
+        {
+            expected += examples[k].classes()[n] == class_id && examples[k].scores()[n] > t;
+        }
+        return expected;
+    };
+    std::vector<uint32_t> counts(class_ids.size() * thresholds.size());
+    for (size_t k = 0; k < batch.size(); k++)
+    {
+        for (size_t m = 0; m < class_ids.size(); m++)
+        {
+            ASSERT_EQ (columns[m][k], reference(k, class_ids[m], threshold)) << "example " << k << " class " << class_ids[m];
+        }
+        /* all kernels supported by this CPU agree with the reference */
+        for (auto isa : {CpuDispatch::Isa::Scalar, CpuDispatch::Isa::Sse42, CpuDispatch::Isa::Avx2, CpuDispatch::Isa::Avx512})
+        {
+            if (isa > CpuDispatch::detectIsa())
+            {
+                break;
+            }
+            EvalFastRcnnResnet101::countKernel(isa)(examples[k].scores().data(), examples[k].classes().data(),
+                    lengths[k], thresholds.data(), thresholds.size(), class_ids.data(), class_ids.size(), counts.data());
+            for (size_t m = 0; m < class_ids.size(); m++)
+            {
+                for (size_t l = 0; l < thresholds.size(); l++)
+                {
+                    ASSERT_EQ (counts[m * thresholds.size() + l], uint32_t(reference(k, class_ids[m], thresholds[l])))
+                        << CpuDispatch::isaName(isa) << " example " << k << " threshold " << thresholds[l];
+                }
+            }
+        }
+    }
+
+    std::vector< std::vector<uint8_t> > levelColumns(class_ids.size(), std::vector<uint8_t>(batch.size() * thresholds.size()));
+    std::vector<uint8_t*> levels;
+    for (auto& column : levelColumns)
+    {
+        levels.push_back(column.data());
+    }
+    ASSERT_TRUE (EvalFastRcnnResnet101::calcScoreLevels(batch.data(), batch.size(), class_ids,
+                                                         thresholds, levels.data()));
+    for (size_t k = 0; k < batch.size(); k++)
+    {
+        for (size_t m = 0; m < class_ids.size(); m++)
+        {
+            ASSERT_EQ (levelColumns[m][k * thresholds.size() + 6], reference(k, class_ids[m], 30));
+        }
+    }
+}
+
+TEST (EvalFastRcnnResnet101Test, BatchMatchesScalarReference)
+{
+    checkBatchAgainstReference({1,2});
+}
+
+TEST (EvalFastRcnnResnet101Test, ManyClassesMatchScalarReference)
+{
+    /* 90 COCO classes are counted in a histogram */
+    std::vector<int> class_ids;
+    for (int c = 1; c <= 90; c++)
+    {
+        class_ids.push_back(c);
+    }
+    /* classes listed twice get the same counts */
+    class_ids.push_back(7);
+    checkBatchAgainstReference(class_ids);
+}
+
+TEST (EvalFastRcnnResnet101Test, SpecializedKernelsMatchGeneric)
+{
+    typedef EvalFastRcnnResnet101::DefaultConfig Config;
+    const std::vector<int> class_ids(Config::Classes::ids.begin(), Config::Classes::ids.end());
+    const std::vector<int> thresholds(Config::Thresholds::values.begin(), Config::Thresholds::values.end());
+    auto scalar = EvalFastRcnnResnet101::countKernel(CpuDispatch::Isa::Scalar);
+    std::vector<uint32_t> expected(class_ids.size() * thresholds.size());
+    std::vector<uint32_t> counts(expected.size());
+    for (uint32_t length : {0, 1, 15, 16, 17, 31, 32, 33, 64, 65, 200})
+    {
+        std::string scores, classes;
+        for (uint32_t n = 0; n < length; n++)
+        {
+            scores.push_back(static_cast<char>((n * 37 + length) % 101));
+            classes.push_back(static_cast<char>((n * 3 + length) % 4));
+        }
+        scalar(scores.data(), classes.data(), length, thresholds.data(), thresholds.size(),
+               class_ids.data(), class_ids.size(), expected.data());
+        for (auto isa : {CpuDispatch::Isa::Sse42, CpuDispatch::Isa::Avx2, CpuDispatch::Isa::Avx512})
+        {
+            if (isa > CpuDispatch::detectIsa())
+            {
+                break;
+            }
+            auto kernel = EvalFastRcnnResnet101::fixedCountKernel<Config>(isa);
+            ASSERT_NE (kernel, nullptr);
+            /* the specialized kernel ignores the classes and thresholds passed at runtime */
+            kernel(scores.data(), classes.data(), length, nullptr, 0, nullptr, 0, counts.data());
+            ASSERT_EQ (counts, expected) << CpuDispatch::isaName(isa) << " length " << length;
+        }
+    }
+}
+
+TEST (EvalFastRcnnResnet101Test, KernelsCountNoDetections)
+{
+    typedef EvalFastRcnnResnet101::DefaultConfig Config;
+    const std::vector<int> class_ids(Config::Classes::ids.begin(), Config::Classes::ids.end());
+    const std::vector<int> thresholds(Config::Thresholds::values.begin(), Config::Thresholds::values.end());
+    for (auto isa : {CpuDispatch::Isa::Scalar, CpuDispatch::Isa::Sse42, CpuDispatch::Isa::Avx2, CpuDispatch::Isa::Avx512})
+    {
+        if (isa > CpuDispatch::detectIsa())
+        {
+            break;
+        }
+        /* an empty repeated field has no data */
+        std::vector<uint32_t> counts(class_ids.size() * thresholds.size(), 99);
+        EvalFastRcnnResnet101::countKernel(isa)(nullptr, nullptr, 0, thresholds.data(), thresholds.size(),
+                                                class_ids.data(), class_ids.size(), counts.data());
+        EXPECT_EQ (counts, std::vector<uint32_t>(counts.size(), 0)) << CpuDispatch::isaName(isa);
+        auto kernel = EvalFastRcnnResnet101::fixedCountKernel<Config>(isa);
+        if (kernel != nullptr)
+        {
+            std::fill(counts.begin(), counts.end(), 99);
+            kernel(nullptr, nullptr, 0, nullptr, 0, nullptr, 0, counts.data());
+            EXPECT_EQ (counts, std::vector<uint32_t>(counts.size(), 0)) << CpuDispatch::isaName(isa);
+        }
+    }
+}
+
+TEST (EvalFastRcnnResnet101Test, RegistryMatchesClassesAndThresholds)
+{
+    auto& registry = EvalFastRcnnResnet101::registry();
+    std::vector<int> thresholds;
+    for (int t = 0; t <= 100; t += 5)
+    {
+        thresholds.push_back(t);
+    }
+    const std::vector<int> registered{1,2};
+    const std::vector<int> other{1,3};
+    bool specialized = CpuDispatch::isa() > CpuDispatch::Isa::Scalar;
+    EXPECT_EQ (registry.find(registered.data(), registered.size(), thresholds.data(), thresholds.size()) != nullptr, specialized);
+    EXPECT_EQ (registry.find(other.data(), other.size(), thresholds.data(), thresholds.size()), nullptr);
+    EXPECT_EQ (registry.find(registered.data(), registered.size(), thresholds.data(), 1), nullptr);
+}
+
+TEST (EvalConfigTest, ThresholdStep)
+{
+    EXPECT_EQ ((ThresholdRange<0,100,5>::step()), 5);
+    EXPECT_EQ ((ThresholdRange<10,90,20>::step()), 20);
+    EXPECT_EQ ((ThresholdSet<0,5,15>::step()), 0);
+    EXPECT_EQ ((ThresholdSet<50>::step()), 0);
+}
+
 
 int main(int argc, char** argv)
 {
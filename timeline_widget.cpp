@@ -0,0 +1,148 @@
+#include "timeline_widget.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+#include <QPainter>
+#include <QPen>
+#include <QColor>
+
+using namespace std;
+
+/*******************************************************************************************/
+/* TimelineWidget */
+
+TimelineWidget::TimelineWidget(QWidget *parent):QWidget(parent)
+{
+    setAttribute(Qt::WA_OpaquePaintEvent);
+    setMinimumHeight(40);
+}
+
+void TimelineWidget::setLanes(const QStringList& names, EnvelopeFn envelope)
+{
+    m_laneNames = names;
+    m_envelope = std::move(envelope);
+    invalidate();
+}
+
+void TimelineWidget::setNumImages(uint32_t numImages)
+{
+    m_numImages = numImages;
+    m_position = std::min(m_position, numImages > 0 ? numImages - 1 : 0);
+    update();
+}
+
+void TimelineWidget::setPosition(uint32_t idx)
+{
+    int oldX = cursorX(m_position);
+    m_position = idx;
+    int newX = cursorX(m_position);
+    if (oldX != newX)
+    {
+        /* only the shade between both cursors and the cursors themselves change */
+        update(std::min(oldX, newX) - 2, 0, std::abs(newX - oldX) + 5, height());
+    }
+}
+
+void TimelineWidget::invalidate()
+{
+    m_dataLayerValid = false;
+    update();
+}
+
+void TimelineWidget::paintEvent(QPaintEvent* event)
+{
+    if ( !m_dataLayerValid || m_dataLayer.size() != size() )
+    {
+        paintDataLayer();
+    }
+    QPainter painter(this);
+    const QRect& rect = event->rect();
+    painter.drawPixmap(rect, m_dataLayer, rect);
+    if (m_numImages == 0)
+    {
+        return;
+    }
+    // overlay the images up to the current one
+    int x = cursorX(m_position);
+    painter.fillRect(QRect(0, 0, x, height()).intersected(rect), QColor(0x05, 0x96, 0x05, 60));
+    painter.setPen(QPen(QColor(0x059605), 2));
+    painter.drawLine(x, 0, x, height());
+}
+
+void TimelineWidget::mousePressEvent(QMouseEvent* event)
+{
+    if (m_numImages > 0 && event->button() == Qt::LeftButton)
+    {
+        emit positionRequested(imageAt(event->pos().x()));
+    }
+}
+
+void TimelineWidget::mouseMoveEvent(QMouseEvent* event)
+{
+    if (m_numImages > 0 && (event->buttons() & Qt::LeftButton))
+    {
+        emit positionRequested(imageAt(event->pos().x()));
+    }
+}
+
+void TimelineWidget::paintDataLayer()
+{
+    m_dataLayer = QPixmap(size());
+    m_dataLayer.fill(palette().color(QPalette::Base));
+    m_dataLayerValid = true;
+    const int numLanes = m_laneNames.size();
+    if (numLanes == 0 || m_numImages == 0 || !m_envelope || width() == 0)
+    {
+        return;
+    }
+    QPainter painter(&m_dataLayer);
+    for (int lane = 0; lane < numLanes; lane++)
+    {
+        const int top = height() * lane / numLanes;
+        const int bottom = height() * (lane + 1) / numLanes;
+        const int laneHeight = bottom - top - 1;
+        // one bin per pixel column, the counts are scaled to the largest one of the lane
+        auto bins = m_envelope(lane, 0, m_numImages, width());
+        int16_t laneMax = 1;
+        for (const auto& bin : bins)
+        {
+            laneMax = std::max(laneMax, bin.max);
+        }
+        QColor color = QColor::fromHsv(360 * lane / numLanes, 200, 200);
+        QColor minColor = color.darker(150);
+        for (size_t b = 0; b < bins.size(); b++)
+        {
+            if (bins[b].max <= 0)
+            {
+                continue;
+            }
+            int x0 = width() * b / bins.size();
+            int x1 = width() * (b + 1) / bins.size();
+            int maxHeight = laneHeight * bins[b].max / laneMax;
+            int minHeight = laneHeight * std::max<int16_t>(bins[b].min, 0) / laneMax;
+            painter.fillRect(x0, bottom - 1 - maxHeight, x1 - x0, maxHeight, color);
+            painter.fillRect(x0, bottom - 1 - minHeight, x1 - x0, minHeight, minColor);
+        }
+        painter.setPen(palette().color(QPalette::Mid));
+        painter.drawLine(0, bottom - 1, width(), bottom - 1);
+        painter.setPen(palette().color(QPalette::Text));
+        painter.drawText(QRect(2, top, width() - 4, bottom - top), Qt::AlignLeft | Qt::AlignTop,
+                         QString("%1 (max %2)").arg(m_laneNames[lane]).arg(laneMax));
+    }
+}
+
+int TimelineWidget::cursorX(uint32_t idx) const
+{
+    if (m_numImages == 0)
+    {
+        return 0;
+    }
+    return std::min(width() - 1, int((idx + 0.5) * width() / m_numImages));
+}
+
+uint32_t TimelineWidget::imageAt(int x) const
+{
+    x = std::clamp(x, 0, std::max(width() - 1, 0));
+    return std::min<uint64_t>(m_numImages - 1, uint64_t(x) * m_numImages / std::max(width(), 1));
+}
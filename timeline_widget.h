@@ -0,0 +1,97 @@
+#ifndef TIMELINE_WIDGET_H
+#define TIMELINE_WIDGET_H
+
+#include <QWidget>
+#include <QPixmap>
+#include <QStringList>
+#include <QPaintEvent>
+#include <QMouseEvent>
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "min_max_pyramid.h"
+
+using namespace std;
+
+/**
+ * \brief Overview of the number of detections of all images, one lane per class
+ *
+ * \details
+ *      The lanes are painted into a pixmap, which is only repainted after the
+ *      data or the size changed. Moving the position only repaints the pixel
+ *      columns between the old and the new cursor from the pixmap, so the cost
+ *      of a step does not depend on the number of images or classes.
+ */
+class TimelineWidget : public QWidget
+{
+    Q_OBJECT
+public:
+    /* minimum and maximum count of lane for numBins equal parts of the images [from, to) */
+    typedef std::function<std::vector<MinMax>(unsigned lane, uint32_t from, uint32_t to, uint32_t numBins)> EnvelopeFn;
+
+    explicit TimelineWidget(QWidget *parent = nullptr);
+
+    /**
+     * \brief Show a lane per name, whose counts are queried from envelope
+     */
+    void setLanes(const QStringList& names, EnvelopeFn envelope);
+
+    /**
+     * \brief Number of images spanned by the timeline
+     *
+     * \details
+     *      Only the cursor is moved, the lanes are repainted by invalidate(), so
+     *      that growing during a load does not query the counts for every batch.
+     */
+    void setNumImages(uint32_t numImages);
+
+    /**
+     * \brief Move the cursor to image idx
+     */
+    void setPosition(uint32_t idx);
+
+public slots:
+    /**
+     * \brief Repaint the lanes, e.g. after the counts changed
+     */
+    void invalidate();
+
+protected:
+    void paintEvent(QPaintEvent* event);
+    void mousePressEvent(QMouseEvent* event);
+    void mouseMoveEvent(QMouseEvent* event);
+
+private:
+    /**
+     * \brief Paint all lanes into m_dataLayer
+     */
+    void paintDataLayer();
+
+    /**
+     * \brief Pixel column of the cursor at image idx
+     */
+    int cursorX(uint32_t idx) const;
+
+    /**
+     * \brief Image at pixel column x
+     */
+    uint32_t imageAt(int x) const;
+
+    QStringList m_laneNames;
+    EnvelopeFn m_envelope;
+    uint32_t m_numImages = 0;
+    uint32_t m_position = 0;
+    QPixmap m_dataLayer;
+    bool m_dataLayerValid = false;
+
+signals:
+    /**
+     * \brief Emitted, when the user clicks or drags to image idx
+     */
+    void positionRequested(int idx);
+};
+
+#endif /* TIMELINE_WIDGET_H */
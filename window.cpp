@@ -1,5 +1,7 @@
 #include <memory>
 #include <iostream>
+#include <algorithm>
+#include <cmath>
 
 #include <QMessageBox>
 #include <QFileDialog>
@@ -37,13 +39,16 @@ Window::Window(QWidget *parent):QMainWindow(parent),
                                 m_mainWidget(new QWidget),
                                 m_numDetectionsChart(new QChart),
                                 m_detectionsSeries(new QLineSeries),
-                                m_shadedArea(new QAreaSeries),
                                 m_numDetectionsView(new QChartView),
                                 axisX(new QValueAxis),
+                                axisY(new QValueAxis),
+                                m_timeline(new TimelineWidget),
                                 m_imageWidget(new ImageLabel),
                                 m_scrollArea(new QScrollArea),
                                 m_layout(new QVBoxLayout),
                                 m_slider(new QSlider),
+                                m_thresholdSlider(new QSlider),
+                                m_thresholdLabel(new QLabel),
                                 m_prevPoiButton(new QPushButton),
                                 m_nextPoiButton(new QPushButton),
                                 m_resetNumDetectionsButton(new QPushButton),
@@ -61,11 +66,6 @@ Window::Window(QWidget *parent):QMainWindow(parent),
     m_scrollArea->setAlignment(Qt::AlignHCenter | Qt::AlignVCenter);
     m_scrollArea->setVisible(false);
 
-    // Add shaded area in graph
-    QPen pen(0x059605);
-    pen.setWidth(3);
-    m_shadedArea->setPen(pen);
-
     // Add detections chart
     m_detectionsSeries->append(QPoint(0, 0));
     m_detectionsSeries->append(QPoint(1, 0));
@@ -73,7 +73,6 @@ Window::Window(QWidget *parent):QMainWindow(parent),
     m_detectionsSeries->append(QPoint(3, 4));
     m_detectionsSeries->append(QPoint(4, 3));
     m_detectionsSeries->append(QPoint(5, 10));
-    m_numDetectionsChart->addSeries(m_shadedArea);
     m_numDetectionsChart->addSeries(m_detectionsSeries);
     m_numDetectionsChart->legend()->setVisible(false);
     m_numDetectionsChart->setMargins(QMargins(1,1,1,1));
@@ -81,8 +80,12 @@ Window::Window(QWidget *parent):QMainWindow(parent),
     axisX->setGridLineVisible(false);
     axisX->setTickCount(30);
     axisX->setRange(0, 40);  
-    //m_detectionsSeries->attachAxis(axisX);
     m_numDetectionsChart->addAxis(axisX, Qt::AlignBottom);
+    /* the counts are scaled to the visible range, the axis is not shown */
+    axisY->setVisible(false);
+    m_numDetectionsChart->addAxis(axisY, Qt::AlignLeft);
+    m_detectionsSeries->attachAxis(axisX);
+    m_detectionsSeries->attachAxis(axisY);
 
     m_numDetectionsView->setChart(m_numDetectionsChart);
     m_numDetectionsView->setRenderHint(QPainter::Antialiasing);
@@ -92,6 +95,11 @@ Window::Window(QWidget *parent):QMainWindow(parent),
     m_numDetectionsView->setSizePolicy(QSizePolicy::Preferred, QSizePolicy::Maximum);
     m_numDetectionsView->setVisible(false);
 
+    // Add timeline of all classes, that shows the current position
+    m_timeline->setMaximumHeight(80);
+    m_timeline->setSizePolicy(QSizePolicy::Preferred, QSizePolicy::Maximum);
+    m_timeline->setVisible(false);
+
     // Create horizontal slider
     m_slider->setOrientation(Qt::Horizontal);
     m_slider->setRange(0,100);
@@ -108,14 +116,34 @@ Window::Window(QWidget *parent):QMainWindow(parent),
     m_resetNumDetectionsButton->setSizePolicy(QSizePolicy::Preferred, QSizePolicy::Maximum);
     m_checkBox->setText("Mis&detection");
     m_checkBox->setEnabled(false);
+
+    // Create score threshold slider, disabled while loading
+    shared_ptr< DataModel<DataModelProtoBuf <EvalFastRcnnResnet101>> > model = DataModelProtoBuf<EvalFastRcnnResnet101>::getInstance();
+    m_thresholdSlider->setOrientation(Qt::Horizontal);
+    /* one step per threshold level, for which the model keeps the counts */
+    typedef EvalFastRcnnResnet101::DefaultConfig::Thresholds Thresholds;
+    m_thresholdSlider->setRange(Thresholds::values.front(), Thresholds::values.back());
+    m_thresholdSlider->setSingleStep(Thresholds::step());
+    m_thresholdSlider->setPageStep(10);
+    m_thresholdSlider->setValue(model->getThreshold());
+    m_thresholdSlider->setMaximumWidth(150);
+    m_thresholdSlider->setFocusPolicy(Qt::NoFocus);
+    m_thresholdSlider->setEnabled(false);
+    /* while dragging, the threshold is only applied once the slider is released */
+    m_thresholdSlider->setTracking(false);
+    m_thresholdLabel->setText(tr("Threshold: %1").arg(model->getThreshold()));
+
     buttonLayout->addWidget(m_prevPoiButton);
     buttonLayout->addWidget(m_nextPoiButton);
     buttonLayout->addWidget(m_checkBox);
+    buttonLayout->addWidget(m_thresholdLabel);
+    buttonLayout->addWidget(m_thresholdSlider);
     buttonLayout->addWidget(m_resetNumDetectionsButton);
     
     // add QWidgets to layout
     m_layout->addWidget(m_scrollArea);
     m_layout->addWidget(m_numDetectionsView);
+    m_layout->addWidget(m_timeline);
     m_layout->addWidget(m_slider);
     m_layout->addLayout(buttonLayout);
     m_mainWidget->setLayout(m_layout);
@@ -129,40 +157,66 @@ Window::Window(QWidget *parent):QMainWindow(parent),
     // setup timer
     m_zoomTmr = make_unique<QTimer>();
     m_zoomTmr->setSingleShot(true);
+    m_timelineTmr = make_unique<QTimer>();
+    m_timelineTmr->setSingleShot(true);
 
     // connect signals
     connect( m_slider, SIGNAL( valueChanged(int) ), this, SLOT( updateImage(int) ) );
     connect( m_imageWidget, SIGNAL( mouseWheelUp() ), this, SLOT( zoomIn() ) );
     connect( m_imageWidget, SIGNAL( mouseWheelDown() ), this, SLOT( zoomOut() ) );
-    connect( this, SIGNAL( detectionSeriesUpdated(QLineSeries*) ), this, SLOT( updateDetectionSeries(QLineSeries*) ) );
+    connect( this, SIGNAL( detectionsLoaded(unsigned) ), this, SLOT( appendDetections(unsigned) ) );
+    connect( this, SIGNAL( loadFinished() ), this, SLOT( enableThreshold() ) );
+    connect( m_thresholdSlider, SIGNAL( valueChanged(int) ), this, SLOT( changeThreshold(int) ) );
     connect( m_nextPoiButton, SIGNAL( clicked() ), this, SLOT( getNextPointOfInterest() ) );
     connect( m_prevPoiButton, SIGNAL( clicked() ), this, SLOT( getPreviousPointOfInterest() ) );
     connect( m_resetNumDetectionsButton, SIGNAL( clicked() ), this, SLOT( resetNumDetectionsView() ) );
+    connect( axisX, SIGNAL( rangeChanged(qreal, qreal) ), this, SLOT( updateDetectionSeries() ) );
+    connect( m_timeline, SIGNAL( positionRequested(int) ), m_slider, SLOT( setValue(int) ) );
     connect( m_checkBox, SIGNAL( clicked(bool) ), this, SLOT( flagAsMisdetection(bool) ) );
     connect( m_zoomTmr.get(), SIGNAL( timeout() ), this, SLOT( setupImgDelayed() ) );
+    connect( m_timelineTmr.get(), SIGNAL( timeout() ), m_timeline, SLOT( invalidate() ) );
 
     resize(QGuiApplication::primaryScreen()->availableSize() * 3 / 5);
 }
 
+Window::~Window()
+{
+    shared_ptr< DataModel<DataModelProtoBuf <EvalFastRcnnResnet101>> > model = DataModelProtoBuf<EvalFastRcnnResnet101>::getInstance();
+    model->cancelLoad();
+}
+
 bool Window::loadFile(const QString& fileName)
 {
     std::cout << "opening file " << fileName.toStdString() << std::endl;
     shared_ptr< DataModel<DataModelProtoBuf <EvalFastRcnnResnet101>> > model = DataModelProtoBuf<EvalFastRcnnResnet101>::getInstance();
     
     model->open(fileName.toStdString());
-    /* load data asynchronously */
-    auto futptr = std::make_shared<std::future<void>>();
-    /* create line object, to be filled in thread (all QWidgets need to be owned by the main thread) */
-    QLineSeries* series = new QLineSeries;
-    *futptr = std::async(std::launch::async, [this,futptr,model,series](){
-        model->load();
-        auto dets = model->getNumDetections(0);
-        size_t numDataLoad = dets.size();
-        for (unsigned x = 0; x < numDataLoad; x++)
+    /* drop the chart of the previous file, it is filled again while loading */
+    m_detectionsSeries->clear();
+    m_numDetectionsChart->zoomReset();
+    m_numPlotted = 0;
+    QStringList laneNames;
+    for (int classId : model->getClassIds())
+    {
+        laneNames.append(tr("class %1").arg(classId));
+    }
+    m_timeline->setLanes(laneNames, [model](unsigned lane, uint32_t from, uint32_t to, uint32_t numBins) {
+        return model->getNumDetectionsEnvelope(lane, from, to, numBins);
+    });
+    m_timelineTmr->stop();
+    m_timeline->setNumImages(0);
+    m_thresholdSlider->setEnabled(false);
+    /* the callback is invoked by the loading thread, the chart is extended by the main thread */
+    model->setLoadCallback([this](uint32_t numLoaded, bool finished){
+        emit this->detectionsLoaded(numLoaded);
+        if (finished)
         {
-            series->append(QPoint(x, dets[x]));
+            emit this->loadFinished();
         }
-        emit this->detectionSeriesUpdated(series);
+    });
+    /* load data asynchronously, open() has stopped the load of the previous file */
+    m_loadFuture = std::async(std::launch::async, [model](){
+        model->load();
     });
 
     QString qimgPathStr = QString::fromStdString( model->getItemByIdx(0).string() );
@@ -184,7 +238,11 @@ bool Window::loadFile(const QString& fileName)
         .arg(QDir::toNativeSeparators(fileName)).arg(m_image.width()).arg(m_image.height()).arg(m_image.depth());
     statusBar()->showMessage(message);
     // create annotation object
-    auto path = fs::path(fileName.toStdString()).parent_path();
+    auto path = fs::path(fileName.toStdString());
+    if ( !fs::is_directory(path) )
+    {
+        path = path.parent_path();
+    }
     auto anno_file = path / string("annotations");
     m_annotations = make_unique<Annotations>(anno_file);
     return true;
@@ -204,6 +262,7 @@ void Window::setImage(const QImage &newImage)
     m_imageWidget->setPixmap( QPixmap::fromImage(m_image) );
     m_scrollArea->setVisible(true);
     m_numDetectionsView->setVisible(true);
+    m_timeline->setVisible(true);
     m_fitToWindowAct->setEnabled(true);
     updateActions();
 
@@ -219,8 +278,11 @@ void Window::createActions()
     QMenu* fileMenu = menuBar()->addMenu(tr("&File"));
     m_openAct = fileMenu->addAction(tr("&Open"), this, &Window::open);
     m_openAct->setShortcut(QKeySequence::Open);
+    m_openDirAct = fileMenu->addAction(tr("Open &directory"), this, &Window::openDirectory);
     m_exportCsvAct = fileMenu->addAction(tr("&Export to csv"), this, &Window::exportFile);
     m_exportCsvAct->setEnabled(false);
+    m_followAct = fileMenu->addAction(tr("&Follow file"), this, &Window::followFile);
+    m_followAct->setCheckable(true);
     fileMenu->addSeparator();
     unique_ptr<QAction> exitAct( fileMenu->addAction(tr("E&xit"), this, &Window::close) );
     // View menu
@@ -329,12 +391,26 @@ void Window::open()
     while (dialog.exec() == QDialog::Accepted && !loadFile(dialog.selectedFiles().first())) {}
 }
 
+void Window::openDirectory()
+{
+    QFileDialog dialog(this, tr("Open Directory"));
+    dialog.setFileMode(QFileDialog::Directory);
+    dialog.setOption(QFileDialog::ShowDirsOnly);
+    while (dialog.exec() == QDialog::Accepted && !loadFile(dialog.selectedFiles().first())) {}
+}
+
 void Window::exportFile()
 {
 	QString fileName = QFileDialog::getSaveFileName(this, tr("Export csv"));
 	saveToCsv(fileName);
 }
 
+void Window::followFile(bool isChecked)
+{
+    shared_ptr< DataModel<DataModelProtoBuf <EvalFastRcnnResnet101>> > model = DataModelProtoBuf<EvalFastRcnnResnet101>::getInstance();
+    model->setFollowMode(isChecked);
+}
+
 void Window::zoomIn()
 {
     scaleImage(1.25);
@@ -382,36 +458,85 @@ void Window::updateImage(int value)
     const QImage newImage = reader.read();
     if (!newImage.isNull()) 
     {
-        QLineSeries* top    = new QLineSeries();
-        QLineSeries* bottom = new QLineSeries();
-        top->append(QPoint(0,3));
-        top->append(QPoint(value,3));
-        bottom->append(QPoint(0,0));
-        bottom->append(QPoint(value,0));
-        m_shadedArea->setLowerSeries(bottom);
-        m_shadedArea->setUpperSeries(top);
-        if ( !(m_shadedArea->attachedAxes()).count() )
+        m_timeline->setPosition(value);
+        setImage(newImage);
+    }
+}
+
+void Window::appendDetections(unsigned numLoaded)
+{
+    if (numLoaded <= m_numPlotted)
+    {
+        return;
+    }
+    uint32_t numPlotted = m_numPlotted;
+    m_numPlotted = numLoaded;
+    this->m_slider->setRange(0, m_numPlotted - 1);
+    m_timeline->setNumImages(m_numPlotted);
+    /* the lanes of all batches loaded in the meantime are repainted at once */
+    if ( !m_timelineTmr->isActive() )
+    {
+        m_timelineTmr->start(100);
+    }
+    if ( !m_numDetectionsChart->isZoomed() )
+    {
+        /* the series is updated, once the axis shows all images */
+        this->axisX->setTickCount(11);
+        this->axisX->setRange(0, m_numPlotted);
+    }
+    else if (this->axisX->max() > numPlotted)
+    {
+        updateDetectionSeries();
+    }
+}
+
+void Window::updateDetectionSeries()
+{
+    shared_ptr< DataModel<DataModelProtoBuf <EvalFastRcnnResnet101>> > model = DataModelProtoBuf<EvalFastRcnnResnet101>::getInstance();
+    uint32_t from = uint32_t(std::max(0.0, std::floor(axisX->min())));
+    uint32_t to = uint32_t(std::min<double>(m_numPlotted, std::ceil(axisX->max()) + 1));
+    if (from >= to)
+    {
+        m_detectionsSeries->clear();
+        return;
+    }
+    /* the minimum and maximum per pixel column yield the same plot as all images */
+    uint32_t numBins = std::max(m_numDetectionsView->width(), 1);
+    auto bins = model->getNumDetectionsEnvelope(0, from, to, numBins);
+    QVector<QPointF> points;
+    points.reserve(2 * bins.size());
+    MinMax range;
+    range.add(int16_t(0));
+    for (size_t b = 0; b < bins.size(); b++)
+    {
+        double x = from + double(to - from) * b / bins.size();
+        points.append(QPointF(x, bins[b].min));
+        if (bins[b].max != bins[b].min)
         {
-            m_shadedArea->attachAxis(this->axisX);
+            points.append(QPointF(x, bins[b].max));
         }
-        setImage(newImage);
+        range.add(bins[b]);
     }
+    m_detectionsSeries->replace(points);
+    axisY->setRange(range.min, std::max<int>(range.max, 1));
+}
+
+void Window::enableThreshold()
+{
+    m_thresholdSlider->setEnabled(true);
 }
 
-void Window::updateDetectionSeries(QLineSeries* newSeries)
+void Window::changeThreshold(int value)
 {
-    auto numDataLoad = newSeries->count();
-    this->m_slider->setRange(0,numDataLoad);
-    this->axisX->setTickCount(11);
-    this->axisX->setRange(0, numDataLoad);  
-    // update series
-    if (m_detectionsSeries)
+    shared_ptr< DataModel<DataModelProtoBuf <EvalFastRcnnResnet101>> > model = DataModelProtoBuf<EvalFastRcnnResnet101>::getInstance();
+    if ( !model->setThreshold(value) )
     {
-        m_numDetectionsChart->removeSeries(m_detectionsSeries);
-        delete m_detectionsSeries;
+        return;
     }
-    m_numDetectionsChart->addSeries(newSeries);
-    m_detectionsSeries = newSeries;
+    m_thresholdLabel->setText(tr("Threshold: %1").arg(model->getThreshold()));
+    /* the whole chart changes */
+    updateDetectionSeries();
+    m_timeline->invalidate();
 }
 
 void Window::getNextPointOfInterest()
@@ -464,4 +589,6 @@ void Window::flagAsMisdetection(bool isChecked)
 void Window::resetNumDetectionsView()
 {
     m_numDetectionsChart->zoomReset();
+    /* images may have been loaded since zooming in */
+    axisX->setRange(0, m_numPlotted);
 }
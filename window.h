@@ -15,13 +15,14 @@
 #include <QScrollBar>
 #include <QLineSeries>
 #include <QValueAxis>
-#include <QAreaSeries>
 #include <QTimer>
 #include <QCheckBox>
 
 #include <memory>
+#include <future>
 
 #include "image_label.h"
+#include "timeline_widget.h"
 #include "annotations.h"
 
 using namespace QtCharts;
@@ -34,6 +35,11 @@ class Window : public QMainWindow
 public:
     explicit Window(QWidget *parent = nullptr);
 
+    /**
+     * \brief Stop loading, the load callback refers to this window
+     */
+    ~Window();
+
 protected:
     bool eventFilter(QObject *obj, QEvent *event);
 
@@ -45,6 +51,8 @@ private:
     
     /**
      * \brief Load a protobuf file, containing metadate of detection results.
+     *
+     * fileName may also be a directory of record files, see DataModelProtoBuf::open()
      */
     bool loadFile(const QString &fileName);
 
@@ -83,28 +91,39 @@ private:
     double m_scaleFactor;
     double m_lastScaleFactor;
     uint32_t m_currentImgIdx = 0;
+    /* number of images covered by m_detectionsSeries */
+    uint32_t m_numPlotted = 0;
     unique_ptr<Annotations> m_annotations;
+    /* load of the opened file, running on its own thread */
+    std::future<void> m_loadFuture;
     fs::path m_imgPath;
 
     QWidget* m_mainWidget;
     QChart* m_numDetectionsChart;
     QLineSeries* m_detectionsSeries;
-    QAreaSeries* m_shadedArea;
     QChartView* m_numDetectionsView;
     QValueAxis* axisX;
+    QValueAxis* axisY;
+    TimelineWidget* m_timeline;
     ImageLabel* m_imageWidget;
     QScrollArea* m_scrollArea;
     QVBoxLayout* m_layout;
     QSlider* m_slider;
+    QSlider* m_thresholdSlider;
+    QLabel* m_thresholdLabel;
     QPushButton* m_prevPoiButton;
     QPushButton* m_nextPoiButton;
     QPushButton* m_resetNumDetectionsButton;
     QCheckBox* m_checkBox;
     unique_ptr<QTimer> m_zoomTmr;
+    // repaints the timeline at most every 100 ms while loading
+    unique_ptr<QTimer> m_timelineTmr;
     
     // Declare actions
     QAction* m_openAct;
+    QAction* m_openDirAct;
     QAction* m_exportCsvAct;
+    QAction* m_followAct;
     QAction* m_zoomInAct;
     QAction* m_zoomOutAct;
     QAction* m_normalSizeAct;
@@ -118,11 +137,21 @@ private slots:
      */
     void open();
 
+    /**
+     * \brief Slot for File->Open directory dialog, all record files of the directory are loaded
+     */
+    void openDirectory();
+
     /**
      * \brief Export file to csv.
      */ 
     void exportFile();
  
+    /**
+     * \brief Keep loading images appended to the opened file
+     */
+    void followFile(bool);
+ 
     /**
      * \brief Increase m_scaleFactor
      */
@@ -153,7 +182,25 @@ private slots:
      */
     void updateImage(int);
 
-    void updateDetectionSeries(QLineSeries* newSeries);
+    /**
+     * \brief Extend the detections chart by the images loaded in the meantime
+     */
+    void appendDetections(unsigned numLoaded);
+
+    /**
+     * \brief Plot the minimum and maximum number of detections per pixel column of the visible images
+     */
+    void updateDetectionSeries();
+
+    /**
+     * \brief Allow changes of the score threshold once all images have been loaded
+     */
+    void enableThreshold();
+
+    /**
+     * \brief Recount detections and POIs for another score threshold
+     */
+    void changeThreshold(int);
     
     /**
      * \brief Query next point of interest from data model
@@ -180,7 +227,15 @@ private slots:
     void resetNumDetectionsView();
 
 signals:
-    void detectionSeriesUpdated(QLineSeries* newSeries);
+    /**
+     * \brief Emitted by the loading thread, whenever another batch of images has been loaded
+     */
+    void detectionsLoaded(unsigned numLoaded);
+
+    /**
+     * \brief Emitted by the loading thread, once all images have been loaded
+     */
+    void loadFinished();
     
 
 public slots: